@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hz/autotune.h>
+#include <hz/codec.h>
+#include <hz/trace.h>
+
+typedef struct autotune_candidate {
+	const char *chain;
+	int level;
+	// stage name in traces
+	const char *name;
+} autotune_candidate_t;
+
+// roughly from fastest to slowest, ties on the target go to the earlier one
+static const autotune_candidate_t candidates[] = {
+	{ "rle",             0, "rle" },
+	{ "huffman",         0, "huffman" },
+	{ "lzs",             1, "lzs -l1" },
+	{ "lzh",             1, "lzh -l1" },
+	{ "huffctx",         0, "huffctx" },
+	{ "lzs",             5, "lzs -l5" },
+	{ "lzh",             5, "lzh -l5" },
+	{ "shuffle4,lzh",    5, "shuffle4,lzh -l5" },
+	{ "shuffle8,lzh",    5, "shuffle8,lzh -l5" },
+	{ "delta4,lzh",      5, "delta4,lzh -l5" },
+	{ "lzh",             9, "lzh -l9" },
+	{ "bwt,rle,huffman", 4, "bwt,rle,huffman" },
+	{ "bwt,rle,huffctx", 4, "bwt,rle,huffctx" },
+};
+
+#define NUM_CANDIDATES (sizeof(candidates) / sizeof(candidates[0]))
+
+typedef struct autotune_result {
+	uint64_t coded;
+	// wall clock and process cpu time, bwt sorts on several threads
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+	double ratio;
+	double speed;
+} autotune_result_t;
+
+static uint64_t cpu_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool autotune_parse(const char *str, autotune_target_t *target) {
+	*target = (autotune_target_t) { .min_speed = 0, .min_ratio = 0 };
+
+	for (const char *p = str; *p;) {
+		char *end = NULL;
+		bool ratio = *p == 'x';
+		double x = strtod(p + ratio, &end);
+
+		if (end == p + ratio || x <= 0 || (*end && *end != ',')) {
+			return false;
+		}
+
+		*(ratio? &target->min_ratio : &target->min_speed) = x;
+		p = *end? end + 1 : end;
+	}
+
+	return target->min_speed > 0 || target->min_ratio > 0;
+}
+
+static void run_candidate(const autotune_candidate_t *cand,
+                          uint8_t *const *samples,
+                          const size_t *lengths,
+                          unsigned count,
+                          codec_ctx_t *ctx,
+                          autotune_result_t *result)
+{
+	uint8_t chain[CODEC_MAX_CHAIN];
+	unsigned chain_length = codec_parse_chain(cand->chain, chain, CODEC_MAX_CHAIN);
+	codec_opts_t opts = { .level = cand->level, .ctx = ctx };
+	uint64_t total = 0;
+
+	*result = (autotune_result_t) { .coded = 0 };
+
+	uint64_t trace = trace_begin();
+	uint64_t wall = trace_now();
+	uint64_t cpu = cpu_now();
+
+	for (unsigned i = 0; i < count; i++) {
+		uint8_t *coded = NULL;
+		size_t codedlen = 0;
+
+		// same as the frame, blocks that don't shrink are stored
+		if (!codec_chain_encode(chain, chain_length, &opts, samples[i],
+		                        lengths[i], &coded, &codedlen)
+		    || codedlen > lengths[i])
+		{
+			codedlen = lengths[i];
+		}
+
+		free(coded);
+		result->coded += codedlen;
+		total += lengths[i];
+	}
+
+	result->wall_ns = trace_now() - wall;
+	result->cpu_ns = cpu_now() - cpu;
+	trace_end("autotune", cand->name, trace, total);
+
+	result->ratio = result->coded? (double)total / result->coded : 0;
+	result->speed = result->wall_ns? total * 1e3 / result->wall_ns : 0;
+}
+
+static bool meets_target(const autotune_result_t *r,
+                         const autotune_target_t *target)
+{
+	return (target->min_speed <= 0 || r->speed >= target->min_speed)
+	    && (target->min_ratio <= 0 || r->ratio >= target->min_ratio);
+}
+
+// 2 if the result meets the whole target, 1 if it only meets the speed
+// part of a speed and ratio target, 0 otherwise
+static int target_rank(const autotune_result_t *r,
+                       const autotune_target_t *target)
+{
+	if (meets_target(r, target)) {
+		return 2;
+	}
+
+	return (target->min_speed > 0 && r->speed >= target->min_speed)? 1 : 0;
+}
+
+// compares results of the same rank. with a speed limit the ratio is what's
+// being maximized, otherwise the ratio floor is met and cpu time minimized.
+static bool better(const autotune_result_t *a, const autotune_result_t *b,
+                   const autotune_target_t *target, int rank)
+{
+	if (rank == 2) {
+		return (target->min_speed > 0)? a->ratio > b->ratio
+		                               : a->cpu_ns < b->cpu_ns;
+	}
+
+	// fast enough but short of the ratio, get as close to it as possible
+	if (rank == 1) {
+		return a->ratio > b->ratio;
+	}
+
+	// nothing is fast enough, or nothing meets a ratio on its own
+	return (target->min_speed > 0)? a->speed > b->speed
+	                               : a->ratio > b->ratio;
+}
+
+static void autotune_samples(uint8_t *const *samples,
+                             const size_t *lengths,
+                             unsigned count,
+                             frame_params_t *params,
+                             const autotune_target_t *target)
+{
+	autotune_result_t results[NUM_CANDIDATES];
+	int pick = -1;
+	int best = 0;
+
+	for (unsigned i = 0; i < NUM_CANDIDATES; i++) {
+		run_candidate(candidates + i, samples, lengths, count,
+		              params->opts.ctx, results + i);
+
+		int rank = target_rank(results + i, target);
+
+		if (pick < 0 || rank > best
+		    || (rank == best && better(results + i, results + pick,
+		                               target, rank)))
+		{
+			pick = i;
+			best = rank;
+		}
+	}
+
+	params->chain_length = codec_parse_chain(candidates[pick].chain,
+	                                         params->chain, CODEC_MAX_CHAIN);
+	params->opts.level = candidates[pick].level;
+	params->record_level = true;
+}
+
+bool autotune_fd(int fd, off_t offset, uint64_t length,
+                 frame_params_t *params, const autotune_target_t *target)
+{
+	uint8_t *samples[AUTOTUNE_SAMPLES];
+	size_t lengths[AUTOTUNE_SAMPLES];
+	unsigned count = 0;
+	bool ret = true;
+
+	// evenly spaced, the first one at the start and the last at the end
+	uint64_t size = (length < AUTOTUNE_SAMPLE_SIZE)? length : AUTOTUNE_SAMPLE_SIZE;
+	uint64_t spare = length - size;
+	unsigned wanted = (length > AUTOTUNE_SAMPLES * size)? AUTOTUNE_SAMPLES : 1;
+
+	for (unsigned i = 0; i < wanted && ret; i++) {
+		off_t pos = offset + ((wanted > 1)? spare * i / (wanted - 1) : 0);
+
+		samples[count] = malloc(size);
+		ssize_t n = pread(fd, samples[count], size, pos);
+
+		lengths[count++] = (n > 0)? n : 0;
+		ret = n >= 0;
+	}
+
+	if (ret) {
+		autotune_samples(samples, lengths, count, params, target);
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		free(samples[i]);
+	}
+
+	return ret;
+}
+
+void autotune_buffer(const uint8_t *buf, size_t length,
+                     frame_params_t *params, const autotune_target_t *target)
+{
+	uint8_t *samples[AUTOTUNE_SAMPLES];
+	size_t lengths[AUTOTUNE_SAMPLES];
+	unsigned count = 0;
+
+	// consecutive pieces, at least one even when it's empty
+	for (size_t pos = 0; count < AUTOTUNE_SAMPLES && (pos < length || count == 0);) {
+		size_t n = length - pos;
+		n = (n < AUTOTUNE_SAMPLE_SIZE)? n : AUTOTUNE_SAMPLE_SIZE;
+
+		samples[count] = (uint8_t *)buf + pos;
+		lengths[count++] = n;
+		pos += n;
+	}
+
+	autotune_samples(samples, lengths, count, params, target);
+}
@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include <hz/batch.h>
+#include <hz/codec.h>
+
+// each worker owns the files in [next, end), it takes from the front and
+// thieves take from the back
+typedef struct batch_worker {
+	pthread_mutex_t lock;
+	size_t next;
+	size_t end;
+
+	pthread_t thread;
+	bool started;
+	struct batch_pool *pool;
+} batch_worker_t;
+
+typedef struct batch_pool {
+	char *const *paths;
+	const batch_params_t *params;
+
+	batch_worker_t *workers;
+	unsigned count;
+
+	atomic_size_t failed;
+} batch_pool_t;
+
+static char *output_path(const char *path, const batch_params_t *params) {
+	char *copy = strdup(path);
+	const char *name = params->out_dir? basename(copy) : path;
+	size_t namelen = strlen(name);
+	size_t suffix = strlen(BATCH_SUFFIX);
+	char *ret = NULL;
+
+	const char *dir = params->out_dir? params->out_dir : "";
+	const char *sep = params->out_dir? "/" : "";
+
+	if (params->encode) {
+		asprintf(&ret, "%s%s%s" BATCH_SUFFIX, dir, sep, name);
+
+	} else if (namelen > suffix
+	           && strcmp(name + namelen - suffix, BATCH_SUFFIX) == 0)
+	{
+		asprintf(&ret, "%s%s%.*s", dir, sep, (int)(namelen - suffix), name);
+
+	} else {
+		asprintf(&ret, "%s%s%s" BATCH_OUT_SUFFIX, dir, sep, name);
+	}
+
+	free(copy);
+	return ret;
+}
+
+static bool batch_file(const char *path,
+                       const batch_params_t *params,
+                       codec_ctx_t *ctx)
+{
+	char *outpath = output_path(path, params);
+	FILE *in = fopen(path, "r");
+	// read-write so decompressed outputs can be mapped
+	FILE *out = in? fopen(outpath, params->encode? "w" : "w+") : NULL;
+	struct stat st;
+	bool ret = false;
+
+	if (!in) {
+		fprintf(stderr, "error: couldn't open \"%s\"\n", path);
+
+	} else if (!out) {
+		fprintf(stderr, "error: couldn't create \"%s\"\n", outpath);
+
+	} else if (params->encode) {
+		frame_params_t frame = *params->frame;
+		frame.opts.ctx = ctx;
+
+		if (fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode)) {
+			frame.has_content_size = true;
+			frame.content_size = st.st_size;
+		}
+
+		if (params->autotune && !autotune_fd(fileno(in), 0, frame.content_size,
+		                                     &frame, params->autotune))
+		{
+			fprintf(stderr, "error: couldn't sample \"%s\"\n", path);
+
+		} else {
+			ret = frame_compress(in, out, &frame);
+		}
+
+	} else {
+		ret = frame_decompress_fd(in, fileno(out), ctx);
+	}
+
+	if (in) fclose(in);
+
+	if (out && fclose(out) != 0) {
+		fprintf(stderr, "error: couldn't write \"%s\"\n", outpath);
+		ret = false;
+	}
+
+	if (!ret) {
+		fprintf(stderr, "error: failed on \"%s\"\n", path);
+
+		// don't leave half written output around
+		if (out) unlink(outpath);
+	}
+
+	free(outpath);
+	return ret;
+}
+
+static size_t files_left(batch_worker_t *worker) {
+	pthread_mutex_lock(&worker->lock);
+	size_t ret = worker->end - worker->next;
+	pthread_mutex_unlock(&worker->lock);
+
+	return ret;
+}
+
+static bool take_own(batch_worker_t *worker, size_t *index) {
+	pthread_mutex_lock(&worker->lock);
+	bool ret = worker->next < worker->end;
+
+	if (ret) {
+		*index = worker->next++;
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+	return ret;
+}
+
+// moves half of the remaining files of the worker with the most left over
+// to `thief`, returns false once there's nothing left anywhere
+static bool steal(batch_worker_t *thief) {
+	batch_pool_t *pool = thief->pool;
+
+	for (;;) {
+		batch_worker_t *victim = NULL;
+		size_t most = 0;
+
+		for (unsigned i = 0; i < pool->count; i++) {
+			batch_worker_t *worker = pool->workers + i;
+			size_t left = (worker != thief)? files_left(worker) : 0;
+
+			if (left > most) {
+				victim = worker;
+				most = left;
+			}
+		}
+
+		if (!victim) {
+			return false;
+		}
+
+		// it may have been emptied since it was picked
+		pthread_mutex_lock(&victim->lock);
+		size_t left = victim->end - victim->next;
+		size_t take = (left + 1) / 2;
+
+		if (left > 0) {
+			size_t start = victim->end - take;
+			victim->end = start;
+			pthread_mutex_unlock(&victim->lock);
+
+			pthread_mutex_lock(&thief->lock);
+			thief->next = start;
+			thief->end = start + take;
+			pthread_mutex_unlock(&thief->lock);
+			return true;
+		}
+
+		pthread_mutex_unlock(&victim->lock);
+	}
+}
+
+static void *batch_worker(void *arg) {
+	batch_worker_t *worker = arg;
+	batch_pool_t *pool = worker->pool;
+	codec_ctx_t *ctx = codec_ctx_create();
+
+	for (;;) {
+		size_t index;
+
+		if (!take_own(worker, &index)) {
+			if (!steal(worker)) {
+				break;
+			}
+
+			continue;
+		}
+
+		if (!batch_file(pool->paths[index], pool->params, ctx)) {
+			atomic_fetch_add(&pool->failed, 1);
+		}
+	}
+
+	codec_ctx_free(ctx);
+	return NULL;
+}
+
+bool batch_run(char *const *paths, size_t count, const batch_params_t *params) {
+	unsigned threads = params->threads;
+
+	if (threads == 0) {
+		// the cpus this process can run on, which can be fewer than the
+		// machine has in containers
+		cpu_set_t set;
+		long cpus = (sched_getaffinity(0, sizeof(set), &set) == 0)
+			? CPU_COUNT(&set) : sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = (cpus > 0)? cpus : 1;
+	}
+
+	threads = (count < threads)? count : threads;
+	threads = threads? threads : 1;
+
+	batch_pool_t pool = {
+		.paths = paths,
+		.params = params,
+		.workers = calloc(threads, sizeof(batch_worker_t)),
+		.count = threads,
+	};
+
+	atomic_init(&pool.failed, 0);
+
+	for (unsigned i = 0; i < threads; i++) {
+		batch_worker_t *worker = pool.workers + i;
+
+		pthread_mutex_init(&worker->lock, NULL);
+		worker->next = count * i / threads;
+		worker->end = count * (i + 1) / threads;
+		worker->pool = &pool;
+	}
+
+	// the calling thread works as the first worker
+	for (unsigned i = 1; i < threads; i++) {
+		// if this fails the worker's files get stolen by the others
+		pool.workers[i].started = pthread_create(&pool.workers[i].thread, NULL,
+		                                         batch_worker,
+		                                         pool.workers + i) == 0;
+	}
+
+	batch_worker(pool.workers);
+
+	for (unsigned i = 1; i < threads; i++) {
+		if (pool.workers[i].started) {
+			pthread_join(pool.workers[i].thread, NULL);
+		}
+	}
+
+	for (unsigned i = 0; i < threads; i++) {
+		pthread_mutex_destroy(&pool.workers[i].lock);
+	}
+
+	size_t failed = atomic_load(&pool.failed);
+	free(pool.workers);
+
+	if (failed > 0) {
+		fprintf(stderr, "error: %zu of %zu files failed\n", failed, count);
+	}
+
+	return failed == 0;
+}
@@ -0,0 +1,478 @@
+// microbenchmarks for the inner loops of the codecs, each one is run on
+// synthetic data and timed on its own, with hardware counters from
+// perf_event_open() when the kernel allows it.
+//
+// the lzs and symbol table kernels are static, so their sources are built
+// into this file instead of being linked in. that keeps them inlined and
+// specialized the same way they are in the real encoders.
+#define _GNU_SOURCE
+#include "lzs.c"
+#include "gentable.c"
+
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <hz/huffman.h>
+
+#define BENCH_DEFAULT_SIZE    (4 << 20)
+#define BENCH_DEFAULT_REPEATS 5
+
+// hardware counters, in the order they're reported
+enum {
+	COUNTER_CYCLES,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_BRANCH_MISSES,
+	COUNTER_CACHE_MISSES,
+	COUNTERS,
+};
+
+static const uint64_t counter_configs[COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+	PERF_COUNT_HW_CACHE_MISSES,
+};
+
+typedef struct counters {
+	// -1 for counters that couldn't be opened
+	int fds[COUNTERS];
+	uint64_t values[COUNTERS];
+	bool valid[COUNTERS];
+} counters_t;
+
+typedef struct bench_data {
+	uint8_t *input;
+	size_t size;
+
+	// the input huffman coded with `tree`, for the decoder
+	huff_tree_t *tree;
+	huff_symbol_table_t *symtab;
+	char *coded;
+	size_t coded_size;
+} bench_data_t;
+
+typedef struct bench_kernel {
+	const char *name;
+	// returns the number of input bytes processed
+	size_t (*run)(bench_data_t *data);
+} bench_kernel_t;
+
+static int perf_open(uint64_t config, int group) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = group == -1;
+	// user space only, so this works with the default paranoid setting
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void counters_open(counters_t *counters) {
+	int leader = -1;
+
+	for (unsigned i = 0; i < COUNTERS; i++) {
+		counters->fds[i] = perf_open(counter_configs[i], leader);
+
+		// counters the cpu or a vm doesn't have are left out
+		if (leader == -1) {
+			leader = counters->fds[i];
+		}
+	}
+}
+
+static void counters_close(counters_t *counters) {
+	for (unsigned i = 0; i < COUNTERS; i++) {
+		if (counters->fds[i] != -1) {
+			close(counters->fds[i]);
+		}
+	}
+}
+
+static int counters_leader(counters_t *counters) {
+	for (unsigned i = 0; i < COUNTERS; i++) {
+		if (counters->fds[i] != -1) {
+			return counters->fds[i];
+		}
+	}
+
+	return -1;
+}
+
+static void counters_start(counters_t *counters) {
+	int leader = counters_leader(counters);
+
+	if (leader != -1) {
+		ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+}
+
+static void counters_stop(counters_t *counters) {
+	int leader = counters_leader(counters);
+
+	if (leader != -1) {
+		ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	}
+
+	for (unsigned i = 0; i < COUNTERS; i++) {
+		counters->valid[i] = counters->fds[i] != -1
+			&& read(counters->fds[i], counters->values + i,
+			        sizeof(uint64_t)) == sizeof(uint64_t);
+	}
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// text-like input: words from a small vocabulary with a skewed
+// distribution, so there are matches to find and codes of varying length
+static void generate_input(uint8_t *buf, size_t size) {
+	static const char *words[] = {
+		"the ", "of ", "and ", "a ", "to ", "in ", "is ", "that ",
+		"compression ", "window ", "match ", "huffman ", "symbol ", "bit ",
+		"stream ", "block ", "length ", "distance ", "table ", "code ",
+		"\n", ", ", ". ", "0x", "{ ", "} ",
+	};
+	const unsigned nwords = sizeof(words) / sizeof(words[0]);
+	uint32_t state = 0x12345678;
+
+	for (size_t i = 0; i < size;) {
+		state = state * 1664525 + 1013904223;
+
+		// the product of two uniform picks favours the early words
+		unsigned a = (state >> 8) % nwords;
+		unsigned b = (state >> 20) % nwords;
+		const char *word = words[a * b / nwords];
+
+		for (; *word && i < size; word++) {
+			buf[i++] = *word;
+		}
+
+		// some noise so not everything matches
+		if ((state & 0xff) < 8 && i < size) {
+			buf[i++] = state >> 24;
+		}
+	}
+}
+
+static size_t bench_bit_write(bench_data_t *data) {
+	FILE *out = fopen("/dev/null", "w");
+	bit_stream_t stream;
+	bit_stream_init_write(&stream, out);
+
+	// code lengths from 1 to 16 bits picked by the input
+	for (size_t i = 0; i < data->size; i++) {
+		bit_stream_write_bits(&stream, (data->input[i] & 0xf) + 1, data->input[i]);
+	}
+
+	bit_stream_flush(&stream);
+	fclose(out);
+	return data->size;
+}
+
+static size_t bench_bit_read(bench_data_t *data) {
+	FILE *fp = fmemopen(data->input, data->size, "r");
+	bit_stream_t stream;
+	memset(&stream, 0, sizeof(stream));
+	stream.fp = fp;
+
+	size_t bits = 0;
+	uint32_t sum = 0;
+
+	while (bits + 16 <= 8 * data->size) {
+		unsigned n = (sum & 0xf) + 1;
+		sum += bit_stream_read_bits(&stream, n);
+		bits += n;
+	}
+
+	fclose(fp);
+
+	// keeps the reads from being optimized out
+	__asm__ volatile("" :: "r"(sum));
+	return data->size;
+}
+
+static encoder_t *bench_encoder(bool chains) {
+	encoder_t *state = calloc(1, sizeof(encoder_t));
+
+	state->input = window_create(MAX_WINDOW_SIZE);
+	state->window = window_create(MAX_WINDOW_SIZE);
+
+	if (chains) {
+		state->hash_bits = LZS_HASH_BITS;
+		state->head = calloc(1 << LZS_HASH_BITS, sizeof(uint32_t));
+		state->prev = calloc(MAX_WINDOW_SIZE, sizeof(uint32_t));
+	}
+
+	return state;
+}
+
+static void bench_encoder_free(encoder_t *state) {
+	window_free(state->input);
+	window_free(state->window);
+	free(state->head);
+	free(state->prev);
+	free(state);
+}
+
+// compares the lookahead against every position in the window, like the
+// scan match finder does. the input moves through the window
+// LZS_MAX_PREFIX_SEARCH bytes at a time.
+static size_t bench_prefix_length(bench_data_t *data) {
+	const uint16_t mask = LZS_DECODER_MASK;
+	encoder_t *state = bench_encoder(false);
+	size_t compared = 0;
+	size_t i = 0;
+
+	// the window and lookahead both hold at most mask bytes
+	for (; i < mask && i < data->size; i++) {
+		window_append(state->window, mask, data->input[i]);
+	}
+
+	for (; i + LZS_MAX_PREFIX_SEARCH < data->size; i += LZS_MAX_PREFIX_SEARCH) {
+		state->input->start = state->input->end = 0;
+
+		for (unsigned k = 0; k < LZS_MAX_PREFIX_SEARCH; k++) {
+			window_append(state->input, mask, data->input[i + k]);
+		}
+
+		uint16_t available = window_available(state->window, mask);
+
+		for (uint16_t k = 0; k < available; k++) {
+			compared += prefix_length(state, mask, k) + 1;
+		}
+
+		for (unsigned k = 0; k < LZS_MAX_PREFIX_SEARCH; k++) {
+			window_append(state->window, mask, data->input[i + k]);
+		}
+	}
+
+	bench_encoder_free(state);
+
+	// counted per byte compared rather than per input byte, the number of
+	// comparisons depends on how well the input matches
+	return compared;
+}
+
+static size_t bench_encoder_shift(bench_data_t *data) {
+	const uint16_t mask = LZS_DECODER_MASK;
+	encoder_t *state = bench_encoder(true);
+
+	for (size_t i = 0; i < data->size; i++) {
+		encoder_append(state, mask, data->input[i]);
+		encoder_shift(state, mask, LZS_MATCH_HASH_CHAIN);
+	}
+
+	bench_encoder_free(state);
+	return data->size;
+}
+
+static size_t bench_huff_encode(bench_data_t *data) {
+	FILE *fp = fmemopen(data->input, data->size, "r");
+	FILE *out = fopen("/dev/null", "w");
+
+	huff_encode(data->tree, fp, out);
+
+	fclose(fp);
+	fclose(out);
+	return data->size;
+}
+
+static size_t bench_huff_decode(bench_data_t *data) {
+	FILE *fp = fmemopen(data->coded, data->coded_size, "r");
+	FILE *out = fopen("/dev/null", "w");
+
+	huff_decode(data->tree, fp, out);
+
+	fclose(fp);
+	fclose(out);
+	return data->size;
+}
+
+static size_t bench_count_file(bench_data_t *data) {
+	FILE *fp = fmemopen(data->input, data->size, "r");
+	huff_symbol_t symtab[256];
+	memset(symtab, 0, sizeof(symtab));
+
+	size_t ret = count_file(fp, 256, symtab);
+
+	fclose(fp);
+	return ret;
+}
+
+static const bench_kernel_t kernels[] = {
+	{ "bit_write",      bench_bit_write },
+	{ "bit_read",       bench_bit_read },
+	{ "prefix_length",  bench_prefix_length },
+	{ "encoder_shift",  bench_encoder_shift },
+	{ "huff_encode",    bench_huff_encode },
+	{ "huff_decode",    bench_huff_decode },
+	{ "count_file",     bench_count_file },
+};
+
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static void bench_data_init(bench_data_t *data, size_t size) {
+	data->size = size;
+	data->input = malloc(size);
+	generate_input(data->input, size);
+
+	FILE *fp = fmemopen(data->input, size, "r");
+	data->symtab = generate_symtab(fp);
+	data->tree = huff_tree_create(data->symtab);
+
+	FILE *coded = open_memstream(&data->coded, &data->coded_size);
+	huff_encode(data->tree, fp, coded);
+
+	fclose(coded);
+	fclose(fp);
+}
+
+static void bench_data_free(bench_data_t *data) {
+	huff_tree_free(data->tree);
+	free_symtab(data->symtab);
+	free(data->coded);
+	free(data->input);
+}
+
+// prints a counter per byte, scaled by `scale`, or a dash if it's missing
+static void print_counter(counters_t *counters, unsigned counter,
+                          double bytes, double scale)
+{
+	if (counters->valid[counter]) {
+		printf(" %12.3f", counters->values[counter] * scale / bytes);
+	} else {
+		printf(" %12s", "-");
+	}
+}
+
+// runs a kernel `repeats` times and reports the fastest run
+static void bench_kernel(const bench_kernel_t *kernel,
+                         bench_data_t *data,
+                         unsigned repeats)
+{
+	counters_t best = {0};
+	uint64_t best_ns = UINT64_MAX;
+	size_t bytes = 0;
+
+	for (unsigned i = 0; i < repeats; i++) {
+		counters_t counters;
+		counters_open(&counters);
+
+		counters_start(&counters);
+		uint64_t start = now_ns();
+		bytes = kernel->run(data);
+		uint64_t elapsed = now_ns() - start;
+		counters_stop(&counters);
+		counters_close(&counters);
+
+		if (elapsed < best_ns) {
+			best_ns = elapsed;
+			best = counters;
+		}
+	}
+
+	printf("%-16s %12.3f", kernel->name, (double)best_ns / bytes);
+	print_counter(&best, COUNTER_CYCLES, bytes, 1);
+
+	if (best.valid[COUNTER_CYCLES] && best.valid[COUNTER_INSTRUCTIONS]
+	    && best.values[COUNTER_CYCLES])
+	{
+		printf(" %12.3f", (double)best.values[COUNTER_INSTRUCTIONS]
+		                  / best.values[COUNTER_CYCLES]);
+	} else {
+		printf(" %12s", "-");
+	}
+
+	print_counter(&best, COUNTER_BRANCH_MISSES, bytes, 1000);
+	print_counter(&best, COUNTER_CACHE_MISSES, bytes, 1000);
+	putchar('\n');
+}
+
+void print_help(void) {
+	puts("Usage: bench [-h] [-n bytes] [-r repeats] [kernel...]\n"
+	     "\t-h: print this help\n"
+	     "\t-n: size of the synthetic input, defaults to 4194304\n"
+	     "\t-r: runs of each kernel, the fastest is reported. defaults to 5.\n"
+	     "\n"
+	     "Runs the named kernels, or all of them:");
+
+	for (unsigned i = 0; i < NUM_KERNELS; i++) {
+		printf("\t%s\n", kernels[i].name);
+	}
+
+	puts("\n"
+	     "Times are per input byte, except for prefix_length which counts\n"
+	     "bytes compared. Branch and cache misses are per 1000 bytes.\n"
+	     "Counters show as \"-\" when perf_event_open() isn't available.");
+}
+
+int main(int argc, char *argv[]) {
+	size_t size = BENCH_DEFAULT_SIZE;
+	unsigned repeats = BENCH_DEFAULT_REPEATS;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hn:r:")) != -1) {
+		switch (opt) {
+			case 'n': size = strtoull(optarg, NULL, 10); break;
+			case 'r': repeats = atoi(optarg); break;
+			case 'h':
+			default:
+				print_help();
+				return opt != 'h';
+		}
+	}
+
+	if (size < MAX_WINDOW_SIZE || repeats == 0) {
+		fprintf(stderr, "error: need at least %u bytes and one run\n",
+		        MAX_WINDOW_SIZE);
+		return 1;
+	}
+
+	for (int i = optind; i < argc; i++) {
+		bool found = false;
+
+		for (unsigned k = 0; k < NUM_KERNELS; k++) {
+			found |= strcmp(argv[i], kernels[k].name) == 0;
+		}
+
+		if (!found) {
+			fprintf(stderr, "error: unknown kernel \"%s\"\n", argv[i]);
+			return 1;
+		}
+	}
+
+	bench_data_t data;
+	bench_data_init(&data, size);
+
+	printf("%-16s %12s %12s %12s %12s %12s\n", "kernel", "ns/byte",
+	       "cycles/byte", "IPC", "br-miss/KB", "cache-miss/KB");
+
+	for (unsigned k = 0; k < NUM_KERNELS; k++) {
+		bool selected = optind == argc;
+
+		for (int i = optind; i < argc; i++) {
+			selected |= strcmp(argv[i], kernels[k].name) == 0;
+		}
+
+		if (selected) {
+			bench_kernel(kernels + k, &data, repeats);
+		}
+	}
+
+	bench_data_free(&data);
+	return 0;
+}
@@ -0,0 +1,591 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <hz/bwt.h>
+#include <hz/bytes.h>
+#include <hz/trace.h>
+
+#define BWT_HEADER_SIZE (4 + 4 * BWT_STREAMS)
+
+// input that fits in fewer blocks than there are cpus is split into one
+// block per cpu so it's still sorted in parallel, but not into blocks
+// smaller than this. they'd lose more context than the time is worth.
+#define BWT_MIN_SPLIT (1 << 18)
+
+// suffix sorting with SA-IS (nong, zhang and chan), linear time and no
+// memory past the suffix array besides a type per byte and the buckets.
+// the text ends with a virtual sentinel smaller than every symbol, it isn't
+// in the text or the suffix array. the text is bytes at the top level and
+// names of LMS substrings in the recursion.
+typedef struct sais_text {
+	const uint8_t *bytes;
+	const int32_t *ints;
+} sais_text_t;
+
+static inline int32_t sais_chr(const sais_text_t *s, int32_t i) {
+	return s->bytes? s->bytes[i] : s->ints[i];
+}
+
+// types are true for S-type suffixes, the ones smaller than the next suffix
+static inline bool sais_lms(const uint8_t *types, int32_t i) {
+	return i > 0 && types[i] && !types[i - 1];
+}
+
+static void sais_buckets(const sais_text_t *s, int32_t n, int32_t k,
+                         int32_t *buckets, bool ends)
+{
+	int32_t sum = 0;
+
+	memset(buckets, 0, k * sizeof(int32_t));
+
+	for (int32_t i = 0; i < n; i++) {
+		buckets[sais_chr(s, i)]++;
+	}
+
+	for (int32_t c = 0; c < k; c++) {
+		sum += buckets[c];
+		buckets[c] = ends? sum : sum - buckets[c];
+	}
+}
+
+// sorts the L-type suffixes from left to right, then the S-type ones from
+// right to left, starting from the LMS suffixes already in place
+static void sais_induce(const sais_text_t *s, const uint8_t *types,
+                        int32_t *sa, int32_t n, int32_t k, int32_t *buckets)
+{
+	sais_buckets(s, n, k, buckets, false);
+
+	// the suffix before the sentinel is the first L-type one
+	sa[buckets[sais_chr(s, n - 1)]++] = n - 1;
+
+	for (int32_t i = 0; i < n; i++) {
+		int32_t j = sa[i] - 1;
+
+		if (sa[i] > 0 && !types[j]) {
+			sa[buckets[sais_chr(s, j)]++] = j;
+		}
+	}
+
+	sais_buckets(s, n, k, buckets, true);
+
+	for (int32_t i = n - 1; i >= 0; i--) {
+		int32_t j = sa[i] - 1;
+
+		if (sa[i] > 0 && types[j]) {
+			sa[--buckets[sais_chr(s, j)]] = j;
+		}
+	}
+}
+
+// two LMS substrings are equal if they have the same symbols and types up to
+// and including the next LMS position. the one reaching the sentinel is
+// unique.
+static bool sais_lms_equal(const sais_text_t *s, const uint8_t *types,
+                           int32_t n, int32_t a, int32_t b)
+{
+	for (int32_t d = 0;; d++) {
+		if (a + d == n || b + d == n
+		    || sais_chr(s, a + d) != sais_chr(s, b + d)
+		    || types[a + d] != types[b + d])
+		{
+			return false;
+		}
+
+		if (d > 0 && (sais_lms(types, a + d) || sais_lms(types, b + d))) {
+			return true;
+		}
+	}
+}
+
+static void sais(const sais_text_t *s, int32_t *sa, int32_t n, int32_t k) {
+	if (n == 0) {
+		return;
+	}
+
+	uint8_t *types = malloc(n);
+	int32_t *buckets = malloc(k * sizeof(int32_t));
+
+	types[n - 1] = false;
+
+	for (int32_t i = n - 2; i >= 0; i--) {
+		int32_t a = sais_chr(s, i);
+		int32_t b = sais_chr(s, i + 1);
+
+		types[i] = a < b || (a == b && types[i + 1]);
+	}
+
+	// sort the LMS substrings by inducing from the LMS positions in any order
+	sais_buckets(s, n, k, buckets, true);
+
+	for (int32_t i = 0; i < n; i++) {
+		sa[i] = -1;
+	}
+
+	for (int32_t i = 1; i < n; i++) {
+		if (sais_lms(types, i)) {
+			sa[--buckets[sais_chr(s, i)]] = i;
+		}
+	}
+
+	sais_induce(s, types, sa, n, k, buckets);
+
+	// move them to the front, then name them. LMS positions are at least
+	// two apart, so pos / 2 gives each one its own slot behind them.
+	int32_t lms = 0;
+
+	for (int32_t i = 0; i < n; i++) {
+		if (sais_lms(types, sa[i])) {
+			sa[lms++] = sa[i];
+		}
+	}
+
+	for (int32_t i = lms; i < n; i++) {
+		sa[i] = -1;
+	}
+
+	int32_t names = 0;
+	int32_t prev = -1;
+
+	for (int32_t i = 0; i < lms; i++) {
+		int32_t pos = sa[i];
+
+		if (prev < 0 || !sais_lms_equal(s, types, n, pos, prev)) {
+			names++;
+			prev = pos;
+		}
+
+		sa[lms + pos / 2] = names - 1;
+	}
+
+	// the reduced text is the names in text order, at the end of `sa`
+	int32_t *reduced = sa + n - lms;
+
+	for (int32_t i = n - 1, j = n - 1; i >= lms; i--) {
+		if (sa[i] >= 0) {
+			sa[j--] = sa[i];
+		}
+	}
+
+	// names that aren't unique need sorting, otherwise they are the order
+	if (names < lms) {
+		sais_text_t sub = { .ints = reduced };
+		sais(&sub, sa, lms, names);
+
+	} else {
+		for (int32_t i = 0; i < lms; i++) {
+			sa[reduced[i]] = i;
+		}
+	}
+
+	// put the sorted LMS suffixes at the ends of their buckets, then induce
+	// the rest from them
+	for (int32_t i = 1, j = 0; i < n; i++) {
+		if (sais_lms(types, i)) {
+			reduced[j++] = i;
+		}
+	}
+
+	for (int32_t i = 0; i < lms; i++) {
+		sa[i] = reduced[sa[i]];
+	}
+
+	for (int32_t i = lms; i < n; i++) {
+		sa[i] = -1;
+	}
+
+	sais_buckets(s, n, k, buckets, true);
+
+	for (int32_t i = lms - 1; i >= 0; i--) {
+		int32_t j = sa[i];
+
+		sa[i] = -1;
+		sa[--buckets[sais_chr(s, j)]] = j;
+	}
+
+	sais_induce(s, types, sa, n, k, buckets);
+
+	free(buckets);
+	free(types);
+}
+
+static uint32_t stream_start(uint32_t length, unsigned k) {
+	return (uint64_t)length * k / BWT_STREAMS;
+}
+
+// row 0 is the rotation starting with the sentinel, row i + 1 is the
+// suffix at sa[i]. the sentinel's own place in the last column is start 0.
+void bwt_transform(const uint8_t *in, uint8_t *out, int32_t *sa,
+                   uint32_t length, uint32_t starts[BWT_STREAMS])
+{
+	memset(starts, 0, BWT_STREAMS * sizeof(uint32_t));
+
+	if (length == 0) {
+		return;
+	}
+
+	sais_text_t s = { .bytes = in };
+	sais(&s, sa, length, 256);
+
+	size_t o = 0;
+	out[o++] = in[length - 1];
+
+	for (uint32_t i = 0; i < length; i++) {
+		uint32_t pos = sa[i];
+
+		for (unsigned k = 0; k < BWT_STREAMS; k++) {
+			if (pos == stream_start(length, k)) {
+				starts[k] = i + 1;
+			}
+		}
+
+		if (pos > 0) {
+			out[o++] = in[pos - 1];
+		}
+	}
+}
+
+// walks forward through the text, each entry holds the next row in the top
+// 24 bits and the first byte of its own row in the low 8, so a step is one
+// random read. the streams are interleaved so their reads overlap.
+bool bwt_inverse(const uint8_t *in, uint8_t *out, uint32_t *rows,
+                 uint32_t length, const uint32_t starts[BWT_STREAMS])
+{
+	if (length == 0) {
+		return true;
+	}
+
+	uint32_t primary = starts[0];
+	uint32_t counts[256] = {0};
+
+	for (unsigned k = 0; k < BWT_STREAMS; k++) {
+		if (starts[k] == 0 || starts[k] > length) {
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < length; i++) {
+		counts[in[i]]++;
+	}
+
+	// the sentinel sorts first, so buckets start at row 1
+	for (uint32_t c = 0, sum = 1; c < 256; c++) {
+		uint32_t n = counts[c];
+		counts[c] = sum;
+		sum += n;
+	}
+
+	rows[0] = 0;
+
+	for (uint32_t j = 0; j <= length; j++) {
+		if (j == primary) {
+			continue;
+		}
+
+		uint8_t c = in[(j < primary)? j : j - 1];
+		rows[counts[c]++] = (j << 8) | c;
+	}
+
+	uint32_t pos[BWT_STREAMS];
+	uint8_t *dest[BWT_STREAMS];
+	uint32_t left[BWT_STREAMS];
+	uint32_t shortest = length;
+
+	for (unsigned k = 0; k < BWT_STREAMS; k++) {
+		uint32_t end = (k + 1 < BWT_STREAMS)? stream_start(length, k + 1) : length;
+
+		pos[k] = starts[k];
+		dest[k] = out + stream_start(length, k);
+		left[k] = end - stream_start(length, k);
+		shortest = (left[k] < shortest)? left[k] : shortest;
+	}
+
+	for (uint32_t i = 0; i < shortest; i++) {
+		for (unsigned k = 0; k < BWT_STREAMS; k++) {
+			uint32_t v = rows[pos[k]];
+
+			dest[k][i] = v;
+			pos[k] = v >> 8;
+		}
+	}
+
+	for (unsigned k = 0; k < BWT_STREAMS; k++) {
+		for (uint32_t i = shortest; i < left[k]; i++) {
+			uint32_t v = rows[pos[k]];
+
+			dest[k][i] = v;
+			pos[k] = v >> 8;
+		}
+	}
+
+	return true;
+}
+
+void mtf_encode(uint8_t *buf, size_t length) {
+	uint8_t order[256];
+
+	for (unsigned i = 0; i < 256; i++) {
+		order[i] = i;
+	}
+
+	for (size_t i = 0; i < length; i++) {
+		uint8_t c = buf[i];
+		uint8_t *p = memchr(order, c, sizeof(order));
+		size_t index = p - order;
+
+		memmove(order + 1, order, index);
+		order[0] = c;
+		buf[i] = index;
+	}
+}
+
+void mtf_decode(uint8_t *buf, size_t length) {
+	uint8_t order[256];
+
+	for (unsigned i = 0; i < 256; i++) {
+		order[i] = i;
+	}
+
+	for (size_t i = 0; i < length; i++) {
+		size_t index = buf[i];
+		uint8_t c = order[index];
+
+		memmove(order + 1, order, index);
+		order[0] = c;
+		buf[i] = c;
+	}
+}
+
+// blocks are handed out to a thread per cpu, the calling thread included
+typedef struct bwt_job {
+	uint8_t *in;
+	uint8_t *out;
+	uint32_t length;
+	uint32_t starts[BWT_STREAMS];
+	bool ok;
+} bwt_job_t;
+
+typedef struct bwt_pool {
+	bwt_job_t *jobs;
+	size_t count;
+	atomic_size_t next;
+	bool inverse;
+} bwt_pool_t;
+
+static void bwt_encode_job(bwt_job_t *job) {
+	int32_t *sa = malloc((job->length + 1) * sizeof(int32_t));
+	uint64_t start = trace_begin();
+
+	bwt_transform(job->in, job->out, sa, job->length, job->starts);
+	trace_end("bwt", "sort", start, job->length);
+
+	start = trace_begin();
+	mtf_encode(job->out, job->length);
+	trace_end("bwt", "mtf", start, job->length);
+
+	free(sa);
+	job->ok = true;
+}
+
+static void bwt_decode_job(bwt_job_t *job) {
+	uint32_t *rows = malloc((job->length + 1) * sizeof(uint32_t));
+	uint64_t start = trace_begin();
+
+	mtf_decode(job->in, job->length);
+	trace_end("bwt", "mtf decode", start, job->length);
+
+	start = trace_begin();
+	job->ok = bwt_inverse(job->in, job->out, rows, job->length, job->starts);
+	trace_end("bwt", "inverse", start, job->length);
+
+	free(rows);
+}
+
+static void *bwt_worker(void *arg) {
+	bwt_pool_t *pool = arg;
+
+	for (size_t i; (i = atomic_fetch_add(&pool->next, 1)) < pool->count;) {
+		if (pool->inverse) {
+			bwt_decode_job(pool->jobs + i);
+		} else {
+			bwt_encode_job(pool->jobs + i);
+		}
+	}
+
+	return NULL;
+}
+
+static unsigned cpu_count(void) {
+	cpu_set_t set;
+	long cpus = (sched_getaffinity(0, sizeof(set), &set) == 0)
+		? CPU_COUNT(&set) : sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (cpus > 0)? cpus : 1;
+}
+
+static void bwt_run_jobs(bwt_job_t *jobs, size_t count, bool inverse) {
+	bwt_pool_t pool = {
+		.jobs = jobs,
+		.count = count,
+		.inverse = inverse,
+	};
+
+	unsigned threads = cpu_count();
+	threads = (count < threads)? count : threads;
+
+	pthread_t *workers = calloc(threads, sizeof(pthread_t));
+	bool *started = calloc(threads, sizeof(bool));
+
+	atomic_init(&pool.next, 0);
+
+	// if a thread can't be started the others pick up its blocks
+	for (unsigned i = 1; i < threads; i++) {
+		started[i] = pthread_create(workers + i, NULL, bwt_worker, &pool) == 0;
+	}
+
+	bwt_worker(&pool);
+
+	for (unsigned i = 1; i < threads; i++) {
+		if (started[i]) {
+			pthread_join(workers[i], NULL);
+		}
+	}
+
+	free(started);
+	free(workers);
+}
+
+static void free_jobs(bwt_job_t *jobs, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		free(jobs[i].in);
+		free(jobs[i].out);
+	}
+
+	free(jobs);
+}
+
+// the whole input, so it can be split up evenly
+static uint8_t *read_all(FILE *in, size_t *length) {
+	size_t space = 0x10000;
+	uint8_t *ret = malloc(space);
+
+	*length = 0;
+
+	for (size_t n; (n = fread(ret + *length, 1, space - *length, in)) > 0;) {
+		*length += n;
+
+		if (*length == space) {
+			space *= 2;
+			ret = realloc(ret, space);
+		}
+	}
+
+	return ret;
+}
+
+// block size for `length` bytes of input, see BWT_MIN_SPLIT
+static size_t split_size(size_t length, size_t block_size) {
+	size_t cpus = cpu_count();
+	size_t part = (length + cpus - 1) / cpus;
+
+	part = (part > BWT_MIN_SPLIT)? part : BWT_MIN_SPLIT;
+	return (part < block_size)? part : block_size;
+}
+
+bool bwt_encode(FILE *in, FILE *out, size_t block_size) {
+	block_size = block_size? block_size : BWT_DEFAULT_BLOCK;
+	block_size = (block_size < BWT_MAX_BLOCK)? block_size : BWT_MAX_BLOCK;
+
+	size_t length;
+	uint8_t *data = read_all(in, &length);
+	size_t part = split_size(length, block_size);
+	size_t count = (length + part - 1) / part;
+	bwt_job_t *jobs = calloc(count, sizeof(bwt_job_t));
+	bool ret = true;
+
+	for (size_t i = 0; i < count; i++) {
+		size_t n = (length - i * part < part)? length - i * part : part;
+
+		jobs[i] = (bwt_job_t) {
+			.in = malloc(n),
+			.out = malloc(n),
+			.length = n,
+		};
+
+		memcpy(jobs[i].in, data + i * part, n);
+	}
+
+	free(data);
+
+	bwt_run_jobs(jobs, count, false);
+
+	for (size_t i = 0; i < count && ret; i++) {
+		uint8_t header[BWT_HEADER_SIZE];
+
+		store_le32(header, jobs[i].length);
+
+		for (unsigned k = 0; k < BWT_STREAMS; k++) {
+			store_le32(header + 4 + 4 * k, jobs[i].starts[k]);
+		}
+
+		ret = fwrite(header, 1, sizeof(header), out) == sizeof(header)
+		   && fwrite(jobs[i].out, 1, jobs[i].length, out) == jobs[i].length;
+	}
+
+	free_jobs(jobs, count);
+	return ret;
+}
+
+bool bwt_decode(FILE *in, FILE *out) {
+	bwt_job_t *jobs = NULL;
+	size_t count = 0;
+	bool ret = true;
+
+	for (uint8_t header[BWT_HEADER_SIZE];
+	     fread(header, 1, sizeof(header), in) == sizeof(header);)
+	{
+		uint32_t length = load_le32(header);
+
+		if (length > BWT_MAX_BLOCK) {
+			ret = false;
+			break;
+		}
+
+		jobs = realloc(jobs, (count + 1) * sizeof(bwt_job_t));
+		bwt_job_t *job = jobs + count++;
+
+		*job = (bwt_job_t) {
+			.in = malloc(length),
+			.out = malloc(length),
+			.length = length,
+		};
+
+		for (unsigned k = 0; k < BWT_STREAMS; k++) {
+			job->starts[k] = load_le32(header + 4 + 4 * k);
+		}
+
+		if (fread(job->in, 1, length, in) != length) {
+			ret = false;
+			break;
+		}
+	}
+
+	if (ret) {
+		bwt_run_jobs(jobs, count, true);
+	}
+
+	for (size_t i = 0; i < count && ret; i++) {
+		ret = jobs[i].ok
+		   && fwrite(jobs[i].out, 1, jobs[i].length, out) == jobs[i].length;
+	}
+
+	free_jobs(jobs, count);
+	return ret;
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+# checks that lines flushed with -F come out of the decoder while the
+# encoder's input is still open
+
+out=`mktemp`
+status=0
+
+for flags in "" "-H"; do
+	( echo "first line"; sleep 2; echo "second line" ) \
+		| ./lzs -e -F $flags | ./lzs -d $flags > $out &
+	sleep 1
+
+	if ! grep -q "first line" $out; then
+		echo "lzs $flags: flushed line wasn't decoded before the end of input"
+		status=1
+	fi
+
+	wait
+done
+
+rm $out
+exit $status
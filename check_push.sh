@@ -0,0 +1,50 @@
+#!/bin/sh
+# checks that the huffman and rle push decoders give back the input when
+# streams are fed in tiny pieces with tiny output buffers
+
+dir=`mktemp -d`
+status=0
+
+# short text gets a built-in table, longer text its own, random bytes are
+# stored, and -c codes each byte by the one before it
+head -c 100 lzs.c > $dir/short
+cp lzs.c $dir/text
+head -c 20000 /dev/urandom > $dir/random
+( head -c 5000 /dev/zero; cat lzs.c; printf '\a\a\a\a\a\a\a\a'; cat $dir/random ) \
+	> $dir/runs
+
+check() {
+	kind=$1 stream=$2 orig=$3
+
+	for sizes in "1 1" "7 3" "4096 1"; do
+		if ! ./push_check $kind $sizes < $stream | cmp -s - $orig; then
+			echo "$kind push decoder, pieces and room of $sizes: $stream differs"
+			status=1
+		fi
+	done
+}
+
+huffman() {
+	sig=$1 orig=$2
+	shift 2
+
+	./huffman "$@" $orig > $dir/$sig
+
+	if [ "`head -c 4 $dir/$sig`" != "$sig" ]; then
+		echo "huffman $* $orig didn't make a $sig stream"
+		status=1
+	fi
+
+	check huffman $dir/$sig $orig
+}
+
+huffman hzpt $dir/short -e
+huffman hzpl $dir/text -e
+huffman hzps $dir/random -e
+huffman hzpc $dir/text -c
+
+./rle -e < $dir/runs > $dir/rle
+check rle $dir/rle $dir/runs
+
+rm -r $dir
+exit $status
@@ -0,0 +1,272 @@
+#include <hz/checksum.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// reflected castagnoli polynomial
+#define CRC32C_POLY 0x82f63b78
+
+static uint32_t crc_table[8][256];
+static bool crc_hardware = false;
+static bool sha_hardware = false;
+
+__attribute__((constructor))
+static void checksum_init(void) {
+	for (unsigned i = 0; i < 256; i++) {
+		uint32_t crc = i;
+
+		for (unsigned k = 0; k < 8; k++) {
+			crc = (crc >> 1) ^ ((crc & 1)? CRC32C_POLY : 0);
+		}
+
+		crc_table[0][i] = crc;
+	}
+
+	for (unsigned i = 0; i < 256; i++) {
+		for (unsigned k = 1; k < 8; k++) {
+			uint32_t prev = crc_table[k - 1][i];
+			crc_table[k][i] = (prev >> 8) ^ crc_table[0][prev & 0xff];
+		}
+	}
+
+#if defined(__x86_64__)
+	crc_hardware = __builtin_cpu_supports("sse4.2");
+	sha_hardware = __builtin_cpu_supports("sha")
+	            && __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+static uint32_t crc32c_software(uint32_t crc, const uint8_t *p, size_t length) {
+	while (length && ((uintptr_t)p & 7)) {
+		crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+		length--;
+	}
+
+	// slicing-by-8, eight table lookups per 64 bit word
+	while (length >= 8) {
+		uint32_t lo, hi;
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo ^= crc;
+
+		crc = crc_table[7][lo & 0xff]
+		    ^ crc_table[6][(lo >> 8) & 0xff]
+		    ^ crc_table[5][(lo >> 16) & 0xff]
+		    ^ crc_table[4][lo >> 24]
+		    ^ crc_table[3][hi & 0xff]
+		    ^ crc_table[2][(hi >> 8) & 0xff]
+		    ^ crc_table[1][(hi >> 16) & 0xff]
+		    ^ crc_table[0][hi >> 24];
+
+		p += 8;
+		length -= 8;
+	}
+
+	while (length--) {
+		crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+	}
+
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const uint8_t *p, size_t length) {
+	uint64_t crc64 = crc;
+
+	while (length && ((uintptr_t)p & 7)) {
+		crc64 = _mm_crc32_u8(crc64, *p++);
+		length--;
+	}
+
+	while (length >= 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+
+		crc64 = _mm_crc32_u64(crc64, word);
+		p += 8;
+		length -= 8;
+	}
+
+	while (length--) {
+		crc64 = _mm_crc32_u8(crc64, *p++);
+	}
+
+	return crc64;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t length) {
+	crc = ~crc;
+
+#if defined(__x86_64__)
+	if (crc_hardware) {
+		return ~crc32c_hardware(crc, data, length);
+	}
+#endif
+
+	return ~crc32c_software(crc, data, length);
+}
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t ror32(uint32_t x, unsigned n) {
+	return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t load_be32(const uint8_t *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+	     | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void sha256_software(uint32_t state[8], const uint8_t *p, size_t blocks) {
+	for (; blocks--; p += 64) {
+		uint32_t w[64];
+		uint32_t s[8];
+
+		for (unsigned i = 0; i < 16; i++) {
+			w[i] = load_be32(p + 4 * i);
+		}
+
+		for (unsigned i = 16; i < 64; i++) {
+			uint32_t s0 = ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		memcpy(s, state, sizeof(s));
+
+		for (unsigned i = 0; i < 64; i++) {
+			uint32_t ch = (s[4] & s[5]) ^ (~s[4] & s[6]);
+			uint32_t maj = (s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]);
+			uint32_t t1 = s[7] + (ror32(s[4], 6) ^ ror32(s[4], 11) ^ ror32(s[4], 25))
+			            + ch + sha256_k[i] + w[i];
+			uint32_t t2 = (ror32(s[0], 2) ^ ror32(s[0], 13) ^ ror32(s[0], 22)) + maj;
+
+			memmove(s + 1, s, 7 * sizeof(uint32_t));
+			s[4] += t1;
+			s[0] = t1 + t2;
+		}
+
+		for (unsigned i = 0; i < 8; i++) {
+			state[i] += s[i];
+		}
+	}
+}
+
+#if defined(__x86_64__)
+// the sha256rnds2 instruction does two rounds on the state split into ABEF
+// and CDGH halves, and sha256msg1/2 extend the message schedule four words
+// at a time
+__attribute__((target("sha,sse4.1")))
+static void sha256_hardware(uint32_t state[8], const uint8_t *p, size_t blocks) {
+	const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+	                                    0x0405060700010203ULL);
+	__m128i dcba = _mm_loadu_si128((const __m128i *)state);
+	__m128i hgfe = _mm_loadu_si128((const __m128i *)(state + 4));
+	__m128i cdab = _mm_shuffle_epi32(dcba, 0xb1);
+	__m128i efgh = _mm_shuffle_epi32(hgfe, 0x1b);
+	__m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+	__m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xf0);
+
+	for (; blocks--; p += 64) {
+		__m128i saved_abef = abef;
+		__m128i saved_cdgh = cdgh;
+		__m128i msg[4];
+
+		for (unsigned i = 0; i < 4; i++) {
+			msg[i] = _mm_shuffle_epi8(
+				_mm_loadu_si128((const __m128i *)(p + 16 * i)), swap);
+		}
+
+		for (unsigned i = 0; i < 16; i++) {
+			__m128i w = msg[i & 3];
+			__m128i wk = _mm_add_epi32(w,
+				_mm_loadu_si128((const __m128i *)(sha256_k + 4 * i)));
+
+			cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+			abef = _mm_sha256rnds2_epu32(abef, cdgh,
+			                             _mm_shuffle_epi32(wk, 0x0e));
+
+			// words 4i+16 onwards replace the ones just used
+			if (i < 12) {
+				__m128i next = _mm_sha256msg1_epu32(w, msg[(i + 1) & 3]);
+				next = _mm_add_epi32(next, _mm_alignr_epi8(msg[(i + 3) & 3],
+				                                           msg[(i + 2) & 3], 4));
+				msg[i & 3] = _mm_sha256msg2_epu32(next, msg[(i + 3) & 3]);
+			}
+		}
+
+		abef = _mm_add_epi32(abef, saved_abef);
+		cdgh = _mm_add_epi32(cdgh, saved_cdgh);
+	}
+
+	__m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+	__m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+
+	_mm_storeu_si128((__m128i *)state, _mm_blend_epi16(feba, dchg, 0xf0));
+	_mm_storeu_si128((__m128i *)(state + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+#endif
+
+static void sha256_blocks(uint32_t state[8], const uint8_t *p, size_t blocks) {
+#if defined(__x86_64__)
+	if (sha_hardware) {
+		sha256_hardware(state, p, blocks);
+		return;
+	}
+#endif
+
+	sha256_software(state, p, blocks);
+}
+
+void sha256(const void *data, size_t length, uint8_t digest[SHA256_SIZE]) {
+	uint32_t state[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	const uint8_t *p = data;
+	uint8_t tail[128] = { 0 };
+	size_t rest = length % 64;
+
+	sha256_blocks(state, p, length / 64);
+
+	// padding is a 1 bit, zeros, then the length in bits as 64 bits big
+	// endian, in one or two more blocks
+	size_t tail_length = (rest < 56)? 64 : 128;
+	uint64_t bits = (uint64_t)length * 8;
+
+	if (rest) {
+		memcpy(tail, p + length - rest, rest);
+	}
+
+	tail[rest] = 0x80;
+
+	for (unsigned i = 0; i < 8; i++) {
+		tail[tail_length - 1 - i] = bits >> (8 * i);
+	}
+
+	sha256_blocks(state, tail, tail_length / 64);
+
+	for (unsigned i = 0; i < 8; i++) {
+		digest[4 * i]     = state[i] >> 24;
+		digest[4 * i + 1] = state[i] >> 16;
+		digest[4 * i + 2] = state[i] >> 8;
+		digest[4 * i + 3] = state[i];
+	}
+}
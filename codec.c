@@ -0,0 +1,470 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hz/codec.h>
+#include <hz/rle.h>
+#include <hz/lzs.h>
+#include <hz/huffman.h>
+#include <hz/huffctx.h>
+#include <hz/filter.h>
+#include <hz/bwt.h>
+#include <hz/dedup.h>
+#include <hz/trace.h>
+
+static bool rle_encode_codec(FILE *in, FILE *out, const codec_opts_t *opts) {
+	rle_encode(in, out);
+	return true;
+}
+
+static bool rle_decode_codec(FILE *in, FILE *out, const codec_opts_t *opts) {
+	rle_decode(in, out);
+	return true;
+}
+
+static lzs_params_t lzs_codec_params(const codec_opts_t *opts, bool entropy) {
+	return (lzs_params_t){
+		.window_size = opts->level? lzs_window_size(opts->level) : 0,
+		.entropy_coded = entropy,
+		.match_finder = lzs_match_finder(opts->level),
+		.dicts = NULL,
+		.dict_count = 0,
+	};
+}
+
+struct codec_ctx {
+	// indexed by whether the tokens are huffman coded, encoders are only
+	// kept for one level at a time
+	lzs_stream_t *encoders[2];
+	int levels[2];
+	lzs_decoder_t *decoders[2];
+};
+
+codec_ctx_t *codec_ctx_create(void) {
+	return calloc(1, sizeof(codec_ctx_t));
+}
+
+void codec_ctx_free(codec_ctx_t *ctx) {
+	for (unsigned i = 0; i < 2; i++) {
+		if (ctx->encoders[i]) lzs_stream_free(ctx->encoders[i]);
+		if (ctx->decoders[i]) lzs_decoder_free(ctx->decoders[i]);
+	}
+
+	free(ctx);
+}
+
+static lzs_stream_t *ctx_encoder(codec_ctx_t *ctx,
+                                 const lzs_params_t *params,
+                                 int level,
+                                 FILE *out)
+{
+	lzs_stream_t **stream = ctx->encoders + params->entropy_coded;
+
+	if (*stream && ctx->levels[params->entropy_coded] != level) {
+		lzs_stream_free(*stream);
+		*stream = NULL;
+	}
+
+	if (*stream) {
+		lzs_stream_reset(*stream, out);
+
+	} else {
+		*stream = lzs_stream_create(out, params);
+		ctx->levels[params->entropy_coded] = level;
+	}
+
+	return *stream;
+}
+
+static bool lzs_encode_with(FILE *in, FILE *out, const codec_opts_t *opts,
+                            bool entropy)
+{
+	lzs_params_t params = lzs_codec_params(opts, entropy);
+
+	if (!opts->ctx) {
+		return lzs_encode(in, out, &params);
+	}
+
+	lzs_stream_t *stream = ctx_encoder(opts->ctx, &params, opts->level, out);
+	uint8_t buf[0x1000];
+
+	if (!stream) {
+		return false;
+	}
+
+	for (size_t n; (n = fread(buf, 1, sizeof(buf), in)) > 0;) {
+		lzs_stream_write(stream, buf, n);
+	}
+
+	lzs_stream_finish(stream);
+	return true;
+}
+
+static bool lzs_decode_with(FILE *in, FILE *out, const codec_opts_t *opts,
+                            bool entropy)
+{
+	lzs_params_t params = lzs_codec_params(opts, entropy);
+
+	if (!opts->ctx) {
+		return lzs_decode(in, out, &params);
+	}
+
+	lzs_decoder_t **dec = opts->ctx->decoders + entropy;
+
+	if (!*dec && !(*dec = lzs_decoder_create(&params))) {
+		return false;
+	}
+
+	return lzs_decoder_run(*dec, in, out);
+}
+
+static bool lzs_decode_buffer_with(FILE *in, uint8_t *out, size_t size,
+                                   size_t *written, const codec_opts_t *opts,
+                                   bool entropy)
+{
+	lzs_params_t params = lzs_codec_params(opts, entropy);
+	lzs_decoder_t *temp = NULL;
+	lzs_decoder_t **dec = opts->ctx? opts->ctx->decoders + entropy : &temp;
+
+	if (!*dec && !(*dec = lzs_decoder_create(&params))) {
+		return false;
+	}
+
+	bool ret = lzs_decoder_run_buffer(*dec, in, out, size, written);
+
+	if (temp) {
+		lzs_decoder_free(temp);
+	}
+
+	return ret;
+}
+
+static bool lzs_encode_codec(FILE *in, FILE *out, const codec_opts_t *opts) {
+	return lzs_encode_with(in, out, opts, false);
+}
+
+static bool lzs_decode_codec(FILE *in, FILE *out, const codec_opts_t *opts) {
+	return lzs_decode_with(in, out, opts, false);
+}
+
+static bool lzs_decode_buffer_codec(FILE *in, uint8_t *out, size_t size,
+                                    size_t *written, const codec_opts_t *opts)
+{
+	return lzs_decode_buffer_with(in, out, size, written, opts, false);
+}
+
+static bool lzh_encode_codec(FILE *in, FILE *out, const codec_opts_t *opts) {
+	return lzs_encode_with(in, out, opts, true);
+}
+
+static bool lzh_decode_codec(FILE *in, FILE *out, const codec_opts_t *opts) {
+	return lzs_decode_with(in, out, opts, true);
+}
+
+static bool lzh_decode_buffer_codec(FILE *in, uint8_t *out, size_t size,
+                                    size_t *written, const codec_opts_t *opts)
+{
+	return lzs_decode_buffer_with(in, out, size, written, opts, true);
+}
+
+static bool huffman_encode_codec(FILE *in, FILE *out, const codec_opts_t *opts) {
+	return huffman_encode(in, out);
+}
+
+static bool huffman_decode_codec(FILE *in, FILE *out, const codec_opts_t *opts) {
+	return huffman_decode(in, out);
+}
+
+static bool huffctx_encode_codec(FILE *in, FILE *out, const codec_opts_t *opts) {
+	return huffctx_encode(in, out);
+}
+
+// levels pick the block size in steps of 256k, bigger blocks sort more
+// context together but take longer
+static bool bwt_encode_codec(FILE *in, FILE *out, const codec_opts_t *opts) {
+	return bwt_encode(in, out, (size_t)opts->level << 18);
+}
+
+static bool bwt_decode_codec(FILE *in, FILE *out, const codec_opts_t *opts) {
+	return bwt_decode(in, out);
+}
+
+// the chunk store is set with dedup_set_store()
+static bool dedup_encode_codec(FILE *in, FILE *out, const codec_opts_t *opts) {
+	return dedup_encode(in, out);
+}
+
+static bool dedup_decode_codec(FILE *in, FILE *out, const codec_opts_t *opts) {
+	return dedup_decode(in, out);
+}
+
+#define FILTER_CODEC(name, type, width) \
+	static bool name##_encode_codec(FILE *in, FILE *out, const codec_opts_t *opts) { \
+		return filter_encode_stream(in, out, type, width); \
+	} \
+	static bool name##_decode_codec(FILE *in, FILE *out, const codec_opts_t *opts) { \
+		return filter_decode_stream(in, out, type, width); \
+	}
+
+FILTER_CODEC(delta,    FILTER_DELTA,   1)
+FILTER_CODEC(delta2,   FILTER_DELTA,   2)
+FILTER_CODEC(delta4,   FILTER_DELTA,   4)
+FILTER_CODEC(delta8,   FILTER_DELTA,   8)
+FILTER_CODEC(xor4,     FILTER_XOR,     4)
+FILTER_CODEC(xor8,     FILTER_XOR,     8)
+FILTER_CODEC(shuffle2, FILTER_SHUFFLE, 2)
+FILTER_CODEC(shuffle4, FILTER_SHUFFLE, 4)
+FILTER_CODEC(shuffle8, FILTER_SHUFFLE, 8)
+
+static const codec_t codecs[] = {
+	{ CODEC_RLE,     "rle",     rle_encode_codec,     rle_decode_codec },
+	{ CODEC_LZS,     "lzs",     lzs_encode_codec,     lzs_decode_codec,
+	  lzs_decode_buffer_codec },
+	{ CODEC_LZH,     "lzh",     lzh_encode_codec,     lzh_decode_codec,
+	  lzh_decode_buffer_codec },
+	{ CODEC_HUFFMAN, "huffman", huffman_encode_codec, huffman_decode_codec },
+	{ CODEC_HUFFCTX, "huffctx", huffctx_encode_codec, huffman_decode_codec },
+	{ CODEC_DELTA,    "delta",    delta_encode_codec,    delta_decode_codec },
+	{ CODEC_DELTA2,   "delta2",   delta2_encode_codec,   delta2_decode_codec },
+	{ CODEC_DELTA4,   "delta4",   delta4_encode_codec,   delta4_decode_codec },
+	{ CODEC_DELTA8,   "delta8",   delta8_encode_codec,   delta8_decode_codec },
+	{ CODEC_XOR4,     "xor4",     xor4_encode_codec,     xor4_decode_codec },
+	{ CODEC_XOR8,     "xor8",     xor8_encode_codec,     xor8_decode_codec },
+	{ CODEC_SHUFFLE2, "shuffle2", shuffle2_encode_codec, shuffle2_decode_codec },
+	{ CODEC_SHUFFLE4, "shuffle4", shuffle4_encode_codec, shuffle4_decode_codec },
+	{ CODEC_SHUFFLE8, "shuffle8", shuffle8_encode_codec, shuffle8_decode_codec },
+	{ CODEC_BWT,      "bwt",      bwt_encode_codec,      bwt_decode_codec },
+	{ CODEC_DEDUP,    "dedup",    dedup_encode_codec,    dedup_decode_codec },
+};
+
+#define NUM_CODECS (sizeof(codecs) / sizeof(codecs[0]))
+
+const codec_t *codec_find(uint8_t id) {
+	for (unsigned i = 0; i < NUM_CODECS; i++) {
+		if (codecs[i].id == id) {
+			return codecs + i;
+		}
+	}
+
+	return NULL;
+}
+
+const codec_t *codec_find_name(const char *name) {
+	for (unsigned i = 0; i < NUM_CODECS; i++) {
+		if (strcmp(codecs[i].name, name) == 0) {
+			return codecs + i;
+		}
+	}
+
+	return NULL;
+}
+
+unsigned codec_parse_chain(const char *str, uint8_t *chain, unsigned max) {
+	char *temp = strdup(str);
+	char *saveptr = NULL;
+	unsigned ret = 0;
+
+	for (char *name = strtok_r(temp, ",", &saveptr);
+	     name;
+	     name = strtok_r(NULL, ",", &saveptr))
+	{
+		const codec_t *codec = codec_find_name(name);
+
+		if (!codec || ret == max) {
+			ret = 0;
+			break;
+		}
+
+		chain[ret++] = codec->id;
+	}
+
+	free(temp);
+	return ret;
+}
+
+// the codecs all work on stdio streams, so buffers are passed through them
+// with fmemopen() and open_memstream()
+static bool codec_run(const codec_t *codec,
+                      bool encode,
+                      const codec_opts_t *opts,
+                      const uint8_t *in,
+                      size_t inlen,
+                      uint8_t **out,
+                      size_t *outlen)
+{
+	char *outbuf = NULL;
+	size_t outsize = 0;
+
+	FILE *infp = fmemopen((void *)in, inlen, "r");
+	FILE *outfp = open_memstream(&outbuf, &outsize);
+
+	if (!infp || !outfp) {
+		if (infp)  fclose(infp);
+		if (outfp) fclose(outfp);
+		free(outbuf);
+		return false;
+	}
+
+	uint64_t start = trace_begin();
+	bool ret = encode? codec->encode(infp, outfp, opts)
+	                 : codec->decode(infp, outfp, opts);
+
+	trace_end(encode? "encode" : "decode", codec->name, start, inlen);
+
+	fclose(infp);
+	fclose(outfp);
+
+	if (!ret) {
+		free(outbuf);
+		return false;
+	}
+
+	*out = (uint8_t *)outbuf;
+	*outlen = outsize;
+	return true;
+}
+
+static bool codec_chain_run(const uint8_t *chain,
+                            unsigned length,
+                            bool encode,
+                            const codec_opts_t *opts,
+                            const uint8_t *in,
+                            size_t inlen,
+                            uint8_t **out,
+                            size_t *outlen)
+{
+	const uint8_t *cur = in;
+	size_t curlen = inlen;
+	uint8_t *owned = NULL;
+
+	for (unsigned i = 0; i < length; i++) {
+		const codec_t *codec = codec_find(chain[encode? i : length - i - 1]);
+		uint8_t *next = NULL;
+		size_t nextlen = 0;
+
+		if (!codec || !codec_run(codec, encode, opts, cur, curlen,
+		                         &next, &nextlen))
+		{
+			free(owned);
+			return false;
+		}
+
+		free(owned);
+		owned = next;
+		cur = next;
+		curlen = nextlen;
+	}
+
+	if (!owned) {
+		// empty chain, still hand back a buffer the caller can free
+		owned = malloc(curlen? curlen : 1);
+		memcpy(owned, cur, curlen);
+	}
+
+	*out = owned;
+	*outlen = curlen;
+	return true;
+}
+
+bool codec_chain_encode(const uint8_t *chain,
+                        unsigned length,
+                        const codec_opts_t *opts,
+                        const uint8_t *in,
+                        size_t inlen,
+                        uint8_t **out,
+                        size_t *outlen)
+{
+	return codec_chain_run(chain, length, true, opts, in, inlen, out, outlen);
+}
+
+bool codec_chain_decode(const uint8_t *chain,
+                        unsigned length,
+                        const codec_opts_t *opts,
+                        const uint8_t *in,
+                        size_t inlen,
+                        uint8_t **out,
+                        size_t *outlen)
+{
+	return codec_chain_run(chain, length, false, opts, in, inlen, out, outlen);
+}
+
+// codecs without a decode_buffer() go through codec_run() and are copied in
+static bool codec_run_buffer(const codec_t *codec,
+                             const codec_opts_t *opts,
+                             const uint8_t *in,
+                             size_t inlen,
+                             uint8_t *out,
+                             size_t size,
+                             size_t *outlen)
+{
+	if (!codec->decode_buffer) {
+		uint8_t *temp = NULL;
+
+		if (!codec_run(codec, false, opts, in, inlen, &temp, outlen)) {
+			return false;
+		}
+
+		bool ret = *outlen <= size;
+
+		if (ret) {
+			memcpy(out, temp, *outlen);
+		}
+
+		free(temp);
+		return ret;
+	}
+
+	FILE *infp = fmemopen((void *)in, inlen, "r");
+
+	if (!infp) {
+		return false;
+	}
+
+	uint64_t start = trace_begin();
+	bool ret = codec->decode_buffer(infp, out, size, outlen, opts);
+
+	trace_end("decode", codec->name, start, inlen);
+	fclose(infp);
+	return ret;
+}
+
+bool codec_chain_decode_buffer(const uint8_t *chain,
+                               unsigned length,
+                               const codec_opts_t *opts,
+                               const uint8_t *in,
+                               size_t inlen,
+                               uint8_t *out,
+                               size_t size,
+                               size_t *outlen)
+{
+	if (length == 0) {
+		*outlen = inlen;
+
+		if (inlen > size) {
+			return false;
+		}
+
+		memcpy(out, in, inlen);
+		return true;
+	}
+
+	// decoding runs the chain back to front, everything but the first codec
+	// goes through temporary buffers as usual
+	const codec_t *last = codec_find(chain[0]);
+	uint8_t *temp = NULL;
+	size_t templen = inlen;
+
+	if (!last || (length > 1 && !codec_chain_run(chain + 1, length - 1, false,
+	                                             opts, in, inlen,
+	                                             &temp, &templen)))
+	{
+		return false;
+	}
+
+	bool ret = codec_run_buffer(last, opts, temp? temp : in, templen,
+	                            out, size, outlen);
+
+	free(temp);
+	return ret;
+}
@@ -0,0 +1,329 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <hz/dedup.h>
+#include <hz/bytes.h>
+#include <hz/checksum.h>
+#include <hz/trace.h>
+
+// normalized chunking: cut points are harder to hit before the average size
+// and easier after it, which keeps most chunks close to the average. the
+// mask bits are taken from the top of the hash, which depends on the last
+// 64 bytes.
+#define CUT_BITS_SMALL 15
+#define CUT_BITS_LARGE 11
+#define CUT_MASK(bits) (~(uint64_t)0 << (64 - (bits)))
+
+// input is read in pieces this big, chunks are cut until less than a
+// maximum chunk is left and the rest is kept for the next piece
+#define DEDUP_BUFFER (16 * DEDUP_MAX_CHUNK)
+
+// "xx/" and the fingerprint in hex
+#define CHUNK_PATH_SIZE (3 + 2 * SHA256_SIZE + 1)
+
+static uint64_t gear[256];
+static const char *store_path = NULL;
+static atomic_uint temp_counter;
+
+// the table is part of where chunks are cut, so changing it would stop new
+// chunks from matching the ones already in existing stores
+__attribute__((constructor))
+static void dedup_init(void) {
+	uint64_t x = 0x6a09e667f3bcc909;
+
+	for (unsigned i = 0; i < 256; i++) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+void dedup_set_store(const char *path) {
+	store_path = path;
+}
+
+size_t dedup_cut(const uint8_t *buf, size_t length) {
+	if (length <= DEDUP_MIN_CHUNK) {
+		return length;
+	}
+
+	size_t normal = (length < DEDUP_AVG_CHUNK)? length : DEDUP_AVG_CHUNK;
+	size_t end = (length < DEDUP_MAX_CHUNK)? length : DEDUP_MAX_CHUNK;
+	uint64_t hash = 0;
+	size_t i = DEDUP_MIN_CHUNK - 64;
+
+	// nothing before the minimum size can be a cut point, only the bytes
+	// that are still in the hash by then are looked at
+	for (; i < DEDUP_MIN_CHUNK; i++) {
+		hash = (hash << 1) + gear[buf[i]];
+	}
+
+	for (; i < normal; i++) {
+		hash = (hash << 1) + gear[buf[i]];
+
+		if (!(hash & CUT_MASK(CUT_BITS_SMALL))) {
+			return i + 1;
+		}
+	}
+
+	for (; i < end; i++) {
+		hash = (hash << 1) + gear[buf[i]];
+
+		if (!(hash & CUT_MASK(CUT_BITS_LARGE))) {
+			return i + 1;
+		}
+	}
+
+	return end;
+}
+
+static void chunk_path(const uint8_t digest[SHA256_SIZE],
+                       char path[CHUNK_PATH_SIZE])
+{
+	static const char hex[] = "0123456789abcdef";
+
+	path[0] = hex[digest[0] >> 4];
+	path[1] = hex[digest[0] & 0xf];
+	path[2] = '/';
+
+	for (unsigned i = 0; i < SHA256_SIZE; i++) {
+		path[3 + 2 * i]     = hex[digest[i] >> 4];
+		path[3 + 2 * i + 1] = hex[digest[i] & 0xf];
+	}
+
+	path[CHUNK_PATH_SIZE - 1] = '\0';
+}
+
+static int store_open(bool create) {
+	if (!store_path) {
+		fprintf(stderr, "error: dedup needs a chunk store, see --store\n");
+		return -1;
+	}
+
+	int ret = open(store_path, O_RDONLY | O_DIRECTORY);
+
+	if (ret < 0 && errno == ENOENT && create && mkdir(store_path, 0777) == 0) {
+		ret = open(store_path, O_RDONLY | O_DIRECTORY);
+	}
+
+	if (ret < 0) {
+		fprintf(stderr, "error: couldn't open chunk store \"%s\"\n", store_path);
+	}
+
+	return ret;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t length) {
+	while (length > 0) {
+		ssize_t n = write(fd, data, length);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (n <= 0) {
+			return false;
+		}
+
+		data += n;
+		length -= n;
+	}
+
+	return true;
+}
+
+static bool store_put(int dir, const char *path,
+                      const uint8_t *data, size_t length)
+{
+	char subdir[3] = { path[0], path[1], '\0' };
+	char temp[64];
+
+	if (mkdirat(dir, subdir, 0777) < 0 && errno != EEXIST) {
+		return false;
+	}
+
+	snprintf(temp, sizeof(temp), "%s/.tmp.%d.%u", subdir, (int)getpid(),
+	         atomic_fetch_add(&temp_counter, 1));
+
+	int fd = openat(dir, temp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	bool ret = write_all(fd, data, length);
+	ret = (close(fd) == 0) && ret;
+
+	// another encoder may have added the same chunk meanwhile, renaming over
+	// it is harmless since the contents are the same
+	if (!ret || renameat(dir, temp, dir, path) < 0) {
+		unlinkat(dir, temp, 0);
+		return false;
+	}
+
+	return true;
+}
+
+// fails unless the stored chunk is exactly `length` bytes
+static bool store_get(int dir, const char *path, uint8_t *buf, size_t length) {
+	int fd = openat(dir, path, O_RDONLY);
+	size_t have = 0;
+	uint8_t extra;
+
+	if (fd < 0) {
+		return false;
+	}
+
+	while (have < length) {
+		ssize_t n = read(fd, buf + have, length - have);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (n <= 0) {
+			break;
+		}
+
+		have += n;
+	}
+
+	bool ret = have == length && read(fd, &extra, 1) == 0;
+	close(fd);
+	return ret;
+}
+
+static bool write_record(FILE *out, uint8_t type, uint32_t length,
+                         const uint8_t *data, size_t size)
+{
+	return fputc(type, out) != EOF
+	    && write_le32(out, length)
+	    && fwrite(data, 1, size, out) == size;
+}
+
+static bool dedup_chunk(int dir, const uint8_t *chunk, size_t length, FILE *out) {
+	uint8_t digest[SHA256_SIZE];
+	char path[CHUNK_PATH_SIZE];
+
+	if (length < DEDUP_MIN_CHUNK) {
+		return write_record(out, DEDUP_DATA, length, chunk, length);
+	}
+
+	uint64_t start = trace_begin();
+	sha256(chunk, length, digest);
+	chunk_path(digest, path);
+	trace_end("dedup", "fingerprint", start, length);
+
+	if (faccessat(dir, path, F_OK, 0) == 0) {
+		return write_record(out, DEDUP_REF, length, digest, SHA256_SIZE);
+	}
+
+	start = trace_begin();
+
+	if (!store_put(dir, path, chunk, length)) {
+		fprintf(stderr, "error: couldn't add chunk %s to the store\n", path);
+		return false;
+	}
+
+	trace_end("dedup", "store", start, length);
+	return write_record(out, DEDUP_DATA, length, chunk, length);
+}
+
+bool dedup_encode(FILE *in, FILE *out) {
+	int dir = store_open(true);
+
+	if (dir < 0) {
+		return false;
+	}
+
+	uint8_t *buf = malloc(DEDUP_BUFFER);
+	size_t have = 0;
+	bool eof = false;
+	bool ret = true;
+
+	while (ret && !eof) {
+		have += fread(buf + have, 1, DEDUP_BUFFER - have, in);
+		eof = have < DEDUP_BUFFER;
+
+		size_t pos = 0;
+
+		// cut points depend on the following bytes, so a chunk is only cut
+		// with a whole maximum chunk after it or at the end of the input
+		while (ret && pos < have && (eof || have - pos >= DEDUP_MAX_CHUNK)) {
+			uint64_t start = trace_begin();
+			size_t length = dedup_cut(buf + pos, have - pos);
+			trace_end("dedup", "chunk", start, length);
+
+			ret = dedup_chunk(dir, buf + pos, length, out);
+			pos += length;
+		}
+
+		memmove(buf, buf + pos, have - pos);
+		have -= pos;
+	}
+
+	free(buf);
+	close(dir);
+	return ret && !ferror(in);
+}
+
+bool dedup_decode(FILE *in, FILE *out) {
+	uint8_t *buf = malloc(DEDUP_MAX_CHUNK);
+	int dir = -1;
+	bool ret = true;
+
+	for (int type; ret && (type = fgetc(in)) != EOF;) {
+		uint8_t digest[SHA256_SIZE];
+		char path[CHUNK_PATH_SIZE];
+		uint32_t length;
+
+		if (!read_le32(in, &length) || length > DEDUP_MAX_CHUNK
+		    || (type != DEDUP_DATA && type != DEDUP_REF))
+		{
+			fprintf(stderr, "error: corrupt dedup record\n");
+			ret = false;
+			break;
+		}
+
+		if (type == DEDUP_DATA) {
+			ret = fread(buf, 1, length, in) == length;
+
+		} else if (fread(digest, 1, SHA256_SIZE, in) != SHA256_SIZE) {
+			ret = false;
+
+		} else {
+			// the store is only needed once there's a reference
+			if (dir < 0 && (dir = store_open(false)) < 0) {
+				ret = false;
+				break;
+			}
+
+			chunk_path(digest, path);
+			ret = store_get(dir, path, buf, length);
+
+			if (!ret) {
+				fprintf(stderr, "error: chunk %s is missing from the store "
+				                "or has the wrong size\n", path);
+			}
+		}
+
+		ret = ret && fwrite(buf, 1, length, out) == length;
+	}
+
+	if (dir >= 0) {
+		close(dir);
+	}
+
+	free(buf);
+	return ret;
+}
@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <hz/filter.h>
+#include <hz/trace.h>
+
+// most bytes in a word, and in a shuffled block of 16 words
+#define FILTER_MAX_WIDTH 8
+
+static bool filter_avx2 = false;
+
+__attribute__((constructor))
+static void filter_init(void) {
+#if defined(__x86_64__)
+	filter_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+static inline uint64_t load_word(const uint8_t *p, unsigned width) {
+	uint64_t ret = 0;
+
+	for (unsigned i = 0; i < width; i++) {
+		ret |= (uint64_t)p[i] << (8 * i);
+	}
+
+	return ret;
+}
+
+static inline void store_word(uint8_t *p, unsigned width, uint64_t x) {
+	for (unsigned i = 0; i < width; i++) {
+		p[i] = x >> (8 * i);
+	}
+}
+
+// delta and xor encoding run back to front, so each word is still the
+// original when the word after it is done. returns where the scalar code has
+// to take over, vectors handle everything from there up.
+#define ENCODE_LOOP(vec, load, store, op, step) \
+	for (; o >= (step) + width; o -= (step)) { \
+		vec cur = load((const vec *)(p + o - (step))); \
+		vec prev = load((const vec *)(p + o - (step) - width)); \
+		store((vec *)(p + o - (step)), op(cur, prev)); \
+	}
+
+#if defined(__x86_64__)
+static size_t encode_sse2(filter_type_t type, unsigned width,
+                          uint8_t *p, size_t o)
+{
+	switch ((type == FILTER_XOR)? 0 : width) {
+		case 0: ENCODE_LOOP(__m128i, _mm_loadu_si128, _mm_storeu_si128,
+		                    _mm_xor_si128, 16); break;
+		case 1: ENCODE_LOOP(__m128i, _mm_loadu_si128, _mm_storeu_si128,
+		                    _mm_sub_epi8, 16); break;
+		case 2: ENCODE_LOOP(__m128i, _mm_loadu_si128, _mm_storeu_si128,
+		                    _mm_sub_epi16, 16); break;
+		case 4: ENCODE_LOOP(__m128i, _mm_loadu_si128, _mm_storeu_si128,
+		                    _mm_sub_epi32, 16); break;
+		case 8: ENCODE_LOOP(__m128i, _mm_loadu_si128, _mm_storeu_si128,
+		                    _mm_sub_epi64, 16); break;
+	}
+
+	return o;
+}
+
+__attribute__((target("avx2")))
+static size_t encode_avx2(filter_type_t type, unsigned width,
+                          uint8_t *p, size_t o)
+{
+	switch ((type == FILTER_XOR)? 0 : width) {
+		case 0: ENCODE_LOOP(__m256i, _mm256_loadu_si256, _mm256_storeu_si256,
+		                    _mm256_xor_si256, 32); break;
+		case 1: ENCODE_LOOP(__m256i, _mm256_loadu_si256, _mm256_storeu_si256,
+		                    _mm256_sub_epi8, 32); break;
+		case 2: ENCODE_LOOP(__m256i, _mm256_loadu_si256, _mm256_storeu_si256,
+		                    _mm256_sub_epi16, 32); break;
+		case 4: ENCODE_LOOP(__m256i, _mm256_loadu_si256, _mm256_storeu_si256,
+		                    _mm256_sub_epi32, 32); break;
+		case 8: ENCODE_LOOP(__m256i, _mm256_loadu_si256, _mm256_storeu_si256,
+		                    _mm256_sub_epi64, 32); break;
+	}
+
+	return o;
+}
+
+// decoding is a prefix sum (or xor). within a vector that's log2(16 / W)
+// shift and add steps, then the last word of the vector before is added to
+// every lane. returns where the scalar code has to take over.
+#define PREFIX_STEPS(x, W, op) \
+	x = op(x, _mm_slli_si128(x, (W))); \
+	if ((W) < 8) x = op(x, _mm_slli_si128(x, 2 * (W))); \
+	if ((W) < 4) x = op(x, _mm_slli_si128(x, 4 * (W))); \
+	if ((W) < 2) x = op(x, _mm_slli_si128(x, 8 * (W)));
+
+#define PREFIX_LOOP(W, op) \
+	for (; o + 16 <= bytes; o += 16) { \
+		__m128i x = _mm_loadu_si128((const __m128i *)(p + o)); \
+		PREFIX_STEPS(x, W, op); \
+		x = op(x, carry); \
+		_mm_storeu_si128((__m128i *)(p + o), x); \
+		\
+		/* the last word moved to the bottom, then spread to every lane */ \
+		carry = _mm_srli_si128(x, 16 - (W)); \
+		PREFIX_STEPS(carry, W, _mm_or_si128); \
+	}
+
+static size_t decode_sse2(filter_type_t type, unsigned width,
+                          uint8_t *p, size_t bytes)
+{
+	__m128i carry = _mm_setzero_si128();
+	size_t o = 0;
+
+	if (type == FILTER_XOR) {
+		switch (width) {
+			case 1: PREFIX_LOOP(1, _mm_xor_si128); break;
+			case 2: PREFIX_LOOP(2, _mm_xor_si128); break;
+			case 4: PREFIX_LOOP(4, _mm_xor_si128); break;
+			case 8: PREFIX_LOOP(8, _mm_xor_si128); break;
+		}
+
+	} else {
+		switch (width) {
+			case 1: PREFIX_LOOP(1, _mm_add_epi8); break;
+			case 2: PREFIX_LOOP(2, _mm_add_epi16); break;
+			case 4: PREFIX_LOOP(4, _mm_add_epi32); break;
+			case 8: PREFIX_LOOP(8, _mm_add_epi64); break;
+		}
+	}
+
+	return o;
+}
+
+// transposes blocks of 16 words. the byte at index (word, byte) has to move
+// to (byte, word), in bits that's rotating the index left by 4. interleaving
+// vector m with vector m + width / 2 rotates it left by 1, so 4 rounds
+// shuffle a block. the inverse is log2(width) more rounds, which comes back
+// around to where it started.
+static void interleave_rounds(__m128i *v, unsigned width, unsigned rounds) {
+	__m128i t[FILTER_MAX_WIDTH];
+	unsigned half = width / 2;
+
+	for (unsigned r = 0; r < rounds; r++) {
+		for (unsigned m = 0; m < half; m++) {
+			t[2 * m]     = _mm_unpacklo_epi8(v[m], v[m + half]);
+			t[2 * m + 1] = _mm_unpackhi_epi8(v[m], v[m + half]);
+		}
+
+		memcpy(v, t, width * sizeof(__m128i));
+	}
+}
+
+static size_t shuffle_sse2(const uint8_t *in, uint8_t *out,
+                           size_t words, unsigned width)
+{
+	size_t blocks = words / 16;
+	__m128i v[FILTER_MAX_WIDTH];
+
+	for (size_t b = 0; b < blocks; b++) {
+		for (unsigned k = 0; k < width; k++) {
+			v[k] = _mm_loadu_si128((const __m128i *)(in + 16 * (b * width + k)));
+		}
+
+		interleave_rounds(v, width, 4);
+
+		for (unsigned k = 0; k < width; k++) {
+			_mm_storeu_si128((__m128i *)(out + k * words + 16 * b), v[k]);
+		}
+	}
+
+	return 16 * blocks;
+}
+
+static size_t unshuffle_sse2(const uint8_t *in, uint8_t *out,
+                             size_t words, unsigned width)
+{
+	size_t blocks = words / 16;
+	unsigned rounds = __builtin_ctz(width);
+	__m128i v[FILTER_MAX_WIDTH];
+
+	for (size_t b = 0; b < blocks; b++) {
+		for (unsigned k = 0; k < width; k++) {
+			v[k] = _mm_loadu_si128((const __m128i *)(in + k * words + 16 * b));
+		}
+
+		interleave_rounds(v, width, rounds);
+
+		for (unsigned k = 0; k < width; k++) {
+			_mm_storeu_si128((__m128i *)(out + 16 * (b * width + k)), v[k]);
+		}
+	}
+
+	return 16 * blocks;
+}
+#endif
+
+static void shuffle(const uint8_t *in, uint8_t *out, size_t words,
+                    unsigned width, bool inverse)
+{
+	size_t done = 0;
+
+#if defined(__x86_64__)
+	done = inverse? unshuffle_sse2(in, out, words, width)
+	              : shuffle_sse2(in, out, words, width);
+#endif
+
+	for (size_t i = done; i < words; i++) {
+		for (unsigned k = 0; k < width; k++) {
+			if (inverse) {
+				out[i * width + k] = in[k * words + i];
+			} else {
+				out[k * words + i] = in[i * width + k];
+			}
+		}
+	}
+}
+
+static bool valid_width(filter_type_t type, unsigned width) {
+	return (width == 1 || width == 2 || width == 4 || width == 8)
+	    && !(type == FILTER_SHUFFLE && width == 1);
+}
+
+static void filter_shuffle(unsigned width, uint8_t *buf, size_t length,
+                           bool inverse)
+{
+	size_t words = length / width;
+	uint8_t *temp = malloc(words * width);
+
+	shuffle(buf, temp, words, width, inverse);
+	memcpy(buf, temp, words * width);
+	free(temp);
+}
+
+void filter_encode(filter_type_t type, unsigned width, uint8_t *buf, size_t length) {
+	if (!valid_width(type, width) || length < 2 * width) {
+		return;
+	}
+
+	if (type == FILTER_SHUFFLE) {
+		filter_shuffle(width, buf, length, false);
+		return;
+	}
+
+	size_t o = length - length % width;
+
+#if defined(__x86_64__)
+	o = filter_avx2? encode_avx2(type, width, buf, o)
+	               : encode_sse2(type, width, buf, o);
+#endif
+
+	// the words below `o` that are left, back to front. the first word is
+	// kept as it is.
+	for (size_t i = o; i > width;) {
+		i -= width;
+
+		uint64_t cur = load_word(buf + i, width);
+		uint64_t prev = load_word(buf + i - width, width);
+
+		store_word(buf + i, width, (type == FILTER_XOR)? cur ^ prev : cur - prev);
+	}
+}
+
+void filter_decode(filter_type_t type, unsigned width, uint8_t *buf, size_t length) {
+	if (!valid_width(type, width) || length < 2 * width) {
+		return;
+	}
+
+	if (type == FILTER_SHUFFLE) {
+		filter_shuffle(width, buf, length, true);
+		return;
+	}
+
+	size_t bytes = length - length % width;
+	size_t o = 0;
+
+#if defined(__x86_64__)
+	o = decode_sse2(type, width, buf, bytes);
+#endif
+
+	for (size_t i = (o > width)? o : width; i < bytes; i += width) {
+		uint64_t cur = load_word(buf + i, width);
+		uint64_t prev = load_word(buf + i - width, width);
+
+		store_word(buf + i, width, (type == FILTER_XOR)? cur ^ prev : cur + prev);
+	}
+}
+
+// the filters need the whole input at once
+static uint8_t *read_all(FILE *in, size_t *length) {
+	size_t space = 0x10000;
+	uint8_t *ret = malloc(space);
+
+	*length = 0;
+
+	for (size_t n; (n = fread(ret + *length, 1, space - *length, in)) > 0;) {
+		*length += n;
+
+		if (*length == space) {
+			space *= 2;
+			ret = realloc(ret, space);
+		}
+	}
+
+	return ret;
+}
+
+static bool filter_stream(FILE *in, FILE *out, filter_type_t type,
+                          unsigned width, bool encode)
+{
+	size_t length = 0;
+	uint8_t *buf = read_all(in, &length);
+	uint64_t start = trace_begin();
+
+	if (encode) {
+		filter_encode(type, width, buf, length);
+	} else {
+		filter_decode(type, width, buf, length);
+	}
+
+	trace_end("filter", encode? "encode" : "decode", start, length);
+
+	bool ret = fwrite(buf, 1, length, out) == length;
+	free(buf);
+	return ret;
+}
+
+bool filter_encode_stream(FILE *in, FILE *out, filter_type_t type, unsigned width) {
+	return filter_stream(in, out, type, width, true);
+}
+
+bool filter_decode_stream(FILE *in, FILE *out, filter_type_t type, unsigned width) {
+	return filter_stream(in, out, type, width, false);
+}
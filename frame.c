@@ -0,0 +1,759 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <hz/frame.h>
+#include <hz/bytes.h>
+#include <hz/checksum.h>
+#include <hz/trace.h>
+
+// magic + version + flags + chain length + chain + block size + content
+// size + level + check
+#define FRAME_HEADER_MAX (4 + 1 + 1 + 1 + CODEC_MAX_CHAIN + 4 + 8 + 1 + 1)
+#define FRAME_BLOCK_HEADER_SIZE 12
+#define FRAME_SEEK_FOOTER_SIZE 12
+#define FRAME_SEEK_ENTRY_SIZE 8
+
+bool frame_write_header(FILE *out, const frame_header_t *header) {
+	uint8_t buf[FRAME_HEADER_MAX];
+	size_t length = 0;
+
+	memcpy(buf, FRAME_MAGIC, 4);
+	length += 4;
+
+	buf[length++] = header->version;
+	buf[length++] = header->flags;
+	buf[length++] = header->chain_length;
+
+	memcpy(buf + length, header->chain, header->chain_length);
+	length += header->chain_length;
+
+	store_le32(buf + length, header->block_size);
+	length += 4;
+
+	if (header->flags & FRAME_FLAG_CONTENT_SIZE) {
+		store_le64(buf + length, header->content_size);
+		length += 8;
+	}
+
+	if (header->flags & FRAME_FLAG_LEVEL) {
+		buf[length++] = header->level;
+	}
+
+	buf[length] = crc32c(0, buf, length) >> 8;
+	length += 1;
+
+	return fwrite(buf, 1, length, out) == length;
+}
+
+bool frame_read_header(FILE *in, frame_header_t *header) {
+	uint8_t buf[FRAME_HEADER_MAX];
+	size_t length = 7;
+
+	if (fread(buf, 1, length, in) != length) {
+		fprintf(stderr, "error: truncated frame header\n");
+		return false;
+	}
+
+	if (memcmp(buf, FRAME_MAGIC, 4) != 0) {
+		fprintf(stderr, "error: bad magic, not an hz frame\n");
+		return false;
+	}
+
+	header->version = buf[4];
+	header->flags = buf[5];
+	header->chain_length = buf[6];
+
+	if (header->version != FRAME_VERSION) {
+		fprintf(stderr, "error: unsupported frame version %u\n",
+		        header->version);
+		return false;
+	}
+
+	if (header->chain_length > CODEC_MAX_CHAIN) {
+		fprintf(stderr, "error: codec chain is too long (%u)\n",
+		        header->chain_length);
+		return false;
+	}
+
+	size_t rest = header->chain_length + 4 + 1
+	            + ((header->flags & FRAME_FLAG_CONTENT_SIZE)? 8 : 0)
+	            + ((header->flags & FRAME_FLAG_LEVEL)? 1 : 0);
+
+	if (fread(buf + length, 1, rest, in) != rest) {
+		fprintf(stderr, "error: truncated frame header\n");
+		return false;
+	}
+
+	memcpy(header->chain, buf + length, header->chain_length);
+	length += header->chain_length;
+
+	header->block_size = load_le32(buf + length);
+	length += 4;
+
+	if (header->flags & FRAME_FLAG_CONTENT_SIZE) {
+		header->content_size = load_le64(buf + length);
+		length += 8;
+	}
+
+	if (header->flags & FRAME_FLAG_LEVEL) {
+		header->level = buf[length++];
+	}
+
+	if ((uint8_t)(crc32c(0, buf, length) >> 8) != buf[length]) {
+		fprintf(stderr, "error: frame header checksum mismatch\n");
+		return false;
+	}
+
+	if (header->flags & ~FRAME_KNOWN_FLAGS) {
+		fprintf(stderr, "error: unknown frame flags %02x\n", header->flags);
+		return false;
+	}
+
+	for (unsigned i = 0; i < header->chain_length; i++) {
+		if (!codec_find(header->chain[i])) {
+			fprintf(stderr, "error: unknown codec id %u\n", header->chain[i]);
+			return false;
+		}
+	}
+
+	if (header->block_size == 0 || header->block_size > FRAME_MAX_BLOCK_SIZE) {
+		fprintf(stderr, "error: bad block size %u\n", header->block_size);
+		return false;
+	}
+
+	return true;
+}
+
+bool frame_write_block_header(FILE *out, const frame_block_t *block) {
+	uint8_t buf[FRAME_BLOCK_HEADER_SIZE];
+
+	store_le32(buf, block->usize);
+	store_le32(buf + 4, block->csize | (block->stored? FRAME_BLOCK_STORED : 0));
+	store_le32(buf + 8, block->checksum);
+
+	return fwrite(buf, 1, sizeof(buf), out) == sizeof(buf);
+}
+
+bool frame_read_block_header(FILE *in, frame_block_t *block) {
+	uint8_t buf[FRAME_BLOCK_HEADER_SIZE];
+
+	// the end marker is only the usize field
+	if (fread(buf, 1, 4, in) != 4) {
+		return false;
+	}
+
+	block->usize = load_le32(buf);
+	block->csize = block->checksum = 0;
+	block->stored = false;
+
+	if (block->usize == 0) {
+		return true;
+	}
+
+	if (fread(buf + 4, 1, 8, in) != 8) {
+		return false;
+	}
+
+	block->csize = load_le32(buf + 4) & ~FRAME_BLOCK_STORED;
+	block->stored = (load_le32(buf + 4) & FRAME_BLOCK_STORED) != 0;
+	block->checksum = load_le32(buf + 8);
+	return true;
+}
+
+static size_t read_block(FILE *in, uint8_t *buf, size_t size) {
+	size_t ret = 0;
+
+	while (ret < size && !feof(in) && !ferror(in)) {
+		ret += fread(buf + ret, 1, size - ret, in);
+	}
+
+	return ret;
+}
+
+bool frame_compress(FILE *in, FILE *out, const frame_params_t *params) {
+	frame_header_t header = {
+		.version = FRAME_VERSION,
+		.flags = params->seek_table? FRAME_FLAG_SEEK_TABLE : 0,
+		.chain_length = params->chain_length,
+		.block_size = params->block_size,
+		.content_size = params->content_size,
+		.level = params->opts.level,
+	};
+
+	if (params->has_content_size) {
+		header.flags |= FRAME_FLAG_CONTENT_SIZE;
+	}
+
+	if (params->record_level) {
+		header.flags |= FRAME_FLAG_LEVEL;
+	}
+
+	memcpy(header.chain, params->chain, params->chain_length);
+
+	if (!frame_write_header(out, &header)) {
+		fprintf(stderr, "error: couldn't write frame header\n");
+		return false;
+	}
+
+	uint8_t *buf = malloc(params->block_size);
+	bool ret = true;
+
+	uint8_t *seek = NULL;
+	size_t seek_count = 0;
+	size_t seek_space = 0;
+	uint64_t total = 0;
+
+	for (;;) {
+		size_t length = read_block(in, buf, params->block_size);
+
+		if (length == 0) {
+			break;
+		}
+
+		total += length;
+
+		uint64_t start = trace_begin();
+		uint8_t *coded = NULL;
+		size_t codedlen = 0;
+
+		if (!codec_chain_encode(params->chain, params->chain_length,
+		                        &params->opts, buf, length,
+		                        &coded, &codedlen))
+		{
+			fprintf(stderr, "error: couldn't encode block\n");
+			ret = false;
+			break;
+		}
+
+		// blocks that don't get any smaller are kept as they are
+		bool stored = codedlen >= length;
+		const uint8_t *payload = stored? buf : coded;
+
+		frame_block_t block = {
+			.usize = length,
+			.csize = stored? length : codedlen,
+			.checksum = crc32c(0, buf, length),
+			.stored = stored,
+		};
+
+		bool written = frame_write_block_header(out, &block)
+		            && fwrite(payload, 1, block.csize, out) == block.csize;
+		free(coded);
+
+		trace_end("frame", "compress block", start, length);
+
+		if (!written) {
+			fprintf(stderr, "error: couldn't write block\n");
+			ret = false;
+			break;
+		}
+
+		if (params->seek_table) {
+			if (seek_count == seek_space) {
+				seek_space = seek_space? seek_space * 2 : 64;
+				seek = realloc(seek, seek_space * FRAME_SEEK_ENTRY_SIZE);
+			}
+
+			uint8_t *ent = seek + seek_count * FRAME_SEEK_ENTRY_SIZE;
+			store_le32(ent, block.usize);
+			store_le32(ent + 4, FRAME_BLOCK_HEADER_SIZE + block.csize);
+			seek_count++;
+		}
+	}
+
+	if (ret && params->has_content_size && total != params->content_size) {
+		fprintf(stderr, "error: input size changed while compressing\n");
+		ret = false;
+	}
+
+	if (ret && !write_le32(out, 0)) {
+		fprintf(stderr, "error: couldn't write end of frame\n");
+		ret = false;
+	}
+
+	if (ret && params->seek_table) {
+		size_t size = seek_count * FRAME_SEEK_ENTRY_SIZE;
+
+		if (fwrite(seek, 1, size, out) != size
+		    || !write_le32(out, seek_count)
+		    || !write_le32(out, crc32c(0, seek, size))
+		    || fwrite(FRAME_SEEK_MAGIC, 1, 4, out) != 4)
+		{
+			fprintf(stderr, "error: couldn't write seek table\n");
+			ret = false;
+		}
+	}
+
+	if (ferror(in)) {
+		fprintf(stderr, "error: couldn't read input\n");
+		ret = false;
+	}
+
+	free(seek);
+	free(buf);
+	return ret;
+}
+
+typedef enum {
+	BLOCK_OK,
+	BLOCK_END,
+	BLOCK_ERROR,
+} block_status_t;
+
+// payloads are allowed to be somewhat bigger than the block they came from,
+// anything past that is corruption
+static size_t max_payload_size(const frame_header_t *header) {
+	return 2 * (size_t)header->block_size + 0x10000;
+}
+
+// reads and decodes the block at the current position, `*data` is
+// malloc()'d and checked against the block checksum. `*payload` is grown to
+// fit the block, so small frames don't need a buffer the size of the largest
+// possible block.
+//
+// with a `dest` buffer the block is decoded into that instead and `*data`
+// points to it, blocks bigger than `dest_size` are an error.
+static block_status_t decode_block(FILE *in,
+                                   const frame_header_t *header,
+                                   unsigned index,
+                                   codec_ctx_t *ctx,
+                                   uint8_t **payload,
+                                   size_t *payload_size,
+                                   uint8_t *dest,
+                                   size_t dest_size,
+                                   uint8_t **data,
+                                   size_t *length)
+{
+	frame_block_t block;
+	codec_opts_t opts = { .level = 0, .ctx = ctx };
+	uint64_t start = trace_begin();
+
+	if (!frame_read_block_header(in, &block)) {
+		fprintf(stderr, "error: truncated block header (block %u)\n", index);
+		return BLOCK_ERROR;
+	}
+
+	if (block.usize == 0) {
+		return BLOCK_END;
+	}
+
+	if (block.usize > header->block_size
+	    || block.csize > max_payload_size(header))
+	{
+		fprintf(stderr, "error: bad block size (block %u)\n", index);
+		return BLOCK_ERROR;
+	}
+
+	if (dest && block.usize > dest_size) {
+		fprintf(stderr, "error: block %u runs past the content size\n", index);
+		return BLOCK_ERROR;
+	}
+
+	if (block.csize > *payload_size) {
+		*payload = realloc(*payload, block.csize);
+		*payload_size = block.csize;
+	}
+
+	if (fread(*payload, 1, block.csize, in) != block.csize) {
+		fprintf(stderr, "error: truncated block (block %u)\n", index);
+		return BLOCK_ERROR;
+	}
+
+	if (block.stored) {
+		if (block.csize != block.usize) {
+			fprintf(stderr, "error: bad stored block size (block %u)\n", index);
+			return BLOCK_ERROR;
+		}
+
+		*data = dest? dest : malloc(block.csize);
+		*length = block.csize;
+		memcpy(*data, *payload, block.csize);
+
+	} else if (dest) {
+		*data = dest;
+
+		if (!codec_chain_decode_buffer(header->chain, header->chain_length,
+		                               &opts, *payload, block.csize,
+		                               dest, block.usize, length))
+		{
+			fprintf(stderr, "error: couldn't decode block %u\n", index);
+			return BLOCK_ERROR;
+		}
+
+	} else if (!codec_chain_decode(header->chain, header->chain_length, &opts,
+	                               *payload, block.csize, data, length))
+	{
+		fprintf(stderr, "error: couldn't decode block %u\n", index);
+		return BLOCK_ERROR;
+	}
+
+	if (*length != block.usize || crc32c(0, *data, *length) != block.checksum) {
+		fprintf(stderr, "error: checksum mismatch (block %u)\n", index);
+
+		if (!dest) {
+			free(*data);
+		}
+
+		return BLOCK_ERROR;
+	}
+
+	trace_end("frame", "decompress block", start, block.usize);
+	return BLOCK_OK;
+}
+
+static bool check_content_size(const frame_header_t *header, uint64_t total) {
+	if ((header->flags & FRAME_FLAG_CONTENT_SIZE)
+	    && total != header->content_size)
+	{
+		fprintf(stderr, "error: frame decoded to %lu bytes, expected %lu\n",
+		        (unsigned long)total, (unsigned long)header->content_size);
+		return false;
+	}
+
+	return true;
+}
+
+// the blocks after a header that's already been read
+static bool decompress_blocks(FILE *in,
+                              FILE *out,
+                              const frame_header_t *header,
+                              codec_ctx_t *ctx)
+{
+	uint8_t *payload = NULL;
+	size_t payload_size = 0;
+	uint64_t total = 0;
+	bool ret = false;
+
+	for (unsigned index = 0;; index++) {
+		uint8_t *data = NULL;
+		size_t length = 0;
+
+		block_status_t status = decode_block(in, header, index, ctx,
+		                                     &payload, &payload_size,
+		                                     NULL, 0, &data, &length);
+
+		if (status != BLOCK_OK) {
+			ret = status == BLOCK_END && check_content_size(header, total);
+			break;
+		}
+
+		total += length;
+
+		bool written = fwrite(data, 1, length, out) == length;
+		free(data);
+
+		if (!written) {
+			fprintf(stderr, "error: couldn't write output\n");
+			break;
+		}
+	}
+
+	free(payload);
+	return ret;
+}
+
+bool frame_decompress(FILE *in, FILE *out, codec_ctx_t *ctx) {
+	frame_header_t header;
+
+	return frame_read_header(in, &header)
+	    && decompress_blocks(in, out, &header, ctx);
+}
+
+// the fallback for outputs that can't be mapped
+static bool decompress_buffered(FILE *in,
+                                int fd,
+                                const frame_header_t *header,
+                                codec_ctx_t *ctx)
+{
+	FILE *out = fdopen(dup(fd), "w");
+	bool ret = out && decompress_blocks(in, out, header, ctx);
+
+	if (out && fclose(out) != 0) {
+		fprintf(stderr, "error: couldn't write output\n");
+		ret = false;
+	}
+
+	return ret;
+}
+
+// returns a descriptor for `fd` that can be mapped for writing, or -1 if it
+// isn't a regular file at offset 0. shells open redirections write-only, so
+// those are opened again read-write.
+static int open_mappable(int fd) {
+	struct stat st;
+	int flags = fcntl(fd, F_GETFL);
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+	    || flags == -1 || (flags & O_APPEND)
+	    || lseek(fd, 0, SEEK_CUR) != 0)
+	{
+		return -1;
+	}
+
+	if ((flags & O_ACCMODE) == O_RDWR) {
+		return dup(fd);
+	}
+
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	return open(path, O_RDWR);
+}
+
+static bool decompress_mapped(FILE *in,
+                              int fd,
+                              const frame_header_t *header,
+                              codec_ctx_t *ctx)
+{
+	uint64_t size = header->content_size;
+
+	// blocks are reserved up front, running out of space while writing to
+	// the mapping would be a SIGBUS instead of an error
+	int err = (ftruncate(fd, size) != 0)? errno
+	        : size? posix_fallocate(fd, 0, size) : 0;
+
+	if (err && err != EOPNOTSUPP && err != EINVAL) {
+		fprintf(stderr, "error: couldn't size output to %lu bytes: %s\n",
+		        (unsigned long)size, strerror(err));
+		return false;
+	}
+
+	uint8_t *map = size? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                          fd, 0)
+	                   : NULL;
+
+	if (map == MAP_FAILED) {
+		return decompress_buffered(in, fd, header, ctx);
+	}
+
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	uint8_t *payload = NULL;
+	size_t payload_size = 0;
+	uint64_t total = 0;
+	bool ret = false;
+
+	for (unsigned index = 0;; index++) {
+		uint8_t *data = NULL;
+		size_t length = 0;
+
+		block_status_t status = decode_block(in, header, index, ctx,
+		                                     &payload, &payload_size,
+		                                     map + total, size - total,
+		                                     &data, &length);
+
+		if (status != BLOCK_OK) {
+			ret = status == BLOCK_END && check_content_size(header, total);
+			break;
+		}
+
+		total += length;
+	}
+
+	free(payload);
+
+	if (size) {
+		munmap(map, size);
+	}
+
+	return ret;
+}
+
+bool frame_decompress_fd(FILE *in, int fd, codec_ctx_t *ctx) {
+	frame_header_t header;
+
+	if (!frame_read_header(in, &header)) {
+		return false;
+	}
+
+	int mapfd = (header.flags & FRAME_FLAG_CONTENT_SIZE)? open_mappable(fd) : -1;
+
+	if (mapfd != -1) {
+		bool ret = decompress_mapped(in, mapfd, &header, ctx);
+		close(mapfd);
+		return ret;
+	}
+
+	return decompress_buffered(in, fd, &header, ctx);
+}
+
+bool frame_read_seek_table(FILE *in,
+                           frame_seek_entry_t **entries,
+                           size_t *count)
+{
+	uint8_t footer[FRAME_SEEK_FOOTER_SIZE];
+
+	if (fseeko(in, -FRAME_SEEK_FOOTER_SIZE, SEEK_END) != 0
+	    || fread(footer, 1, sizeof(footer), in) != sizeof(footer)
+	    || memcmp(footer + 8, FRAME_SEEK_MAGIC, 4) != 0)
+	{
+		fprintf(stderr, "error: missing seek table\n");
+		return false;
+	}
+
+	size_t n = load_le32(footer);
+	size_t size = n * FRAME_SEEK_ENTRY_SIZE;
+	uint8_t *raw = malloc(size? size : 1);
+
+	if (fseeko(in, -(off_t)(FRAME_SEEK_FOOTER_SIZE + size), SEEK_END) != 0
+	    || fread(raw, 1, size, in) != size
+	    || crc32c(0, raw, size) != load_le32(footer + 4))
+	{
+		fprintf(stderr, "error: corrupt seek table\n");
+		free(raw);
+		return false;
+	}
+
+	frame_seek_entry_t *ret = calloc(n? n : 1, sizeof(frame_seek_entry_t));
+	uint64_t uoffset = 0;
+	uint64_t coffset = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		ret[i].uoffset = uoffset;
+		ret[i].coffset = coffset;
+		ret[i].usize = load_le32(raw + i * FRAME_SEEK_ENTRY_SIZE);
+		ret[i].csize = load_le32(raw + i * FRAME_SEEK_ENTRY_SIZE + 4);
+
+		uoffset += ret[i].usize;
+		coffset += ret[i].csize;
+	}
+
+	free(raw);
+	*entries = ret;
+	*count = n;
+	return true;
+}
+
+// walks the block headers from the current position, for frames without a
+// seek table. payloads are skipped with fseek() rather than decoded.
+static bool scan_blocks(FILE *in,
+                        const frame_header_t *header,
+                        frame_seek_entry_t **entries,
+                        size_t *count)
+{
+	frame_seek_entry_t *ret = NULL;
+	size_t n = 0;
+	size_t space = 0;
+	uint64_t uoffset = 0;
+	uint64_t coffset = 0;
+
+	for (;;) {
+		frame_block_t block;
+
+		if (!frame_read_block_header(in, &block)) {
+			fprintf(stderr, "error: truncated block header (block %zu)\n", n);
+			free(ret);
+			return false;
+		}
+
+		if (block.usize == 0) {
+			break;
+		}
+
+		if (block.usize > header->block_size
+		    || block.csize > max_payload_size(header)
+		    || fseeko(in, block.csize, SEEK_CUR) != 0)
+		{
+			fprintf(stderr, "error: bad block size (block %zu)\n", n);
+			free(ret);
+			return false;
+		}
+
+		if (n == space) {
+			space = space? space * 2 : 64;
+			ret = realloc(ret, space * sizeof(frame_seek_entry_t));
+		}
+
+		ret[n++] = (frame_seek_entry_t){
+			.uoffset = uoffset,
+			.coffset = coffset,
+			.usize = block.usize,
+			.csize = FRAME_BLOCK_HEADER_SIZE + block.csize,
+		};
+
+		uoffset += block.usize;
+		coffset += FRAME_BLOCK_HEADER_SIZE + block.csize;
+	}
+
+	*entries = ret;
+	*count = n;
+	return true;
+}
+
+bool frame_decompress_range(FILE *in,
+                            FILE *out,
+                            uint64_t offset,
+                            uint64_t length)
+{
+	frame_header_t header;
+	frame_seek_entry_t *entries = NULL;
+	size_t count = 0;
+
+	if (!frame_read_header(in, &header)) {
+		return false;
+	}
+
+	off_t start = ftello(in);
+	bool found = (header.flags & FRAME_FLAG_SEEK_TABLE)
+		? frame_read_seek_table(in, &entries, &count)
+		: scan_blocks(in, &header, &entries, &count);
+
+	if (!found) {
+		return false;
+	}
+
+	// binary search for the first block that ends past `offset`
+	size_t lo = 0;
+	size_t hi = count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (entries[mid].uoffset + entries[mid].usize <= offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	uint8_t *payload = NULL;
+	size_t payload_size = 0;
+	uint64_t end = (length > UINT64_MAX - offset)? UINT64_MAX : offset + length;
+	bool ret = true;
+
+	for (size_t i = lo; i < count && entries[i].uoffset < end; i++) {
+		uint8_t *data = NULL;
+		size_t datalen = 0;
+
+		if (fseeko(in, start + entries[i].coffset, SEEK_SET) != 0
+		    || decode_block(in, &header, i, NULL, &payload, &payload_size,
+		                    NULL, 0, &data, &datalen) != BLOCK_OK)
+		{
+			ret = false;
+			break;
+		}
+
+		// clip the decoded block to the requested range
+		uint64_t base = entries[i].uoffset;
+		uint64_t from = (offset > base)? offset - base : 0;
+		uint64_t to = (end - base < datalen)? end - base : datalen;
+
+		bool written = fwrite(data + from, 1, to - from, out) == to - from;
+		free(data);
+
+		if (!written) {
+			fprintf(stderr, "error: couldn't write output\n");
+			ret = false;
+			break;
+		}
+	}
+
+	free(payload);
+	free(entries);
+	return ret;
+}
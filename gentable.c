@@ -6,11 +6,6 @@
 
 #include <hz/gentable.h>
 
-typedef struct {
-	uint8_t  symbol;
-	uint64_t frequency;
-} huff_symbol_t;
-
 uint64_t count_file(FILE *fp, unsigned symbits, huff_symbol_t *symtab) {
 	uint64_t ret = 0;
 
@@ -95,8 +90,11 @@ void write_packed_symtab(FILE *fp, huff_symbol_table_t *table) {
 	fwrite(&table->length, 1, 2, fp);
 
 	for (unsigned i = 0; i < table->length; i++) {
-		fwrite(&table->symbols[i].symbol, 1, 1, fp);
-		fwrite(&table->symbols[i].weight, 1, 1, fp);
+		uint8_t symbol = table->symbols[i].symbol;
+		uint8_t weight = table->symbols[i].weight;
+
+		fwrite(&symbol, 1, 1, fp);
+		fwrite(&weight, 1, 1, fp);
 	}
 }
 
@@ -104,20 +102,36 @@ huff_symbol_table_t *read_packed_symtab(FILE *fp) {
 	// TODO: leaving this here in case symbol size is ever configurable
 	//       (will it ever be? seems kinda silly tbh)
 	unsigned symbols = 256;
+	uint16_t length = 0;
 
-	huff_symbol_table_t *ret = calloc(1, sizeof(huff_symbol_table_t));
-	ret->symbols = calloc(1, sizeof(huff_sym_table_ent_t[symbols]));
+	if (fread(&length, 1, 2, fp) != 2 || length > symbols) {
+		return NULL;
+	}
 
-	fread(&ret->length, 1, 2, fp);
+	// only as many entries as the table has, most inputs use far fewer
+	// than all 256 symbols
+	huff_symbol_table_t *ret = calloc(1, sizeof(huff_symbol_table_t));
+	ret->symbols = calloc(length? length : 1, sizeof(huff_sym_table_ent_t));
+	ret->length = length;
 
 	for (unsigned i = 0; i < ret->length; i++) {
-		fread(&ret->symbols[i].symbol, 1, 1, fp);
-		fread(&ret->symbols[i].weight, 1, 1, fp);
+		uint8_t symbol = 0;
+		uint8_t weight = 0;
+
+		fread(&symbol, 1, 1, fp);
+		fread(&weight, 1, 1, fp);
+		ret->symbols[i].symbol = symbol;
+		ret->symbols[i].weight = weight;
 	}
 
 	return ret;
 }
 
+void free_symtab(huff_symbol_table_t *table) {
+	free(table->symbols);
+	free(table);
+}
+
 int huff_frequency_compare(const void *a, const void *b) {
 	const huff_symbol_t *x = a;
 	const huff_symbol_t *y = b;
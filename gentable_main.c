@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hz/gentable.h>
+#include <hz/hufftree.h>
+#include <hz/huffstatic.h>
+
+// builds the code lengths for a built-in table (see hz/huffstatic.h) out of
+// the byte counts of a set of sample files, and prints them as a C array to
+// paste into huffstatic.c
+int main(int argc, char *argv[]) {
+	if (argc < 3) {
+		puts("Usage: gentable name samples...");
+		return EXIT_FAILURE;
+	}
+
+	// every byte starts with a count of one, so any input can be coded with
+	// the table even if the samples never had some of them
+	uint64_t counts[HUFF_STATIC_SYMBOLS];
+	uint64_t total = HUFF_STATIC_SYMBOLS;
+
+	for (unsigned i = 0; i < HUFF_STATIC_SYMBOLS; i++) {
+		counts[i] = 1;
+	}
+
+	for (int i = 2; i < argc; i++) {
+		FILE *fp = fopen(argv[i], "r");
+
+		if (!fp) {
+			fprintf(stderr, "error: couldn't open sample \"%s\"\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+
+		// counted the same way huffman counts its input
+		huff_symbol_t symtab[256];
+		memset(symtab, 0, sizeof(symtab));
+		total += count_file(fp, 256, symtab);
+
+		for (unsigned k = 0; k < 256; k++) {
+			counts[k] += symtab[k].frequency;
+		}
+
+		// one end of block per sample, roughly one per message
+		counts[HUFF_STATIC_SYMBOLS - 1]++;
+		fclose(fp);
+	}
+
+	uint32_t freqs[HUFF_STATIC_SYMBOLS];
+	uint8_t lengths[HUFF_STATIC_SYMBOLS];
+	unsigned shift = 0;
+
+	while ((total >> shift) >= UINT32_MAX) {
+		shift++;
+	}
+
+	for (unsigned i = 0; i < HUFF_STATIC_SYMBOLS; i++) {
+		uint64_t freq = counts[i] >> shift;
+		freqs[i] = freq? freq : 1;
+	}
+
+	huff_lengths_from_freqs(freqs, HUFF_STATIC_SYMBOLS, lengths, HUFF_MAX_CODE_BITS);
+
+	printf("// %s, %lu bytes from %d samples\n", argv[1],
+	       (unsigned long)(total - HUFF_STATIC_SYMBOLS), argc - 2);
+	printf("static const uint8_t %s_lengths[HUFF_STATIC_SYMBOLS] = {", argv[1]);
+
+	for (unsigned i = 0; i < HUFF_STATIC_SYMBOLS; i++) {
+		printf("%s%2u,", (i % 16)? " " : "\n\t", lengths[i]);
+	}
+
+	printf("\n};\n");
+	return 0;
+}
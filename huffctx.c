@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include <hz/bitstream.h>
+#include <hz/hufftree.h>
+#include <hz/huffman.h>
+#include <hz/huffctx.h>
+#include <hz/trace.h>
+
+// rough header bits for one compact table, a merge has to save more than
+// this to be worth it
+#define HUFFCTX_TABLE_BITS (2.0 * HUFFCTX_SYMBOLS)
+
+// rounds of reassigning contexts to the nearest cluster
+#define HUFFCTX_ROUNDS 4
+
+typedef struct histogram {
+	uint64_t counts[HUFFCTX_SYMBOLS];
+	uint64_t total;
+} histogram_t;
+
+static void histogram_add(histogram_t *to, const histogram_t *from) {
+	for (unsigned i = 0; i < HUFFCTX_SYMBOLS; i++) {
+		to->counts[i] += from->counts[i];
+	}
+
+	to->total += from->total;
+}
+
+// ideal coded size in bits, the entropy times the number of symbols
+static double histogram_cost(const histogram_t *h) {
+	double ret = 0;
+
+	for (unsigned i = 0; i < HUFFCTX_SYMBOLS; i++) {
+		if (h->counts[i]) {
+			ret += h->counts[i] * log2((double)h->total / h->counts[i]);
+		}
+	}
+
+	return ret;
+}
+
+// cost of coding `a` and `b` with one table instead of two
+static double merge_cost(const histogram_t *a, const histogram_t *b) {
+	histogram_t sum = *a;
+	histogram_add(&sum, b);
+
+	return histogram_cost(&sum) - histogram_cost(a) - histogram_cost(b);
+}
+
+// groups the contexts into at most HUFFCTX_MAX_CLUSTERS clusters, returns
+// the number of clusters and fills in each context's cluster in `map` and
+// the cluster statistics in `clusters`
+static unsigned cluster_contexts(const histogram_t *contexts,
+                                 uint8_t *map,
+                                 histogram_t *clusters)
+{
+	unsigned order[HUFFCTX_CONTEXTS];
+	unsigned used = 0;
+
+	for (unsigned i = 0; i < HUFFCTX_CONTEXTS; i++) {
+		map[i] = 0;
+
+		if (contexts[i].total) {
+			order[used++] = i;
+		}
+	}
+
+	if (used == 0) {
+		memset(clusters, 0, sizeof(histogram_t));
+		return 1;
+	}
+
+	// the busiest contexts seed the clusters
+	for (unsigned i = 1; i < used; i++) {
+		for (unsigned k = i; k > 0
+		     && contexts[order[k]].total > contexts[order[k - 1]].total; k--)
+		{
+			unsigned temp = order[k];
+			order[k] = order[k - 1];
+			order[k - 1] = temp;
+		}
+	}
+
+	unsigned count = (used < HUFFCTX_MAX_CLUSTERS)? used : HUFFCTX_MAX_CLUSTERS;
+
+	for (unsigned i = 0; i < count; i++) {
+		clusters[i] = contexts[order[i]];
+	}
+
+	for (unsigned round = 0; round < HUFFCTX_ROUNDS; round++) {
+		histogram_t next[HUFFCTX_MAX_CLUSTERS];
+		memset(next, 0, sizeof(next));
+
+		for (unsigned i = 0; i < used; i++) {
+			const histogram_t *ctx = contexts + order[i];
+			unsigned best = 0;
+			double best_cost = INFINITY;
+
+			for (unsigned k = 0; k < count; k++) {
+				// what adding the context to the cluster costs
+				histogram_t sum = clusters[k];
+				histogram_add(&sum, ctx);
+				double cost = histogram_cost(&sum) - histogram_cost(clusters + k);
+
+				if (cost < best_cost) {
+					best = k;
+					best_cost = cost;
+				}
+			}
+
+			map[order[i]] = best;
+			histogram_add(next + best, ctx);
+		}
+
+		// drop clusters nothing was assigned to
+		unsigned remap[HUFFCTX_MAX_CLUSTERS];
+		unsigned kept = 0;
+
+		for (unsigned k = 0; k < count; k++) {
+			remap[k] = kept;
+
+			if (next[k].total) {
+				clusters[kept++] = next[k];
+			}
+		}
+
+		for (unsigned i = 0; i < used; i++) {
+			map[order[i]] = remap[map[order[i]]];
+		}
+
+		count = kept;
+	}
+
+	// merge clusters while that saves more than the extra table costs
+	while (count > 1) {
+		unsigned a = 0, b = 0;
+		double best = INFINITY;
+
+		for (unsigned i = 0; i < count; i++) {
+			for (unsigned k = i + 1; k < count; k++) {
+				double cost = merge_cost(clusters + i, clusters + k);
+
+				if (cost < best) {
+					a = i, b = k, best = cost;
+				}
+			}
+		}
+
+		if (best >= HUFFCTX_TABLE_BITS) {
+			break;
+		}
+
+		histogram_add(clusters + a, clusters + b);
+		clusters[b] = clusters[--count];
+
+		for (unsigned i = 0; i < HUFFCTX_CONTEXTS; i++) {
+			map[i] = (map[i] == b)? a : (map[i] == count)? b : map[i];
+		}
+	}
+
+	return count;
+}
+
+static void histogram_lengths(const histogram_t *h, uint8_t *lengths) {
+	uint32_t freqs[HUFFCTX_SYMBOLS];
+	unsigned shift = 0;
+
+	// the length code takes 32 bit frequencies
+	while ((h->total >> shift) > UINT32_MAX) {
+		shift++;
+	}
+
+	for (unsigned i = 0; i < HUFFCTX_SYMBOLS; i++) {
+		uint64_t freq = h->counts[i] >> shift;
+		freqs[i] = (h->counts[i] && !freq)? 1 : freq;
+	}
+
+	huff_lengths_from_freqs(freqs, HUFFCTX_SYMBOLS, lengths, HUFF_MAX_CODE_BITS);
+}
+
+static void write_le64(FILE *out, uint64_t x) {
+	for (unsigned i = 0; i < 8; i++) {
+		fputc((x >> (8 * i)) & 0xff, out);
+	}
+}
+
+static bool read_le64(FILE *fp, uint64_t *x) {
+	uint8_t buf[8];
+
+	if (fread(buf, 1, 8, fp) != 8) {
+		return false;
+	}
+
+	*x = 0;
+	for (unsigned i = 0; i < 8; i++) {
+		*x |= (uint64_t)buf[i] << (8 * i);
+	}
+
+	return true;
+}
+
+// pairs of 4 bit values, low nibble first
+static void write_nibbles(FILE *out, const uint8_t *values, unsigned count) {
+	for (unsigned i = 0; i < count; i += 2) {
+		fputc(values[i] | (values[i + 1] << 4), out);
+	}
+}
+
+static bool read_nibbles(FILE *fp, uint8_t *values, unsigned count) {
+	for (unsigned i = 0; i < count; i += 2) {
+		int c = fgetc(fp);
+
+		if (c == EOF) {
+			return false;
+		}
+
+		values[i] = c & 0xf;
+		values[i + 1] = c >> 4;
+	}
+
+	return true;
+}
+
+bool huffctx_encode(FILE *fp, FILE *out) {
+	histogram_t *contexts = calloc(HUFFCTX_CONTEXTS, sizeof(histogram_t));
+	histogram_t clusters[HUFFCTX_MAX_CLUSTERS];
+	uint8_t map[HUFFCTX_CONTEXTS];
+	uint64_t length = 0;
+
+	uint64_t start = trace_begin();
+	rewind(fp);
+
+	uint64_t order0[HUFFCTX_SYMBOLS] = {0};
+
+	for (int c, prev = 0; (c = fgetc(fp)) != EOF; prev = c) {
+		contexts[prev].counts[c]++;
+		contexts[prev].total++;
+		order0[c]++;
+		length++;
+	}
+
+	trace_end("huffctx", "histogram", start, length);
+
+	start = trace_begin();
+	unsigned count = cluster_contexts(contexts, map, clusters);
+	uint8_t lengths[HUFFCTX_MAX_CLUSTERS][HUFFCTX_SYMBOLS];
+	uint64_t bits = 0;
+
+	for (unsigned k = 0; k < count; k++) {
+		histogram_lengths(clusters + k, lengths[k]);
+
+		for (unsigned i = 0; i < HUFFCTX_SYMBOLS; i++) {
+			bits += clusters[k].counts[i] * lengths[k][i];
+		}
+	}
+
+	free(contexts);
+	rewind(fp);
+	trace_end("huffctx", "tables", start, 0);
+
+	uint64_t header = 8 + 1 + ((count > 1)? HUFFCTX_CONTEXTS / 2 : 0);
+
+	for (unsigned k = 0; k < count; k++) {
+		bits += huff_lengths_bits(lengths[k], HUFFCTX_SYMBOLS);
+	}
+
+	// contexts don't always pay for their tables, the plain order-0 coder
+	// is used when it does at least as well. that includes storing input
+	// that doesn't shrink.
+	if (huffman_encoded_size(order0, length) <= 4 + header + (bits + 7) / 8) {
+		return huffman_encode(fp, out);
+	}
+
+	fprintf(out, HUFF_CONTEXT_SIGNATURE);
+	write_le64(out, length);
+	fputc(count, out);
+
+	if (count > 1) {
+		write_nibbles(out, map, HUFFCTX_CONTEXTS);
+	}
+
+	huff_code_t codes[HUFFCTX_MAX_CLUSTERS][HUFFCTX_SYMBOLS];
+	bit_stream_t stream;
+	bit_stream_init_write(&stream, out);
+
+	for (unsigned k = 0; k < count; k++) {
+		huff_write_lengths(&stream, lengths[k], HUFFCTX_SYMBOLS);
+		huff_canonical_codes(lengths[k], HUFFCTX_SYMBOLS, codes[k]);
+	}
+
+	start = trace_begin();
+
+	for (int c, prev = 0; (c = fgetc(fp)) != EOF; prev = c) {
+		huff_code_t *code = codes[map[prev]] + c;
+		bit_stream_write_bits(&stream, code->length, code->code);
+	}
+
+	bit_stream_flush(&stream);
+	trace_end("huffctx", "encode", start, length);
+	return true;
+}
+
+bool huffctx_decode(FILE *fp, FILE *out) {
+	uint64_t length = 0;
+	uint8_t map[HUFFCTX_CONTEXTS];
+	uint8_t lengths[HUFFCTX_SYMBOLS];
+	int count = 0;
+
+	memset(map, 0, sizeof(map));
+
+	if (!read_le64(fp, &length)
+	    || (count = fgetc(fp)) == EOF
+	    || count < 1 || count > HUFFCTX_MAX_CLUSTERS
+	    || (count > 1 && !read_nibbles(fp, map, HUFFCTX_CONTEXTS)))
+	{
+		fprintf(stderr, "error: bad context table header\n");
+		return false;
+	}
+
+	huff_decode_ent_t *tables = malloc(sizeof(huff_decode_ent_t[count]
+	                                         [1 << HUFF_MAX_CODE_BITS]));
+	bit_stream_t stream;
+	memset(&stream, 0, sizeof(stream));
+	stream.fp = fp;
+
+	for (int k = 0; k < count; k++) {
+		if (!huff_read_lengths(&stream, lengths, HUFFCTX_SYMBOLS)) {
+			fprintf(stderr, "error: bad code length table\n");
+			free(tables);
+			return false;
+		}
+
+		huff_build_decode_table(lengths, HUFFCTX_SYMBOLS,
+		                        tables + ((size_t)k << HUFF_MAX_CODE_BITS));
+	}
+
+	for (unsigned i = 0; i < HUFFCTX_CONTEXTS; i++) {
+		map[i] = (map[i] < count)? map[i] : 0;
+	}
+
+	bool ret = true;
+	uint8_t prev = 0;
+	uint64_t start = trace_begin();
+
+	for (uint64_t i = 0; i < length; i++) {
+		huff_decode_ent_t *table = tables + ((size_t)map[prev] << HUFF_MAX_CODE_BITS);
+		huff_decode_ent_t *ent = table + bit_stream_peek_bits(&stream,
+		                                                      HUFF_MAX_CODE_BITS);
+
+		if (!ent->length || stream.offset + ent->length > stream.available) {
+			fprintf(stderr, "error: corrupt data at byte %lu\n", (unsigned long)i);
+			ret = false;
+			break;
+		}
+
+		bit_stream_skip_bits(&stream, ent->length);
+		prev = ent->symbol;
+		putc(prev, out);
+	}
+
+	trace_end("huffctx", "decode", start, length);
+	free(tables);
+	return ret;
+}
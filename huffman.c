@@ -8,269 +8,786 @@
 
 #include <hz/gentable.h>
 #include <hz/bitstream.h>
-#include <hz/queue.h>
-
-#define END_OF_BLOCK 0xffff
-
-typedef struct huff_node huff_node_t;
-typedef struct huff_node {
-	uint16_t symbol;
-	unsigned weight;
-
-	huff_node_t *left;
-	huff_node_t *right;
-	huff_node_t *parent;
-} huff_node_t;
-
-typedef struct huff_tree {
-	//huff_table_sym_t *symbols;
-	const huff_symbol_table_t *symbols;
-	/* TODO: const */ huff_node_t *nodes;
-} huff_tree_t;
-
-huff_node_t *make_huffnode(uint16_t symbol,
-                           huff_node_t *left,
-                           huff_node_t *right,
-                           uint16_t weight)
+#include <hz/hufftree.h>
+#include <hz/huffman.h>
+#include <hz/huffctx.h>
+#include <hz/huffstatic.h>
+#include <hz/trace.h>
+
+bool huff_do_encode(huff_node_t *node,
+                    bit_stream_t *stream,
+                    uint16_t symbol,
+                    uint32_t path,
+                    uint32_t pathbits)
 {
-	huff_node_t *ret = calloc(1, sizeof(huff_node_t));
+	if (!node) {
+		return false;
+	}
 
-	ret->left = left;
-	ret->right = right;
-	ret->symbol = symbol;
-	ret->weight = weight;
+	if (is_leaf(node) && symbol == node->symbol) {
+		for (unsigned k = pathbits; k;) {
+			bool bit = !!(path & (1 << --k));
+			bit_stream_write(stream, bit);
+		}
 
-	if (ret->left)  ret->left->parent = ret;
-	if (ret->right) ret->right->parent = ret;
+		return true;
+	}
 
-	return ret;
+	bool right = huff_do_encode(node->right, stream, symbol,
+	                            (path << 1) | 1, pathbits + 1);
+	bool left = right || huff_do_encode(node->left, stream, symbol,
+	                                    (path << 1), pathbits + 1);
+
+	return left || right;
+}
+
+bool huff_do_decode(huff_node_t *node, bit_stream_t *stream, FILE *out) {
+	// a lone leaf at the root is the end of block node for empty input
+	if (!node || is_leaf(node)) {
+		return true;
+	}
+
+	for (bool found = false; !found;) {
+		bool dir = bit_stream_read(stream);
+
+		node = dir? node->right : node->left;
+
+		if (is_leaf(node)) {
+			if (node->symbol == END_OF_BLOCK)
+				return true;
+
+			fputc(node->symbol, out);
+			found = true;
+		}
+	}
+
+	return false;
 }
 
-int huff_node_compare(void *a, void *b){
-	huff_node_t *x = a;
-	huff_node_t *y = b;
+// path to each leaf, bit-reversed so bit_stream_write_bits() puts the root
+// bit first. symbols missing from the tree have a length of 0.
+typedef struct huff_path {
+	uint32_t bits;
+	uint8_t length;
+} huff_path_t;
+
+#define HUFF_PATHS 257
 
-	return (int)x->weight - (int)y->weight;
+static inline unsigned huff_path_index(uint16_t symbol) {
+	return (symbol == END_OF_BLOCK)? HUFF_PATHS - 1 : symbol;
 }
 
-void dump_hufftree(huff_node_t *node, unsigned indent) {
-	if (node) {
-		dump_hufftree(node->left, indent + 1);
+static void huff_tree_paths(huff_node_t *node, huff_path_t *paths,
+                            uint32_t bits, unsigned depth)
+{
+	if (!node) {
+		return;
+	}
 
-		for (unsigned i = 0; i < indent; i++) putchar(' ');
-		printf("- %x (%c) (%u)\n", node->symbol, node->symbol, node->weight);
+	if (is_leaf(node)) {
+		paths[huff_path_index(node->symbol)] = (huff_path_t) {
+			.bits = bits,
+			.length = depth,
+		};
 
-		dump_hufftree(node->right, indent + 1);
+		return;
 	}
+
+	huff_tree_paths(node->right, paths, bits | (1u << depth), depth + 1);
+	huff_tree_paths(node->left, paths, bits, depth + 1);
 }
 
-/*
-huff_symbol_table_t *load_symbol_file(const char *symfile) {
-	huff_symbol_table_t *ret = NULL;
+// same bits as huff_do_encode(), but the tree is only searched once
+void huff_encode(huff_tree_t *tree, FILE *fp, FILE *out) {
+	huff_path_t paths[HUFF_PATHS] = {0};
+	uint8_t buf[0x1000];
+	bit_stream_t stream;
+
+	bit_stream_init_write(&stream, out);
+	huff_tree_paths(tree->nodes, paths, 0, 0);
 
-	FILE *fp = fopen(symfile, "r");
+	for (size_t n; (n = fread(buf, 1, sizeof(buf), fp)) > 0;) {
+		for (size_t i = 0; i < n; i++) {
+			huff_path_t *path = paths + buf[i];
 
-	if (!fp) {
-		fprintf(stderr, "couldn't open symbol file \"%s\"\n", symfile);
-		return ret;
+			if (path->length == 0) {
+				fprintf(stderr, "error: can't encode %02x, no symbol!\n", buf[i]);
+				continue;
+			}
+
+			bit_stream_write_bits(&stream, path->length, path->bits);
+		}
 	}
 
-	ret = calloc(1, sizeof(huff_symbol_table_t));
-	fseek(fp, 0L, SEEK_END);
-	size_t fsize = ftell(fp);
-	fseek(fp, 0L, SEEK_SET);
+	huff_path_t *end = paths + huff_path_index(END_OF_BLOCK);
+	bit_stream_write_bits(&stream, end->length, end->bits);
+	bit_stream_flush(&stream);
+}
 
-	ret->length = fsize / 2;
-	ret->symbols = calloc(1, sizeof(huff_sym_table_ent_t[ret->length]) + 1);
+void huff_decode(huff_tree_t *tree, FILE *fp, FILE *out) {
+	bit_stream_t stream;
+	memset(&stream, 0, sizeof(stream));
+	stream.fp = fp;
+	bool block_end = false;
 
-	fread(ret->symbols, fsize, 1, fp);
-	fclose(fp);
+	while (!block_end && !bit_stream_end(&stream)) {
+		block_end = huff_do_decode(tree->nodes, &stream, out);
+	}
+}
 
-	return ret;
+void write_signature(FILE *fp) {
+	fprintf(fp, HUFF_SIGNATURE);
 }
-*/
 
-//huff_tree_t *open_symfile(const char *symfile) {
-huff_tree_t *huff_tree_create(const huff_symbol_table_t *sym_table) {
-	//huff_symbol_table_t *sym_table = load_symbol_file(symfile);
+bool check_signature(FILE *fp, huff_mode_t *mode) {
+	char sig[5];
 
-	if (!sym_table) {
-		fprintf(stderr, "couldn't load symbols!\n");
+	if (!fgets(sig, 5, fp)) {
+		return false;
 	}
 
-	queue_t *input = queue_create();
-	queue_t *output = queue_create();
+	if (strcmp(sig, HUFF_SIGNATURE) == 0) {
+		*mode = HUFF_MODE_TREE;
+	} else if (strcmp(sig, HUFF_STORED_SIGNATURE) == 0) {
+		*mode = HUFF_MODE_STORED;
+	} else if (strcmp(sig, HUFF_CONTEXT_SIGNATURE) == 0) {
+		*mode = HUFF_MODE_CONTEXT;
+	} else if (strcmp(sig, HUFF_CANONICAL_SIGNATURE) == 0) {
+		*mode = HUFF_MODE_CANONICAL;
+	} else if (strcmp(sig, HUFF_STATIC_SIGNATURE) == 0) {
+		*mode = HUFF_MODE_STATIC;
+	} else {
+		return false;
+	}
 
-	// add a non-data node that signals the end of input
-	huff_node_t *node = make_huffnode(END_OF_BLOCK, NULL, NULL, 0);
-	queue_push_back(input, node);
+	return true;
+}
 
-	for (unsigned k = 0; k < sym_table->length; k++) {
-		huff_node_t *node = make_huffnode(sym_table->symbols[k].symbol,
-		                                  NULL, NULL,
-		                                  sym_table->symbols[k].weight);
+static void copy_stream(FILE *fp, FILE *out) {
+	uint8_t buf[0x1000];
 
-		queue_push_back(input, node);
+	for (size_t n; (n = fread(buf, 1, sizeof(buf), fp)) > 0;) {
+		fwrite(buf, 1, n, out);
 	}
+}
 
-	while (input->items + output->items > 1) {
-		huff_node_t *left = queue_pop_min(input, output, huff_node_compare);
-		huff_node_t *right = queue_pop_min(input, output, huff_node_compare);
+// code lengths for the byte values and the end of block symbol, the length
+// code takes 32 bit frequencies so big counts are scaled down
+static void huff_count_lengths(const uint64_t *counts, uint64_t total,
+                               uint8_t *lengths)
+{
+	uint32_t freqs[HUFF_PATHS];
+	unsigned shift = 0;
 
-		huff_node_t *foo = make_huffnode('?', left, right,
-		                                 left->weight + right->weight);
+	while ((total >> shift) >= UINT32_MAX) {
+		shift++;
+	}
 
-		queue_push_back(output, foo);
+	for (unsigned i = 0; i < HUFF_PATHS - 1; i++) {
+		uint64_t freq = counts[i] >> shift;
+		freqs[i] = (counts[i] && !freq)? 1 : freq;
 	}
 
-	huff_tree_t *blarg = calloc(1, sizeof(huff_tree_t));
+	freqs[huff_path_index(END_OF_BLOCK)] = 1;
+	huff_lengths_from_freqs(freqs, HUFF_PATHS, lengths, HUFF_MAX_CODE_BITS);
+}
+
+// bits the counted bytes and an end of block take with these code lengths
+static uint64_t huff_coded_bits(const uint64_t *counts, const uint8_t *lengths) {
+	uint64_t ret = lengths[huff_path_index(END_OF_BLOCK)];
 
-	blarg->symbols = sym_table;
-	blarg->nodes = queue_pop_min(input, output, huff_node_compare);
+	for (unsigned i = 0; i < HUFF_PATHS - 1; i++) {
+		ret += counts[i] * lengths[i];
+	}
 
-	return blarg;
+	return ret;
 }
 
-bool is_internal(huff_node_t *node) {
-	return node->left || node->right;
+// `fp` needs to be seekable, the input is read once to count the symbols
+// and then again to encode it
+// the table and code lengths give the exact size before encoding anything.
+// a built-in table that does as well as the input's own only costs its id.
+// returns the bits for the table and data, `*builtin` is left NULL when the
+// input's own table is better.
+static uint64_t huff_pick_table(const uint64_t *counts,
+                                const uint8_t *lengths,
+                                const huff_static_table_t **builtin,
+                                unsigned *builtin_id)
+{
+	uint64_t ret = huff_coded_bits(counts, lengths)
+	             + huff_lengths_bits(lengths, HUFF_PATHS);
+
+	*builtin = NULL;
+	*builtin_id = 0;
+
+	for (unsigned i = 0; i < HUFF_STATIC_TABLES; i++) {
+		const huff_static_table_t *table = huff_static_table(i);
+		uint64_t table_bits = 8 + huff_coded_bits(counts, table->lengths);
+
+		if (table_bits <= ret) {
+			ret = table_bits;
+			*builtin = table;
+			*builtin_id = i;
+		}
+	}
+
+	return ret;
 }
 
-bool is_leaf(huff_node_t *node) {
-	return !is_internal(node);
+uint64_t huffman_encoded_size(const uint64_t *counts, uint64_t length) {
+	uint8_t lengths[HUFF_PATHS];
+	const huff_static_table_t *builtin;
+	unsigned builtin_id;
+
+	huff_count_lengths(counts, length, lengths);
+
+	uint64_t bits = huff_pick_table(counts, lengths, &builtin, &builtin_id);
+	uint64_t ret = 4 + (bits + 7) / 8;
+
+	// same as huffman_encode(), streams that don't shrink are stored
+	return (ret >= length)? 4 + length : ret;
 }
 
-bool huff_do_encode(huff_node_t *node,
-                    bit_stream_t *stream,
-                    uint16_t symbol,
-                    uint32_t path,
-                    uint32_t pathbits)
+bool huffman_encode(FILE *fp, FILE *out) {
+	uint64_t counts[HUFF_PATHS - 1] = {0};
+	uint64_t length = 0;
+	uint8_t buf[0x1000];
+
+	uint64_t start = trace_begin();
+	rewind(fp);
+
+	for (size_t n; (n = fread(buf, 1, sizeof(buf), fp)) > 0; length += n) {
+		for (size_t i = 0; i < n; i++) {
+			counts[buf[i]]++;
+		}
+	}
+
+	trace_end("huffman", "histogram", start, length);
+
+	start = trace_begin();
+	uint8_t lengths[HUFF_PATHS];
+	huff_code_t own_codes[HUFF_PATHS];
+
+	huff_count_lengths(counts, length, lengths);
+	rewind(fp);
+
+	const huff_static_table_t *builtin;
+	unsigned builtin_id;
+	uint64_t bits = huff_pick_table(counts, lengths, &builtin, &builtin_id);
+
+	trace_end("huffman", "tables", start, 0);
+
+	// if that comes out bigger than the input it's stored instead
+	if (4 + (bits + 7) / 8 >= length) {
+		fprintf(out, HUFF_STORED_SIGNATURE);
+		copy_stream(fp, out);
+		return true;
+	}
+
+	const huff_code_t *codes = own_codes;
+	bit_stream_t stream;
+
+	if (builtin) {
+		fprintf(out, HUFF_STATIC_SIGNATURE);
+		fputc(builtin_id, out);
+		bit_stream_init_write(&stream, out);
+		codes = builtin->codes;
+
+	} else {
+		fprintf(out, HUFF_CANONICAL_SIGNATURE);
+		bit_stream_init_write(&stream, out);
+		huff_write_lengths(&stream, lengths, HUFF_PATHS);
+		huff_canonical_codes(lengths, HUFF_PATHS, own_codes);
+	}
+
+	start = trace_begin();
+
+	for (size_t n; (n = fread(buf, 1, sizeof(buf), fp)) > 0;) {
+		for (size_t i = 0; i < n; i++) {
+			const huff_code_t *code = codes + buf[i];
+			bit_stream_write_bits(&stream, code->length, code->code);
+		}
+	}
+
+	const huff_code_t *end = codes + huff_path_index(END_OF_BLOCK);
+	bit_stream_write_bits(&stream, end->length, end->code);
+	bit_stream_flush(&stream);
+	trace_end("huffman", "encode", start, length);
+	return true;
+}
+
+// decodes codes up to the end of block symbol
+static bool huff_decode_codes(bit_stream_t *stream,
+                              const huff_decode_ent_t *table,
+                              FILE *out)
 {
-	if (!node) {
+	bool ret = true;
+	uint64_t count = 0;
+	uint64_t start = trace_begin();
+
+	for (;; count++) {
+		const huff_decode_ent_t *ent = table + bit_stream_peek_bits(stream,
+		                                                            HUFF_MAX_CODE_BITS);
+
+		if (!ent->length || stream->offset + ent->length > stream->available) {
+			fprintf(stderr, "error: corrupt data at byte %lu\n", (unsigned long)count);
+			ret = false;
+			break;
+		}
+
+		bit_stream_skip_bits(stream, ent->length);
+
+		if (ent->symbol == huff_path_index(END_OF_BLOCK)) {
+			break;
+		}
+
+		putc(ent->symbol, out);
+	}
+
+	trace_end("huffman", "decode", start, count);
+	return ret;
+}
+
+// decodes what follows HUFF_STATIC_SIGNATURE
+static bool huff_decode_static(FILE *fp, FILE *out) {
+	int id = fgetc(fp);
+	const huff_static_table_t *table = (id == EOF)? NULL : huff_static_table(id);
+	bit_stream_t stream;
+
+	if (!table) {
+		fprintf(stderr, "error: no built-in table with id %d\n", id);
 		return false;
 	}
 
-	if (is_leaf(node) && symbol == node->symbol) {
-		for (unsigned k = pathbits; k;) {
-			bool bit = !!(path & (1 << --k));
-			bit_stream_write(stream, bit);
-		}
+	memset(&stream, 0, sizeof(stream));
+	stream.fp = fp;
+	return huff_decode_codes(&stream, table->decode, out);
+}
 
-		return true;
+// decodes what follows HUFF_CANONICAL_SIGNATURE
+static bool huff_decode_canonical(FILE *fp, FILE *out) {
+	uint8_t lengths[HUFF_PATHS];
+	bit_stream_t stream;
+
+	memset(&stream, 0, sizeof(stream));
+	stream.fp = fp;
+
+	if (!huff_read_lengths(&stream, lengths, HUFF_PATHS)) {
+		fprintf(stderr, "error: bad code length table\n");
+		return false;
 	}
 
-	bool right = huff_do_encode(node->right, stream, symbol,
-	                            (path << 1) | 1, pathbits + 1);
-	bool left = right || huff_do_encode(node->left, stream, symbol,
-	                                    (path << 1), pathbits + 1);
+	huff_decode_ent_t *table = malloc(sizeof(huff_decode_ent_t[1 << HUFF_MAX_CODE_BITS]));
+	huff_build_decode_table(lengths, HUFF_PATHS, table);
 
-	return left || right;
+	bool ret = huff_decode_codes(&stream, table, out);
+	free(table);
+	return ret;
 }
 
-bool huff_do_decode(huff_node_t *node, bit_stream_t *stream) {
-	if (!node) {
+bool huffman_decode(FILE *fp, FILE *out) {
+	huff_mode_t mode;
+
+	if (!check_signature(fp, &mode)) {
+		return false;
+	}
+
+	if (mode == HUFF_MODE_STORED) {
+		copy_stream(fp, out);
 		return true;
 	}
 
-	for (bool found = false; !found;) {
-		bool dir = bit_stream_read(stream);
+	if (mode == HUFF_MODE_CONTEXT) {
+		return huffctx_decode(fp, out);
+	}
 
-		node = dir? node->right : node->left;
+	if (mode == HUFF_MODE_CANONICAL) {
+		return huff_decode_canonical(fp, out);
+	}
 
-		if (is_leaf(node)) {
-			if (node->symbol == END_OF_BLOCK)
-				return true;
+	if (mode == HUFF_MODE_STATIC) {
+		return huff_decode_static(fp, out);
+	}
 
-			putchar(node->symbol);
-			found = true;
+	huff_symbol_table_t *symtab = read_packed_symtab(fp);
+
+	if (!symtab) {
+		fprintf(stderr, "error: bad symbol table\n");
+		return false;
+	}
+
+	uint64_t start = trace_begin();
+	huff_tree_t *hufftree = huff_tree_create(symtab);
+	trace_end("huffman", "tree", start, 0);
+
+	start = trace_begin();
+	huff_decode(hufftree, fp, out);
+	trace_end("huffman", "decode", start, 0);
+
+	huff_tree_free(hufftree);
+	free_symtab(symtab);
+	return true;
+}
+
+typedef enum huff_push_state {
+	HUFF_PUSH_SIGNATURE,
+	HUFF_PUSH_STORED,
+	// packed symbol table and tree walk of HUFF_SIGNATURE streams
+	HUFF_PUSH_SYMTAB,
+	HUFF_PUSH_TREE,
+	// compact code lengths of canonical streams, or the id of a static one
+	HUFF_PUSH_LENGTHS,
+	HUFF_PUSH_STATIC,
+	// codes up to the end of block, with `table`
+	HUFF_PUSH_CODES,
+	HUFF_PUSH_CONTEXT_HEADER,
+	HUFF_PUSH_CONTEXT_TABLES,
+	// `remaining` codes with the table for the context of `prev`
+	HUFF_PUSH_CONTEXT_CODES,
+	HUFF_PUSH_DONE,
+} huff_push_state_t;
+
+struct huff_push {
+	bit_stream_t in;
+	huff_push_state_t state;
+	const huff_decode_ent_t *table;
+	// decoding tables built from the stream's own code lengths, one per
+	// cluster for context streams
+	huff_decode_ent_t *own;
+	huff_symbol_table_t *symtab;
+	huff_tree_t *tree;
+	// how far into the current code the tree walk is
+	huff_node_t *node;
+	uint64_t remaining;
+	unsigned clusters;
+	unsigned loaded;
+	uint8_t prev;
+	uint8_t map[HUFFCTX_CONTEXTS];
+};
+
+huff_push_t *huff_push_create(void) {
+	return calloc(1, sizeof(huff_push_t));
+}
+
+void huff_push_reset(huff_push_t *dec) {
+	if (dec->tree) {
+		huff_tree_free(dec->tree);
+	}
+
+	if (dec->symtab) {
+		free_symtab(dec->symtab);
+	}
+
+	free(dec->own);
+	memset(dec, 0, sizeof(huff_push_t));
+}
+
+void huff_push_free(huff_push_t *dec) {
+	huff_push_reset(dec);
+	free(dec);
+}
+
+static bool huff_push_signature(huff_push_t *dec, bit_stream_t *in) {
+	static const struct {
+		const char *signature;
+		huff_push_state_t state;
+	} modes[] = {
+		{ HUFF_SIGNATURE,           HUFF_PUSH_SYMTAB },
+		{ HUFF_STORED_SIGNATURE,    HUFF_PUSH_STORED },
+		{ HUFF_CONTEXT_SIGNATURE,   HUFF_PUSH_CONTEXT_HEADER },
+		{ HUFF_CANONICAL_SIGNATURE, HUFF_PUSH_LENGTHS },
+		{ HUFF_STATIC_SIGNATURE,    HUFF_PUSH_STATIC },
+	};
+
+	char sig[4];
+
+	for (unsigned i = 0; i < sizeof(sig); i++) {
+		sig[i] = bit_stream_read_bits(in, 8);
+	}
+
+	for (unsigned i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		if (memcmp(sig, modes[i].signature, sizeof(sig)) == 0) {
+			dec->state = modes[i].state;
+			return true;
 		}
 	}
 
 	return false;
 }
 
-void huff_encode(huff_tree_t *tree, FILE *fp) {
-	bit_stream_t stream;
-	bit_stream_init_write(&stream, stdout);
-	/*
-	memset(&stream, 0, sizeof(stream));
-	stream.fp = stdout;
-	*/
+static bool huff_push_symtab(huff_push_t *dec, bit_stream_t *in) {
+	unsigned length = bit_stream_read_bits(in, 16);
+
+	if (length > 256) {
+		return false;
+	}
+
+	huff_symbol_table_t *symtab = calloc(1, sizeof(huff_symbol_table_t));
+	symtab->symbols = calloc(length? length : 1, sizeof(huff_sym_table_ent_t));
+	symtab->length = length;
+
+	for (unsigned i = 0; i < length; i++) {
+		symtab->symbols[i].symbol = bit_stream_read_bits(in, 8);
+		symtab->symbols[i].weight = bit_stream_read_bits(in, 8);
+	}
+
+	if (bit_stream_overrun(in)) {
+		free_symtab(symtab);
+		return true;
+	}
+
+	dec->symtab = symtab;
+	dec->tree = huff_tree_create(symtab);
+	dec->node = dec->tree->nodes;
+
+	// a lone leaf at the root is the end of block node for empty input
+	bool empty = !dec->node || is_leaf(dec->node);
+	dec->state = empty? HUFF_PUSH_DONE : HUFF_PUSH_TREE;
+	return true;
+}
+
+static push_status_t huff_push_tree(huff_push_t *dec, bit_stream_t *in,
+                                    uint8_t *out, size_t size, size_t *written)
+{
+	huff_node_t *node = dec->node;
+	push_status_t ret = PUSH_NEED_INPUT;
 
-	while (!feof(fp)) {
-		uint16_t sym = fgetc(fp) & 0xff;
-		if (feof(fp)) {
+	while (in->offset < in->available) {
+		if (*written == size) {
+			ret = PUSH_MORE_OUTPUT;
 			break;
 		}
 
-		if (!huff_do_encode(tree->nodes, &stream, sym, 0, 0)) {
-			fprintf(stderr, "error: can't encode %02x, no symbol!\n", sym);
+		node = bit_stream_read(in)? node->right : node->left;
+
+		if (is_leaf(node)) {
+			if (node->symbol == END_OF_BLOCK) {
+				dec->state = HUFF_PUSH_DONE;
+				ret = PUSH_DONE;
+				break;
+			}
+
+			out[(*written)++] = node->symbol;
+			node = dec->tree->nodes;
 		}
 	}
 
-	// XXX: why do we need two?
-	huff_do_encode(tree->nodes, &stream, END_OF_BLOCK, 0, 0);
-	huff_do_encode(tree->nodes, &stream, END_OF_BLOCK, 0, 0);
+	dec->node = node;
+	return ret;
 }
 
-void huff_decode(huff_tree_t *tree, FILE *fp) {
-	bit_stream_t stream;
-	memset(&stream, 0, sizeof(stream));
-	stream.fp = stdin;
-	bool block_end = false;
+// reads one table of code lengths into the decoding table `table`. false if
+// the table is bad, a table cut short by the end of the input fails just
+// the same, so that's only an error if there was enough input for any code
+static bool huff_push_lengths(bit_stream_t *in, unsigned symbols,
+                              huff_decode_ent_t *table)
+{
+	uint8_t lengths[HUFF_PATHS];
+	size_t save = in->offset;
 
-	while (!block_end && !feof(stream.fp)) {
-		block_end = huff_do_decode(tree->nodes, &stream);
+	if (huff_read_lengths(in, lengths, symbols) && !bit_stream_overrun(in)) {
+		huff_build_decode_table(lengths, symbols, table);
+		return true;
 	}
-}
 
-void write_signature(FILE *fp) {
-	fprintf(fp, "hzpk");
+	bool cut = in->offset + HUFF_MAX_CODE_BITS > in->available;
+	in->offset = save;
+	return cut;
 }
 
-bool check_signature(FILE *fp) {
-	char sig[5];
-	fgets(sig, 5, fp);
+static bool huff_push_context_header(huff_push_t *dec, bit_stream_t *in) {
+	uint64_t length = bit_stream_read_bits(in, 32);
+	length |= (uint64_t)bit_stream_read_bits(in, 32) << 32;
+	unsigned count = bit_stream_read_bits(in, 8);
 
-	return strcmp(sig, "hzpk") == 0;
+	if (count < 1 || count > HUFFCTX_MAX_CLUSTERS) {
+		return bit_stream_overrun(in);
+	}
+
+	memset(dec->map, 0, sizeof(dec->map));
+
+	for (unsigned i = 0; count > 1 && i < HUFFCTX_CONTEXTS; i++) {
+		unsigned cluster = bit_stream_read_bits(in, 4);
+		dec->map[i] = (cluster < count)? cluster : 0;
+	}
+
+	if (bit_stream_overrun(in)) {
+		return true;
+	}
+
+	dec->remaining = length;
+	dec->clusters = count;
+	dec->own = malloc(sizeof(huff_decode_ent_t[count][1 << HUFF_MAX_CODE_BITS]));
+	dec->state = HUFF_PUSH_CONTEXT_TABLES;
+	return true;
 }
 
-int main(int argc, char *argv[]) {
-	/*
-	const char *symfile = "symbols.bin";
-	huff_tree_t *hufftree = open_symfile(symfile);
-	*/
+// decodes codes with `table` until the output is full or the input runs
+// out, a code cut short by the end of the input looks like a bad one until
+// there's enough input to be sure
+static push_status_t huff_push_codes(huff_push_t *dec, bit_stream_t *in,
+                                     uint8_t *out, size_t size, size_t *written)
+{
+	const huff_decode_ent_t *table = dec->table;
+	bool context = dec->state == HUFF_PUSH_CONTEXT_CODES;
+	size_t o = *written;
+	push_status_t ret = PUSH_NEED_INPUT;
+
+	for (;;) {
+		if (context && dec->remaining == 0) {
+			dec->state = HUFF_PUSH_DONE;
+			ret = PUSH_DONE;
+			break;
+		}
 
-	/*
-	if (argc >= 2 && strcmp(argv[1], "-D") == 0) {
-		dump_hufftree(hufftree->nodes, 0);
+		if (o == size) {
+			ret = PUSH_MORE_OUTPUT;
+			break;
+		}
 
-		for (unsigned i = 0; i < hufftree->symbols->length; i++) {
-			putchar(hufftree->symbols->symbols[i].symbol);
+		if (context) {
+			table = dec->own + ((size_t)dec->map[dec->prev] << HUFF_MAX_CODE_BITS);
 		}
-		putchar('\n');
 
-	} else */
-	if (argc >= 3 && strcmp(argv[1], "-e") == 0) {
-		FILE *fp = fopen(argv[2], "r");
-		assert(fp != NULL); // TODO: proper errors and stuff
+		const huff_decode_ent_t *ent = table + bit_stream_peek_bits(in,
+		                                                            HUFF_MAX_CODE_BITS);
 
-		write_signature(stdout);
-		huff_symbol_table_t *symtab = generate_symtab(fp);
+		if (!ent->length || in->offset + ent->length > in->available) {
+			if (in->available - in->offset >= HUFF_MAX_CODE_BITS) {
+				ret = PUSH_ERROR;
+			}
 
-		assert(symtab != NULL);
-		write_packed_symtab(stdout, symtab);
+			break;
+		}
 
-		huff_tree_t *hufftree = huff_tree_create(symtab);
-		huff_encode(hufftree, fp);
+		bit_stream_skip_bits(in, ent->length);
 
-	} else if (argc >= 2 && strcmp(argv[1], "-d") == 0) {
-		assert(check_signature(stdin));
-		huff_symbol_table_t *symtab = read_packed_symtab(stdin);
-		huff_tree_t *hufftree = huff_tree_create(symtab);
+		if (context) {
+			dec->prev = ent->symbol;
+			dec->remaining--;
 
-		huff_decode(hufftree, stdin);
+		} else if (ent->symbol == huff_path_index(END_OF_BLOCK)) {
+			dec->state = HUFF_PUSH_DONE;
+			ret = PUSH_DONE;
+			break;
+		}
 
-	} else {
-		puts("?");
+		out[o++] = ent->symbol;
+	}
+
+	*written = o;
+	return ret;
+}
+
+static push_status_t huff_push_run(void *ptr, bit_stream_t *in,
+                                   uint8_t *out, size_t size, size_t *written)
+{
+	huff_push_t *dec = ptr;
+
+	for (;;) {
+		huff_push_state_t state = dec->state;
+		size_t save = in->offset;
+		bool ok = true;
+
+		switch (state) {
+			case HUFF_PUSH_SIGNATURE:
+				ok = huff_push_signature(dec, in) || bit_stream_overrun(in);
+				break;
+
+			case HUFF_PUSH_STORED: {
+				size_t n = bytepos(in->available) - bytepos(in->offset);
+				n = (n < size - *written)? n : size - *written;
+
+				memcpy(out + *written, in->fbuffer + bytepos(in->offset), n);
+				in->offset += 8 * n;
+				*written += n;
+
+				// stored streams run to the end of the input
+				return (*written == size)? PUSH_MORE_OUTPUT : PUSH_NEED_INPUT;
+			}
+
+			case HUFF_PUSH_SYMTAB:
+				ok = huff_push_symtab(dec, in);
+				break;
+
+			case HUFF_PUSH_TREE:
+				return huff_push_tree(dec, in, out, size, written);
+
+			case HUFF_PUSH_LENGTHS:
+				if (!dec->own) {
+					dec->own = malloc(sizeof(huff_decode_ent_t[1 << HUFF_MAX_CODE_BITS]));
+				}
+
+				ok = huff_push_lengths(in, HUFF_PATHS, dec->own);
+
+				if (in->offset != save) {
+					dec->table = dec->own;
+					dec->state = HUFF_PUSH_CODES;
+				}
+				break;
+
+			case HUFF_PUSH_STATIC: {
+				const huff_static_table_t *table =
+					huff_static_table(bit_stream_read_bits(in, 8));
+
+				ok = table || bit_stream_overrun(in);
+
+				if (table && !bit_stream_overrun(in)) {
+					dec->table = table->decode;
+					dec->state = HUFF_PUSH_CODES;
+				}
+				break;
+			}
+
+			case HUFF_PUSH_CONTEXT_HEADER:
+				ok = huff_push_context_header(dec, in);
+				break;
+
+			case HUFF_PUSH_CONTEXT_TABLES:
+				if (dec->loaded == dec->clusters) {
+					dec->state = HUFF_PUSH_CONTEXT_CODES;
+					break;
+				}
+
+				ok = huff_push_lengths(in, HUFFCTX_SYMBOLS, dec->own
+				                       + ((size_t)dec->loaded << HUFF_MAX_CODE_BITS));
+
+				if (in->offset != save) {
+					dec->loaded++;
+				}
+				break;
+
+			case HUFF_PUSH_CODES:
+			case HUFF_PUSH_CONTEXT_CODES:
+				return huff_push_codes(dec, in, out, size, written);
+
+			case HUFF_PUSH_DONE:
+				return PUSH_DONE;
+		}
+
+		if (!ok) {
+			return PUSH_ERROR;
+		}
+
+		if (bit_stream_overrun(in)) {
+			in->offset = save;
+			dec->state = state;
+		}
+
+		if (in->offset == save && dec->state == state) {
+			return PUSH_NEED_INPUT;
+		}
 	}
 }
+
+push_status_t huff_push_decode(huff_push_t *dec,
+                               const uint8_t *in,
+                               size_t length,
+                               size_t *used,
+                               uint8_t *out,
+                               size_t size,
+                               size_t *written)
+{
+	return push_decode(&dec->in, huff_push_run, dec, in, length, used,
+	                   out, size, written);
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <assert.h>
+
+#include <hz/huffman.h>
+#include <hz/huffctx.h>
+#include <hz/iostage.h>
+#include <hz/trace.h>
+
+int main(int argc, char *argv[]) {
+	/*
+	const char *symfile = "symbols.bin";
+	huff_tree_t *hufftree = open_symfile(symfile);
+	*/
+
+	/*
+	if (argc >= 2 && strcmp(argv[1], "-D") == 0) {
+		dump_hufftree(hufftree->nodes, 0);
+
+		for (unsigned i = 0; i < hufftree->symbols->length; i++) {
+			putchar(hufftree->symbols->symbols[i].symbol);
+		}
+		putchar('\n');
+
+	} else */
+	trace_init();
+
+	// -c codes each byte with a table picked by the byte before it
+	bool context = argc >= 3 && strcmp(argv[1], "-c") == 0;
+	bool encode = argc >= 3 && (context || strcmp(argv[1], "-e") == 0);
+	bool decode = argc >= 2 && strcmp(argv[1], "-d") == 0;
+
+	if (!encode && !decode) {
+		puts("?");
+		return 0;
+	}
+
+	// the encoder makes two passes over its input file, so only the output
+	// goes through a stage there
+	FILE *fp = encode? fopen(argv[2], "r") : iostage_open_reader(STDIN_FILENO);
+	FILE *out = iostage_open_writer(STDOUT_FILENO);
+	assert(fp != NULL); // TODO: proper errors and stuff
+
+	if (!out) {
+		fprintf(stderr, "error: couldn't start I/O threads\n");
+		return 1;
+	}
+
+	if (encode && !(context? huffctx_encode(fp, out) : huffman_encode(fp, out))) {
+		fprintf(stderr, "error: couldn't generate symbol table\n");
+		return 1;
+	}
+
+	if (decode && !huffman_decode(fp, out)) {
+		fprintf(stderr, "error: bad signature, not a huffman stream\n");
+		return 1;
+	}
+
+	fclose(fp);
+
+	if (fclose(out) != 0) {
+		fprintf(stderr, "error: couldn't write output\n");
+		return 1;
+	}
+
+	return 0;
+}
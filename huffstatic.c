@@ -0,0 +1,120 @@
+#include <stdint.h>
+
+#include <hz/hufftree.h>
+#include <hz/huffstatic.h>
+
+// made with `gentable name samples...` from these corpora, and never to be
+// regenerated since streams refer to them (see hz/huffstatic.h):
+//
+//   text   software licenses and READMEs
+//   json   npm package.json files and a few larger test data files
+//   log    dpkg, apt and npm debug logs
+//   rle    rle_encode() of ELF executables, and of the bwt codec's output
+//          for text, logs, json and C source
+
+// text, 206993 bytes from 49 samples
+static const uint8_t text_lengths[HUFF_STATIC_SYMBOLS] = {
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12,  6, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	 3, 12,  9, 10, 12, 12, 12, 10,  9,  9,  9, 12,  7,  7,  7,  8,
+	 9,  9, 10, 11, 11, 11, 11, 12, 12, 11,  9, 11, 12,  9, 11, 12,
+	12,  8, 10,  8,  9,  8,  9,  9, 10,  8, 12, 12,  8,  9,  9,  9,
+	 9, 12,  9,  8,  8,  9, 11, 10, 12,  9, 12, 11, 11, 11, 12, 10,
+	11,  4,  6,  5,  6,  4,  6,  6,  5,  4, 10,  8,  5,  6,  4,  4,
+	 6, 10,  4,  5,  4,  6,  7,  7,  9,  6, 12, 12, 11, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 11, 11, 11,
+	11,
+};
+
+// json, 1002843 bytes from 350 samples
+static const uint8_t json_lengths[HUFF_STATIC_SYMBOLS] = {
+	12, 12, 12, 12, 12, 12, 12, 12, 12,  8,  5, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	 3, 12,  3, 11, 12, 10, 11, 12, 11, 11, 10, 12,  5,  7,  6,  7,
+	 8,  8,  9,  9,  9, 10, 10, 10, 10, 11,  4, 12, 12, 11, 11, 12,
+	10, 11, 11, 11, 11, 11, 12, 12, 12, 11, 12, 12, 12, 11, 12, 12,
+	12, 12, 12, 10, 11, 12, 12, 12, 12, 12, 12, 10, 10, 10,  9,  6,
+	12,  5,  7,  6,  6,  4,  7,  7,  6,  5,  8,  8,  6,  6,  5,  5,
+	 6, 10,  5,  5,  4,  6,  7,  8,  8,  7, 11,  7, 11,  7, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 11, 11,
+	11,
+};
+
+// log, 734361 bytes from 11 samples
+static const uint8_t log_lengths[HUFF_STATIC_SYMBOLS] = {
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12,  6, 12, 12,  8, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	 4, 12, 12, 12, 12, 11, 12, 12,  8,  8, 12,  8,  9,  5,  5,  6,
+	 5,  4,  5,  6,  6,  6,  6,  7,  7,  8,  5, 12,  9, 12,  9, 12,
+	 9, 11, 12, 10,  9, 10, 12, 11, 12, 12, 12, 11, 12, 12, 12, 11,
+	10, 12, 11,  9, 11, 10, 12, 12, 12, 12, 12, 12, 12, 12, 10,  8,
+	12,  5,  6,  6,  5,  4,  7,  6,  7,  5,  9,  7,  5,  6,  5,  5,
+	 5, 11,  5,  5,  5,  5,  7,  9,  8,  7,  9, 12, 12, 12, 10, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+	12,
+};
+
+// rle, 2046848 bytes from 13 samples
+static const uint8_t rle_lengths[HUFF_STATIC_SYMBOLS] = {
+	 4,  6,  7,  6,  7,  7,  8,  5,  7,  9,  7,  9, 10,  9,  7,  6,
+	 8, 10, 10, 10, 10, 10, 10, 10,  8, 11, 11, 11, 10, 10, 11,  8,
+	 5, 10,  6, 10,  7,  8, 11, 10,  8,  8, 10,  9,  8,  6,  6,  8,
+	 6,  6,  6,  8,  7,  7,  8,  8,  8,  8,  6, 10,  9,  9, 10, 10,
+	 9,  7,  8,  9,  7,  8, 10,  9,  5,  8, 10, 10,  7,  9, 10, 10,
+	 9, 11, 10,  9,  9,  9, 10, 10, 10, 11, 11, 10,  9,  9, 10,  8,
+	10,  6,  7,  7,  6,  6,  7,  7,  7,  6, 10,  8,  6,  7,  6,  6,
+	 7, 10,  7,  6,  6,  7,  8,  9,  9,  9, 10, 10,  9, 10, 10, 10,
+	 8, 10, 11,  7,  7,  7, 10, 10, 10,  6, 11,  7, 10,  7, 10, 10,
+	 9, 11, 11, 11, 10, 11, 11, 11, 10, 11, 11, 11, 10, 11, 11, 11,
+	10, 11, 11, 11, 11, 11, 11, 11, 10, 11, 11, 11, 11, 11, 11, 11,
+	10, 11, 11, 11, 10, 11,  9, 11, 10, 10,  9, 10, 10, 10, 10, 10,
+	 7,  9,  9,  9,  9, 10,  9,  8, 10, 10, 10, 11, 11, 11, 11, 11,
+	 9, 10, 10, 10, 10, 11, 11, 11, 10, 10, 10, 10, 11, 11, 10, 10,
+	10, 10, 10, 11, 10, 10, 10, 10,  7,  8, 10,  9, 10, 10, 10,  9,
+	10, 10, 10, 10, 10, 10,  9,  9,  9, 10,  9,  9,  9,  9,  8,  5,
+	11,
+};
+
+static huff_static_table_t tables[HUFF_STATIC_TABLES] = {
+	[HUFF_STATIC_TEXT] = { .name = "text", .lengths = text_lengths },
+	[HUFF_STATIC_JSON] = { .name = "json", .lengths = json_lengths },
+	[HUFF_STATIC_LOG]  = { .name = "log",  .lengths = log_lengths },
+	[HUFF_STATIC_RLE]  = { .name = "rle",  .lengths = rle_lengths },
+};
+
+// the codes and decoding tables only depend on the lengths, so they're built
+// once per process instead of taking 16k of data each in the binary
+__attribute__((constructor))
+static void huff_static_init(void) {
+	for (unsigned i = 0; i < HUFF_STATIC_TABLES; i++) {
+		huff_canonical_codes(tables[i].lengths, HUFF_STATIC_SYMBOLS,
+		                     tables[i].codes);
+		huff_build_decode_table(tables[i].lengths, HUFF_STATIC_SYMBOLS,
+		                        tables[i].decode);
+	}
+}
+
+const huff_static_table_t *huff_static_table(unsigned id) {
+	return (id < HUFF_STATIC_TABLES)? tables + id : NULL;
+}
@@ -0,0 +1,505 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <hz/hufftree.h>
+
+huff_node_t *make_huffnode(uint16_t symbol,
+                           huff_node_t *left,
+                           huff_node_t *right,
+                           unsigned weight)
+{
+	huff_node_t *ret = calloc(1, sizeof(huff_node_t));
+
+	ret->left = left;
+	ret->right = right;
+	ret->symbol = symbol;
+	ret->weight = weight;
+
+	if (ret->left)  ret->left->parent = ret;
+	if (ret->right) ret->right->parent = ret;
+
+	return ret;
+}
+
+int huff_node_compare(void *a, void *b){
+	huff_node_t *x = a;
+	huff_node_t *y = b;
+
+	return (int)x->weight - (int)y->weight;
+}
+
+void dump_hufftree(huff_node_t *node, unsigned indent) {
+	if (node) {
+		dump_hufftree(node->left, indent + 1);
+
+		for (unsigned i = 0; i < indent; i++) putchar(' ');
+		printf("- %x (%c) (%u)\n", node->symbol, node->symbol, node->weight);
+
+		dump_hufftree(node->right, indent + 1);
+	}
+}
+
+/*
+huff_symbol_table_t *load_symbol_file(const char *symfile) {
+	huff_symbol_table_t *ret = NULL;
+
+	FILE *fp = fopen(symfile, "r");
+
+	if (!fp) {
+		fprintf(stderr, "couldn't open symbol file \"%s\"\n", symfile);
+		return ret;
+	}
+
+	ret = calloc(1, sizeof(huff_symbol_table_t));
+	fseek(fp, 0L, SEEK_END);
+	size_t fsize = ftell(fp);
+	fseek(fp, 0L, SEEK_SET);
+
+	ret->length = fsize / 2;
+	ret->symbols = calloc(1, sizeof(huff_sym_table_ent_t[ret->length]) + 1);
+
+	fread(ret->symbols, fsize, 1, fp);
+	fclose(fp);
+
+	return ret;
+}
+*/
+
+static void huff_node_init(huff_node_t *node,
+                           uint16_t symbol,
+                           huff_node_t *left,
+                           huff_node_t *right,
+                           unsigned weight)
+{
+	*node = (huff_node_t){
+		.symbol = symbol,
+		.weight = weight,
+		.left = left,
+		.right = right,
+	};
+
+	if (left)  left->parent = node;
+	if (right) right->parent = node;
+}
+
+// takes the lightest node from the front of either sorted array below
+static huff_node_t *huff_pop_min(huff_node_t **a, unsigned *a_front, unsigned a_end,
+                                 huff_node_t **b, unsigned *b_front, unsigned b_end)
+{
+	if (*a_front == a_end) return b[(*b_front)++];
+	if (*b_front == b_end) return a[(*a_front)++];
+
+	int diff = huff_node_compare(a[*a_front], b[*b_front]);
+
+	return (diff <= 0)? a[(*a_front)++] : b[(*b_front)++];
+}
+
+//huff_tree_t *open_symfile(const char *symfile) {
+huff_tree_t *huff_tree_create(const huff_symbol_table_t *sym_table) {
+	//huff_symbol_table_t *sym_table = load_symbol_file(symfile);
+
+	if (!sym_table) {
+		fprintf(stderr, "couldn't load symbols!\n");
+	}
+
+	// all the nodes come out of one allocation, a tree with n leaves has
+	// n - 1 internal nodes. the leaves are expected in order of weight, so
+	// two queues are enough to always merge the lightest nodes.
+	unsigned leaves = sym_table->length + 1;
+	huff_node_t *pool = malloc(sizeof(huff_node_t[2 * leaves - 1]));
+	huff_node_t *input[leaves];
+	huff_node_t *output[leaves];
+	unsigned in_front = 0, in_end = 0;
+	unsigned out_front = 0, out_end = 0;
+	unsigned used = 0;
+
+	// add a non-data node that signals the end of input
+	huff_node_init(pool + used, END_OF_BLOCK, NULL, NULL, 0);
+	input[in_end++] = pool + used++;
+
+	for (unsigned k = 0; k < sym_table->length; k++) {
+		huff_node_init(pool + used, sym_table->symbols[k].symbol,
+		               NULL, NULL, sym_table->symbols[k].weight);
+		input[in_end++] = pool + used++;
+	}
+
+	while ((in_end - in_front) + (out_end - out_front) > 1) {
+		huff_node_t *left = huff_pop_min(input, &in_front, in_end,
+		                                 output, &out_front, out_end);
+		huff_node_t *right = huff_pop_min(input, &in_front, in_end,
+		                                  output, &out_front, out_end);
+
+		huff_node_init(pool + used, '?', left, right,
+		               left->weight + right->weight);
+		output[out_end++] = pool + used++;
+	}
+
+	huff_tree_t *blarg = calloc(1, sizeof(huff_tree_t));
+
+	blarg->symbols = sym_table;
+	blarg->pool = pool;
+	blarg->nodes = huff_pop_min(input, &in_front, in_end,
+	                            output, &out_front, out_end);
+
+	return blarg;
+}
+
+void huff_tree_free(huff_tree_t *tree) {
+	free(tree->pool);
+	free(tree);
+}
+
+bool is_internal(huff_node_t *node) {
+	return node->left || node->right;
+}
+
+bool is_leaf(huff_node_t *node) {
+	return !is_internal(node);
+}
+
+static void huff_node_depths(huff_node_t *node,
+                             unsigned depth,
+                             uint8_t *lengths,
+                             unsigned symbols,
+                             unsigned *maxdepth)
+{
+	if (!node) {
+		return;
+	}
+
+	if (is_leaf(node)) {
+		// the end of block node is skipped here, callers that want one
+		// include it in their own alphabet
+		if (node->symbol < symbols) {
+			lengths[node->symbol] = depth;
+			*maxdepth = (depth > *maxdepth)? depth : *maxdepth;
+		}
+
+		return;
+	}
+
+	huff_node_depths(node->left,  depth + 1, lengths, symbols, maxdepth);
+	huff_node_depths(node->right, depth + 1, lengths, symbols, maxdepth);
+}
+
+static int huff_weight_compare(const void *a, const void *b) {
+	const huff_sym_table_ent_t *x = a;
+	const huff_sym_table_ent_t *y = b;
+
+	if (x->weight != y->weight) {
+		return (int)x->weight - (int)y->weight;
+	}
+
+	// qsort() isn't stable, break ties so the tree is deterministic
+	return (int)x->symbol - (int)y->symbol;
+}
+
+unsigned huff_lengths_from_freqs(const uint32_t *freqs,
+                                 unsigned symbols,
+                                 uint8_t *lengths,
+                                 unsigned maxbits)
+{
+	huff_sym_table_ent_t ents[symbols];
+	huff_symbol_table_t table = {
+		.length = 0,
+		.symbols = ents,
+	};
+
+	uint32_t max_freq = 0;
+	for (unsigned i = 0; i < symbols; i++) {
+		max_freq = (freqs[i] > max_freq)? freqs[i] : max_freq;
+	}
+
+	for (unsigned i = 0; i < symbols; i++) {
+		if (freqs[i]) {
+			unsigned weight = ((uint64_t)freqs[i] * 0xffff) / max_freq;
+
+			ents[table.length].symbol = i;
+			ents[table.length].weight = weight? weight : 1;
+			table.length++;
+		}
+	}
+
+	for (;;) {
+		unsigned maxlen = 0;
+
+		memset(lengths, 0, symbols);
+		qsort(ents, table.length, sizeof(huff_sym_table_ent_t),
+		      huff_weight_compare);
+
+		huff_tree_t *tree = huff_tree_create(&table);
+		huff_node_depths(tree->nodes, 0, lengths, symbols, &maxlen);
+		huff_tree_free(tree);
+
+		if (maxlen <= maxbits) {
+			return maxlen;
+		}
+
+		// codes are too long, flatten the weights and try again. this
+		// costs a little bit of ratio but keeps the decoding tables small
+		bool changed = false;
+		for (unsigned i = 0; i < table.length; i++) {
+			uint16_t weight = (ents[i].weight + 1) / 2;
+
+			changed |= weight != ents[i].weight;
+			ents[i].weight = weight;
+		}
+
+		if (!changed) {
+			// all weights are equal, can't do any better than this
+			return maxlen;
+		}
+	}
+}
+
+static inline uint16_t reverse_bits(uint16_t code, unsigned bits) {
+	uint16_t ret = 0;
+
+	for (unsigned i = 0; i < bits; i++) {
+		ret = (ret << 1) | ((code >> i) & 1);
+	}
+
+	return ret;
+}
+
+void huff_canonical_codes(const uint8_t *lengths,
+                          unsigned symbols,
+                          huff_code_t *codes)
+{
+	unsigned count[HUFF_MAX_CODE_BITS + 1];
+	unsigned next[HUFF_MAX_CODE_BITS + 1];
+	memset(count, 0, sizeof(count));
+
+	for (unsigned i = 0; i < symbols; i++) {
+		count[lengths[i]]++;
+	}
+
+	// same code assignment as deflate, shorter codes sort first and symbols
+	// of the same length are numbered consecutively
+	unsigned code = 0;
+	count[0] = 0;
+
+	for (unsigned bits = 1; bits <= HUFF_MAX_CODE_BITS; bits++) {
+		code = (code + count[bits - 1]) << 1;
+		next[bits] = code;
+	}
+
+	for (unsigned i = 0; i < symbols; i++) {
+		unsigned len = lengths[i];
+
+		codes[i].length = len;
+		codes[i].code = len? reverse_bits(next[len]++, len) : 0;
+	}
+}
+
+void huff_build_decode_table(const uint8_t *lengths,
+                             unsigned symbols,
+                             huff_decode_ent_t *table)
+{
+	huff_code_t codes[symbols];
+	huff_canonical_codes(lengths, symbols, codes);
+
+	memset(table, 0, sizeof(huff_decode_ent_t[1 << HUFF_MAX_CODE_BITS]));
+
+	for (unsigned i = 0; i < symbols; i++) {
+		if (!codes[i].length) {
+			continue;
+		}
+
+		// fill in every entry whose low bits match this code
+		for (unsigned k = codes[i].code;
+		     k < (1 << HUFF_MAX_CODE_BITS);
+		     k += 1 << codes[i].length)
+		{
+			table[k].symbol = i;
+			table[k].length = codes[i].length;
+		}
+	}
+}
+
+// longest code for the code length alphabet, so each one fits in 3 bits
+#define HUFF_CL_MAX_BITS 7
+
+// code length code lengths are sent in this order so the ones that are
+// usually 0 come last and can be left out
+static const uint8_t huff_cl_order[HUFF_CL_CODES] = {
+	HUFF_CL_ZEROS, HUFF_CL_ZEROS_LONG, HUFF_CL_REPEAT, 0,
+	8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 2, 1,
+};
+
+static const uint8_t huff_cl_extra_bits[HUFF_CL_CODES] = {
+	[HUFF_CL_REPEAT]     = 2,
+	[HUFF_CL_ZEROS]      = 3,
+	[HUFF_CL_ZEROS_LONG] = 7,
+};
+
+typedef struct huff_cl_token {
+	uint8_t symbol;
+	uint8_t extra;
+} huff_cl_token_t;
+
+// splits the lengths into code length symbols, there are never more of
+// them than lengths
+static unsigned huff_cl_tokens(const uint8_t *lengths,
+                               unsigned symbols,
+                               huff_cl_token_t *tokens)
+{
+	unsigned count = 0;
+
+	for (unsigned i = 0; i < symbols;) {
+		uint8_t length = lengths[i];
+		unsigned run = 1;
+
+		while (i + run < symbols && lengths[i + run] == length) {
+			run++;
+		}
+
+		i += run;
+
+		if (length == 0) {
+			while (run >= 11) {
+				unsigned n = (run < 138)? run : 138;
+				tokens[count++] = (huff_cl_token_t){ HUFF_CL_ZEROS_LONG, n - 11 };
+				run -= n;
+			}
+
+			if (run >= 3) {
+				tokens[count++] = (huff_cl_token_t){ HUFF_CL_ZEROS, run - 3 };
+				run = 0;
+			}
+
+		} else {
+			// a repeat needs the length sent once first
+			tokens[count++] = (huff_cl_token_t){ length, 0 };
+			run--;
+
+			while (run >= 3) {
+				unsigned n = (run < 6)? run : 6;
+				tokens[count++] = (huff_cl_token_t){ HUFF_CL_REPEAT, n - 3 };
+				run -= n;
+			}
+		}
+
+		for (; run > 0; run--) {
+			tokens[count++] = (huff_cl_token_t){ length, 0 };
+		}
+	}
+
+	return count;
+}
+
+// code lengths for the code length symbols, returns how many of them are
+// sent in the header
+static unsigned huff_cl_lengths(const huff_cl_token_t *tokens,
+                                unsigned count,
+                                uint8_t *cl_lengths)
+{
+	uint32_t freqs[HUFF_CL_CODES] = {0};
+
+	for (unsigned i = 0; i < count; i++) {
+		freqs[tokens[i].symbol]++;
+	}
+
+	huff_lengths_from_freqs(freqs, HUFF_CL_CODES, cl_lengths, HUFF_CL_MAX_BITS);
+
+	unsigned sent = HUFF_CL_CODES;
+
+	while (sent > 1 && cl_lengths[huff_cl_order[sent - 1]] == 0) {
+		sent--;
+	}
+
+	return sent;
+}
+
+size_t huff_lengths_bits(const uint8_t *lengths, unsigned symbols) {
+	huff_cl_token_t tokens[symbols];
+	uint8_t cl_lengths[HUFF_CL_CODES];
+	unsigned count = huff_cl_tokens(lengths, symbols, tokens);
+	unsigned sent = huff_cl_lengths(tokens, count, cl_lengths);
+	size_t ret = 4 + 3 * sent;
+
+	for (unsigned i = 0; i < count; i++) {
+		ret += cl_lengths[tokens[i].symbol] + huff_cl_extra_bits[tokens[i].symbol];
+	}
+
+	return ret;
+}
+
+void huff_write_lengths(bit_stream_t *out, const uint8_t *lengths, unsigned symbols) {
+	huff_cl_token_t tokens[symbols];
+	uint8_t cl_lengths[HUFF_CL_CODES];
+	huff_code_t cl_codes[HUFF_CL_CODES];
+	unsigned count = huff_cl_tokens(lengths, symbols, tokens);
+	unsigned sent = huff_cl_lengths(tokens, count, cl_lengths);
+
+	huff_canonical_codes(cl_lengths, HUFF_CL_CODES, cl_codes);
+	bit_stream_write_bits(out, 4, sent - 1);
+
+	for (unsigned i = 0; i < sent; i++) {
+		bit_stream_write_bits(out, 3, cl_lengths[huff_cl_order[i]]);
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		huff_code_t *code = cl_codes + tokens[i].symbol;
+
+		bit_stream_write_bits(out, code->length, code->code);
+		bit_stream_write_bits(out, huff_cl_extra_bits[tokens[i].symbol],
+		                      tokens[i].extra);
+	}
+}
+
+bool huff_read_lengths(bit_stream_t *in, uint8_t *lengths, unsigned symbols) {
+	huff_decode_ent_t table[1 << HUFF_MAX_CODE_BITS];
+	uint8_t cl_lengths[HUFF_CL_CODES] = {0};
+	unsigned sent = bit_stream_read_bits(in, 4) + 1;
+
+	for (unsigned i = 0; i < sent; i++) {
+		cl_lengths[huff_cl_order[i]] = bit_stream_read_bits(in, 3);
+	}
+
+	huff_build_decode_table(cl_lengths, HUFF_CL_CODES, table);
+
+	for (unsigned i = 0; i < symbols;) {
+		huff_decode_ent_t *ent = table + bit_stream_peek_bits(in, HUFF_MAX_CODE_BITS);
+
+		if (!ent->length || bit_stream_end(in)) {
+			return false;
+		}
+
+		bit_stream_skip_bits(in, ent->length);
+
+		unsigned symbol = ent->symbol;
+		unsigned extra = bit_stream_read_bits(in, huff_cl_extra_bits[symbol]);
+		unsigned run = 1;
+		uint8_t length = symbol;
+
+		if (symbol == HUFF_CL_REPEAT) {
+			if (i == 0) {
+				return false;
+			}
+
+			length = lengths[i - 1];
+			run = 3 + extra;
+
+		} else if (symbol == HUFF_CL_ZEROS) {
+			length = 0;
+			run = 3 + extra;
+
+		} else if (symbol == HUFF_CL_ZEROS_LONG) {
+			length = 0;
+			run = 11 + extra;
+		}
+
+		if (run > symbols - i) {
+			return false;
+		}
+
+		memset(lengths + i, length, run);
+		i += run;
+	}
+
+	return true;
+}
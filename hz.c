@@ -0,0 +1,488 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include <hz/frame.h>
+#include <hz/codec.h>
+#include <hz/iostage.h>
+#include <hz/batch.h>
+#include <hz/autotune.h>
+#include <hz/dedup.h>
+#include <hz/trace.h>
+
+#define DEFAULT_CHAIN "lzh"
+
+void print_help(void) {
+	puts("Usage: hz [-edhsT] [-c chain] [-l level] [-b block size]\n"
+	     "          [-a target] [-r offset,length] [-S store]\n"
+	     "       hz [-ed] [options] [-j threads] [-o dir] [-L list] files...\n"
+	     "\t-h: print this help\n"
+	     "\t-e: compress input from stdin, the default if no options are given\n"
+	     "\t-d: decompress input from stdin, verifying block checksums\n"
+	     "\t-c: comma separated codec chain applied to each block, from\n"
+	     "\t    rle, lzs, lzh, huffman, huffctx and bwt. defaults to \""
+	     DEFAULT_CHAIN "\".\n"
+	     "\t    \"bwt,rle,huffman\" block sorts like bzip2, usually the\n"
+	     "\t    best ratio for text. bwt splits each block into one part\n"
+	     "\t    per cpu, down to 256k, and sorts the parts in parallel.\n"
+	     "\t    arrays of numbers can go through a pre-filter first, the\n"
+	     "\t    suffix is the word size: delta, delta2, delta4, delta8,\n"
+	     "\t    xor4, xor8, shuffle2, shuffle4 and shuffle8.\n"
+	     "\t    e.g. \"shuffle4,lzs\"\n"
+	     "\t    \"dedup\" at the front of the chain replaces chunks that\n"
+	     "\t    are already in the chunk store (-S) with references, so\n"
+	     "\t    only new data is compressed. e.g. \"dedup,lzh\"\n"
+	     "\t-l: compression level passed to the codecs, from 1-9\n"
+	     "\t-a, --auto=target: pick the chain and level by compressing a few\n"
+	     "\t    samples of the input with each candidate. the target is a\n"
+	     "\t    speed in MB/s, for the best ratio at least that fast, or\n"
+	     "\t    \"x\" and a ratio, for the least cpu time reaching it, or\n"
+	     "\t    both as in \"50,x3\". overrides -c and -l, the level picked\n"
+	     "\t    is recorded in the frame header.\n"
+	     "\t-b: uncompressed block size in bytes, k and m suffixes are\n"
+	     "\t    accepted. defaults to 1m.\n"
+	     "\t-S, --store=dir: chunk store for the dedup codec, kept across\n"
+	     "\t    runs and created if it doesn't exist. frames using it need\n"
+	     "\t    the same store to decompress.\n"
+	     "\t-s: write a seek table at the end of the frame\n"
+	     "\t-r: only decompress `length` bytes starting at `offset`, only\n"
+	     "\t    blocks overlapping the range are decoded. stdin must be a\n"
+	     "\t    regular file for this.\n"
+	     "\t-j: number of threads for compressing or decompressing files\n"
+	     "\t    given as arguments, 0 for one per cpu. defaults to 1.\n"
+	     "\t    directories stand for the files directly inside them.\n"
+	     "\t-o: write output files here instead of next to each input\n"
+	     "\t-L: read more file names from a list, one per line, or from\n"
+	     "\t    stdin for \"-\"\n"
+	     "\t-T: print the time and bytes spent in each stage to stderr on\n"
+	     "\t    exit. HZ_TRACE=1 in the environment does the same, and\n"
+	     "\t    HZ_TRACE=path writes a chrome trace of every span instead.\n"
+	     "\n"
+	     "With file arguments each file is compressed to a copy with a \""
+	     BATCH_SUFFIX "\"\n"
+	     "suffix, or decompressed to a copy without it.");
+}
+
+static size_t parse_size(const char *str) {
+	char *end = NULL;
+	size_t ret = strtoull(str, &end, 10);
+
+	switch (*end) {
+		case 'k': case 'K': ret <<= 10; break;
+		case 'm': case 'M': ret <<= 20; break;
+		case 'g': case 'G': ret <<= 30; break;
+		default: break;
+	}
+
+	return ret;
+}
+
+static bool frame_compress_stream(FILE *in, FILE *out, const void *params) {
+	return frame_compress(in, out, params);
+}
+
+static bool frame_decompress_stream(FILE *in, FILE *out, const void *params) {
+	return frame_decompress(in, out, NULL);
+}
+
+static bool is_regular_file(int fd) {
+	struct stat st;
+
+	return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// regular file outputs are sized and mapped by frame_decompress_fd(), so
+// only the input goes through a stage
+static int run_mapped(void) {
+	FILE *in = iostage_open_reader(STDIN_FILENO);
+
+	if (!in) {
+		fprintf(stderr, "error: couldn't start I/O threads\n");
+		return EXIT_FAILURE;
+	}
+
+	bool ret = frame_decompress_fd(in, STDOUT_FILENO, NULL);
+	fclose(in);
+
+	return ret? 0 : EXIT_FAILURE;
+}
+
+// the rest of stdin's size when it's a regular file, so it can go in the
+// frame header
+static void stdin_content_size(frame_params_t *params) {
+	struct stat st;
+	off_t pos = lseek(STDIN_FILENO, 0, SEEK_CUR);
+
+	if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && pos >= 0) {
+		params->has_content_size = true;
+		params->content_size = (st.st_size > pos)? st.st_size - pos : 0;
+	}
+}
+
+typedef struct auto_params {
+	frame_params_t *frame;
+	const autotune_target_t *target;
+	// where stdin was before the reader stage started moving it
+	off_t offset;
+} auto_params_t;
+
+// the start of a stream that was read for sampling, followed by the rest
+typedef struct prefix_stream {
+	uint8_t *buf;
+	size_t length;
+	size_t pos;
+	FILE *rest;
+} prefix_stream_t;
+
+static ssize_t prefix_read(void *cookie, char *buf, size_t size) {
+	prefix_stream_t *stream = cookie;
+
+	if (stream->pos == stream->length) {
+		return fread(buf, 1, size, stream->rest);
+	}
+
+	size_t n = stream->length - stream->pos;
+	n = (n < size)? n : size;
+
+	memcpy(buf, stream->buf + stream->pos, n);
+	stream->pos += n;
+	return n;
+}
+
+// regular files are sampled all over with pread(), other inputs only at the
+// start, which is then replayed ahead of the rest
+static bool frame_compress_auto(FILE *in, FILE *out, const void *arg) {
+	const auto_params_t *params = arg;
+	frame_params_t *frame = params->frame;
+
+	if (frame->has_content_size) {
+		if (!autotune_fd(STDIN_FILENO, params->offset, frame->content_size,
+		                 frame, params->target))
+		{
+			fprintf(stderr, "error: couldn't sample input\n");
+			return false;
+		}
+
+		return frame_compress(in, out, frame);
+	}
+
+	prefix_stream_t prefix = {
+		.buf = malloc(AUTOTUNE_SAMPLES * AUTOTUNE_SAMPLE_SIZE),
+		.rest = in,
+	};
+
+	prefix.length = fread(prefix.buf, 1, AUTOTUNE_SAMPLES * AUTOTUNE_SAMPLE_SIZE, in);
+	autotune_buffer(prefix.buf, prefix.length, frame, params->target);
+
+	cookie_io_functions_t funcs = { .read = prefix_read };
+	FILE *fp = fopencookie(&prefix, "r", funcs);
+	bool ret = fp && frame_compress(fp, out, frame);
+
+	if (fp) fclose(fp);
+	free(prefix.buf);
+	return ret;
+}
+
+typedef struct path_list {
+	char **paths;
+	size_t count;
+	size_t space;
+} path_list_t;
+
+static void path_list_add(path_list_t *list, const char *path) {
+	if (list->count == list->space) {
+		list->space = list->space? list->space * 2 : 64;
+		list->paths = realloc(list->paths, list->space * sizeof(char *));
+	}
+
+	list->paths[list->count++] = strdup(path);
+}
+
+static bool has_suffix(const char *str, const char *suffix) {
+	size_t len = strlen(str);
+	size_t slen = strlen(suffix);
+
+	return len >= slen && strcmp(str + len - slen, suffix) == 0;
+}
+
+// directories are expanded to the regular files directly in them, leaving
+// out the ones that wouldn't be compressed or decompressed
+static bool path_list_expand(path_list_t *list, const char *path, bool encode) {
+	struct stat st;
+
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "error: couldn't stat \"%s\"\n", path);
+		return false;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		path_list_add(list, path);
+		return true;
+	}
+
+	DIR *dir = opendir(path);
+
+	if (!dir) {
+		fprintf(stderr, "error: couldn't open directory \"%s\"\n", path);
+		return false;
+	}
+
+	for (struct dirent *ent; (ent = readdir(dir));) {
+		char *full = NULL;
+
+		if (has_suffix(ent->d_name, BATCH_SUFFIX) == encode
+		    || asprintf(&full, "%s/%s", path, ent->d_name) < 0)
+		{
+			continue;
+		}
+
+		if (stat(full, &st) == 0 && S_ISREG(st.st_mode)) {
+			path_list_add(list, full);
+		}
+
+		free(full);
+	}
+
+	closedir(dir);
+	return true;
+}
+
+static bool path_list_read(path_list_t *list, const char *listpath, bool encode) {
+	FILE *fp = strcmp(listpath, "-")? fopen(listpath, "r") : stdin;
+	char *line = NULL;
+	size_t size = 0;
+	bool ret = true;
+
+	if (!fp) {
+		fprintf(stderr, "error: couldn't open list \"%s\"\n", listpath);
+		return false;
+	}
+
+	for (ssize_t n; (n = getline(&line, &size, fp)) > 0;) {
+		if (line[n - 1] == '\n') {
+			line[n - 1] = '\0';
+		}
+
+		if (line[0] != '\0') {
+			ret &= path_list_expand(list, line, encode);
+		}
+	}
+
+	if (fp != stdin) {
+		fclose(fp);
+	}
+
+	free(line);
+	return ret;
+}
+
+// runs `func` with stdin and stdout going through I/O stages
+static int run_staged(bool (*func)(FILE *, FILE *, const void *),
+                      const void *params)
+{
+	FILE *in = iostage_open_reader(STDIN_FILENO);
+	FILE *out = iostage_open_writer(STDOUT_FILENO);
+
+	if (!in || !out) {
+		fprintf(stderr, "error: couldn't start I/O threads\n");
+		return EXIT_FAILURE;
+	}
+
+	bool ret = func(in, out, params);
+	fclose(in);
+
+	if (fclose(out) != 0) {
+		fprintf(stderr, "error: couldn't write output\n");
+		ret = false;
+	}
+
+	return ret? 0 : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[]) {
+	bool do_encode = true;
+	bool do_range = false;
+	uint64_t range_offset = 0;
+	uint64_t range_length = 0;
+	const char *chain = DEFAULT_CHAIN;
+	const char *list_path = NULL;
+	autotune_target_t target;
+	bool autotune = false;
+
+	batch_params_t batch = {
+		.out_dir = NULL,
+		.threads = 1,
+	};
+
+	frame_params_t params = {
+		.block_size = FRAME_DEFAULT_BLOCK_SIZE,
+		.opts = { .level = 0 },
+		.seek_table = false,
+	};
+
+	trace_init();
+
+	static const struct option long_opts[] = {
+		{ "auto", required_argument, NULL, 'a' },
+		{ "store", required_argument, NULL, 'S' },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	for (int opt; (opt = getopt_long(argc, argv, "edhsTc:l:a:b:r:j:o:L:S:",
+	                                 long_opts, NULL)) != -1;)
+	{
+		switch (opt) {
+			case 'e':
+				do_encode = true;
+				break;
+
+			case 'd':
+				do_encode = false;
+				break;
+
+			case 'c':
+				chain = optarg;
+				break;
+
+			case 'l':
+				params.opts.level = atoi(optarg);
+				break;
+
+			case 'a':
+				if (!autotune_parse(optarg, &target)) {
+					fprintf(stderr, "error: bad --auto target \"%s\"\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+
+				autotune = true;
+				break;
+
+			case 'b':
+				params.block_size = parse_size(optarg);
+				break;
+
+			case 's':
+				params.seek_table = true;
+				break;
+
+			case 'S':
+				dedup_set_store(optarg);
+				break;
+
+			case 'r': {
+				char *comma = strchr(optarg, ',');
+
+				if (!comma) {
+					fprintf(stderr, "error: range should be offset,length\n");
+					exit(EXIT_FAILURE);
+				}
+
+				do_range = true;
+				range_offset = parse_size(optarg);
+				range_length = parse_size(comma + 1);
+				break;
+			}
+
+			case 'j':
+				batch.threads = atoi(optarg);
+				break;
+
+			case 'o':
+				batch.out_dir = optarg;
+				break;
+
+			case 'L':
+				list_path = optarg;
+				break;
+
+			case 'T':
+				trace_enable(NULL);
+				break;
+
+			case 'h':
+				print_help();
+				exit(0);
+				break;
+
+			default:
+				print_help();
+				exit(EXIT_FAILURE);
+				break;
+		}
+	}
+
+	path_list_t files = { .count = 0 };
+	bool batch_mode = optind < argc || list_path;
+
+	for (int i = optind; i < argc; i++) {
+		if (!path_list_expand(&files, argv[i], do_encode)) {
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (list_path && !path_list_read(&files, list_path, do_encode)) {
+		exit(EXIT_FAILURE);
+	}
+
+	batch.encode = do_encode;
+	batch.frame = &params;
+	batch.autotune = autotune? &target : NULL;
+
+	if (!do_encode && batch_mode) {
+		return batch_run(files.paths, files.count, &batch)? 0 : EXIT_FAILURE;
+	}
+
+	if (!do_encode && do_range) {
+		return frame_decompress_range(stdin, stdout, range_offset, range_length)
+			? 0 : EXIT_FAILURE;
+	}
+
+	if (!do_encode) {
+		return is_regular_file(STDOUT_FILENO)? run_mapped()
+		     : run_staged(frame_decompress_stream, NULL);
+	}
+
+	params.chain_length = codec_parse_chain(chain, params.chain,
+	                                        CODEC_MAX_CHAIN);
+
+	if (params.chain_length == 0) {
+		fprintf(stderr, "error: bad codec chain \"%s\"\n", chain);
+		exit(EXIT_FAILURE);
+	}
+
+	if (params.block_size == 0 || params.block_size > FRAME_MAX_BLOCK_SIZE) {
+		fprintf(stderr, "error: block size must be between 1 and %u\n",
+		        FRAME_MAX_BLOCK_SIZE);
+		exit(EXIT_FAILURE);
+	}
+
+	if (params.opts.level < 0 || params.opts.level > 9) {
+		fprintf(stderr, "error: level must be between 1 and 9\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (batch_mode) {
+		return batch_run(files.paths, files.count, &batch)? 0 : EXIT_FAILURE;
+	}
+
+	stdin_content_size(&params);
+
+	if (autotune) {
+		auto_params_t auto_params = {
+			.frame = &params,
+			.target = &target,
+			.offset = lseek(STDIN_FILENO, 0, SEEK_CUR),
+		};
+
+		return run_staged(frame_compress_auto, &auto_params);
+	}
+
+	return run_staged(frame_compress_stream, &params);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <hz/frame.h>
+
+// picks a codec chain and level for an input (`hz -a`). a few samples
+// spread over the input are compressed with each candidate chain, timing
+// each one, and the best fit for the target goes into the frame params. the
+// chain is in the frame header as always, and the level is recorded there
+// too (FRAME_FLAG_LEVEL).
+//
+// samples are AUTOTUNE_SAMPLE_SIZE bytes, so the ratio of codecs with more
+// context than that (big lzs windows, bwt blocks) comes out a little low.
+#define AUTOTUNE_SAMPLES     4
+#define AUTOTUNE_SAMPLE_SIZE (256 * 1024)
+
+typedef struct autotune_target {
+	// slowest acceptable compression speed in MB/s, 0 for no limit. the
+	// candidate with the best ratio at least this fast is picked, or the
+	// fastest one if none are.
+	double min_speed;
+	// smallest acceptable ratio, 0 for no limit. without a speed limit the
+	// candidate using the least cpu time to reach it is picked, or the one
+	// with the best ratio if none do.
+	double min_ratio;
+} autotune_target_t;
+
+// parses "speed", "xratio" or both as "speed,xratio", e.g. "50" for at
+// least 50 MB/s or "x3" for at least a 3:1 ratio
+bool autotune_parse(const char *str, autotune_target_t *target);
+
+// samples `length` bytes of `fd` starting at `offset` with pread(), without
+// moving the file offset
+bool autotune_fd(int fd, off_t offset, uint64_t length,
+                 frame_params_t *params, const autotune_target_t *target);
+// samples the start of a stream that's already been read into memory
+void autotune_buffer(const uint8_t *buf, size_t length,
+                     frame_params_t *params, const autotune_target_t *target);
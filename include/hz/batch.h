@@ -0,0 +1,32 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <hz/frame.h>
+#include <hz/autotune.h>
+
+// compresses or decompresses lots of files at once on a pool of worker
+// threads. each worker starts with an even share of the files and steals
+// half of the busiest worker's remaining files when it runs out, and keeps
+// one codec_ctx_t for all the files it handles.
+//
+// compressed files get a ".hz" suffix, decompressing strips it (or adds
+// ".out" if it isn't there). outputs go next to their inputs, or into
+// `out_dir` when it's set.
+#define BATCH_SUFFIX     ".hz"
+#define BATCH_OUT_SUFFIX ".out"
+
+typedef struct batch_params {
+	bool encode;
+	// only used for compressing
+	const frame_params_t *frame;
+	// picks the chain and level for each file, NULL to use frame's
+	const autotune_target_t *autotune;
+	// NULL to write outputs next to the inputs
+	const char *out_dir;
+	// 0 uses one thread per cpu the process can run on
+	unsigned threads;
+} batch_params_t;
+
+// errors are reported on stderr per file, returns false if any file failed
+bool batch_run(char *const *paths, size_t count, const batch_params_t *params);
@@ -2,11 +2,16 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 #define BITS(X) (sizeof(X) * 8)
 
+// streams without an `fp` are memory streams, read from `fbuffer` as it's
+// filled in by bit_stream_feed(). reads past the end of what's there give
+// zeros like they do at the end of a file, but `offset` keeps counting so
+// the reader can tell it ran out (see bit_stream_overrun()) and try again
+// from an earlier offset once there's more input.
 typedef struct bit_stream {
-	// TODO: implement memory streams
 	// TODO: have flag for write/read mode
 	FILE *fp;
 	size_t available;
@@ -43,7 +48,14 @@ static inline void bit_stream_init_write(bit_stream_t *stream, FILE *fp) {
 
 static inline void bit_stream_do_write(bit_stream_t *stream) {
 	if (stream->offset > 0) {
-		fwrite(stream->fbuffer, 1, bytepos(stream->offset), stream->fp);
+		// clear whatever an earlier use of the buffer left past the last
+		// bit, so the padding is always zero
+		if (bitpos(stream->offset)) {
+			stream->fbuffer[bytepos(stream->offset)] &= (1 << bitpos(stream->offset)) - 1;
+		}
+
+		// round up so a partially filled last byte isn't dropped on flush
+		fwrite(stream->fbuffer, 1, bytepos(stream->offset + 7), stream->fp);
 		stream->offset = 0;
 	}
 }
@@ -58,17 +70,31 @@ static inline void bit_stream_write(bit_stream_t *stream, bool bit) {
 
 static inline
 void bit_stream_write_bits(bit_stream_t *stream, unsigned bits, uint32_t x) {
-	for (unsigned i = 0; i < bits; i++) {
-		bit_stream_write(stream, !!(x & (1 << i)));
+	// write as many bits as fit in the current byte at a time
+	while (bits) {
+		unsigned shift = bitpos(stream->offset);
+		unsigned n = (8 - shift < bits)? 8 - shift : bits;
+		uint8_t mask = ((1 << n) - 1) << shift;
+		uint8_t *p = stream->fbuffer + bytepos(stream->offset);
+
+		*p = (*p & ~mask) | ((x << shift) & mask);
+		x >>= n;
+		bits -= n;
+		stream->offset += n;
+
+		if (stream->offset == stream->available) {
+			bit_stream_do_write(stream);
+		}
 	}
 }
 
 static inline bool bit_stream_end(bit_stream_t *stream) {
-	return (stream->offset == stream->available) && feof(stream->fp);
+	return (stream->offset >= stream->available)
+	    && (!stream->fp || feof(stream->fp));
 }
 
 static inline bool bit_stream_read(bit_stream_t *stream) {
-	if (stream->offset == stream->available) {
+	if (stream->offset == stream->available && stream->fp) {
 		stream->available = 8 * fread(&stream->fbuffer, 1, sizeof(stream->fbuffer),
 		                              stream->fp);
 		stream->offset = 0;
@@ -76,17 +102,94 @@ static inline bool bit_stream_read(bit_stream_t *stream) {
 
 	if (stream->offset < stream->available) {
 		return bitget(stream->fbuffer, stream->offset++);
-	} else {
-		return 0;
 	}
+
+	if (!stream->fp) {
+		stream->offset++;
+	}
+
+	return 0;
+}
+
+// moves unread bytes to the front of the buffer and tops it up, keeping the
+// bit offset within the first byte
+static inline void bit_stream_refill(bit_stream_t *stream) {
+	if (!stream->fp) {
+		return;
+	}
+
+	size_t start = bytepos(stream->offset);
+	size_t keep = bytepos(stream->available) - start;
+
+	memmove(stream->fbuffer, stream->fbuffer + start, keep);
+	stream->offset = bitpos(stream->offset);
+	stream->available = 8 * (keep + fread(stream->fbuffer + keep, 1,
+	                                      sizeof(stream->fbuffer) - keep,
+	                                      stream->fp));
+}
+
+// returns the next `bits` bits (up to 25) without consuming them, bits past
+// the end of the input read as zero
+static inline
+uint32_t bit_stream_peek_bits(bit_stream_t *stream, unsigned bits) {
+	if (stream->available - stream->offset < bits) {
+		bit_stream_refill(stream);
+	}
+
+	size_t start = bytepos(stream->offset);
+	size_t end = bytepos(stream->available);
+	uint32_t word = 0;
+
+	for (unsigned i = 0; i < 4 && start + i < end; i++) {
+		word |= (uint32_t)stream->fbuffer[start + i] << (8 * i);
+	}
+
+	return (word >> bitpos(stream->offset)) & ((1u << bits) - 1);
+}
+
+static inline void bit_stream_skip_bits(bit_stream_t *stream, unsigned bits) {
+	stream->offset += bits;
+
+	if (stream->offset > stream->available && stream->fp) {
+		stream->offset = stream->available;
+	}
+}
+
+// memory streams only, whether something read past the end of the input
+static inline bool bit_stream_overrun(bit_stream_t *stream) {
+	return stream->offset > stream->available;
+}
+
+// memory streams only, drops the bytes that have been read and adds as much
+// of `data` as fits after the rest. returns the number of bytes added. the
+// stream can't be overrun when this is called.
+static inline
+size_t bit_stream_feed(bit_stream_t *stream, const uint8_t *data, size_t length) {
+	size_t start = bytepos(stream->offset);
+	size_t keep = bytepos(stream->available) - start;
+	size_t room = sizeof(stream->fbuffer) - keep;
+	size_t n = (length < room)? length : room;
+
+	memmove(stream->fbuffer, stream->fbuffer + start, keep);
+	memcpy(stream->fbuffer + keep, data, n);
+	stream->offset = bitpos(stream->offset);
+	stream->available = 8 * (keep + n);
+
+	return n;
 }
 
 static inline
 uint32_t bit_stream_read_bits(bit_stream_t *stream, unsigned bits) {
 	uint32_t ret = 0;
 
+	if (bits <= 25) {
+		ret = bit_stream_peek_bits(stream, bits);
+		bit_stream_skip_bits(stream, bits);
+		return ret;
+	}
+
 	for (unsigned i = 0; i < bits; i++) {
-		ret |= bit_stream_read(stream) << i;
+		ret |= (uint32_t)bit_stream_read(stream) << i;
 	}
 
 	return ret;
@@ -0,0 +1,46 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// block sorting front end for the rle and huffman codecs, the same idea as
+// bzip2. the input is cut into blocks, each block is burrows-wheeler
+// transformed and then move-to-front coded, which turns the repeated
+// contexts of text into long runs of small numbers. blocks are independent
+// and are sorted and inverted in parallel, input that would only make a few
+// blocks is split into one per cpu.
+//
+// the stream is a sequence of blocks, each one:
+//
+//   length      4 bytes, number of bytes in the block
+//   starts      4 bytes each, BWT_STREAMS rows the inverse starts from
+//   data        `length` bytes, the mtf coded last column without the
+//               sentinel
+//
+// all integers are little-endian. start k is the row of the rotation that
+// begins at byte k * length / BWT_STREAMS, start 0 is the usual primary
+// index. with more than one, the inverse can walk several independent
+// parts of the block at once, which hides the latency of its random reads.
+#define BWT_STREAMS 4
+
+// rows and bytes are packed into 32 bits while inverting
+#define BWT_MAX_BLOCK ((1 << 24) - 1)
+#define BWT_DEFAULT_BLOCK (1 << 20)
+
+// `block_size` is capped at BWT_MAX_BLOCK, 0 uses the default. it's the
+// largest block, smaller ones are used to keep every cpu busy.
+bool bwt_encode(FILE *in, FILE *out, size_t block_size);
+bool bwt_decode(FILE *in, FILE *out);
+
+// the transforms on their own. `sa` needs room for `length` entries, `out`
+// gets `length` bytes of the last column, leaving out the sentinel.
+void bwt_transform(const uint8_t *in, uint8_t *out, int32_t *sa,
+                   uint32_t length, uint32_t starts[BWT_STREAMS]);
+// `rows` needs room for `length + 1` entries. returns false if the starts
+// are out of range.
+bool bwt_inverse(const uint8_t *in, uint8_t *out, uint32_t *rows,
+                 uint32_t length, const uint32_t starts[BWT_STREAMS]);
+
+void mtf_encode(uint8_t *buf, size_t length);
+void mtf_decode(uint8_t *buf, size_t length);
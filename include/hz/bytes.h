@@ -0,0 +1,46 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// little-endian helpers for the on-disk headers
+
+static inline void store_le32(uint8_t *p, uint32_t x) {
+	p[0] = x;
+	p[1] = x >> 8;
+	p[2] = x >> 16;
+	p[3] = x >> 24;
+}
+
+static inline uint32_t load_le32(const uint8_t *p) {
+	return (uint32_t)p[0]
+	     | ((uint32_t)p[1] << 8)
+	     | ((uint32_t)p[2] << 16)
+	     | ((uint32_t)p[3] << 24);
+}
+
+static inline void store_le64(uint8_t *p, uint64_t x) {
+	store_le32(p, x);
+	store_le32(p + 4, x >> 32);
+}
+
+static inline uint64_t load_le64(const uint8_t *p) {
+	return load_le32(p) | ((uint64_t)load_le32(p + 4) << 32);
+}
+
+static inline bool write_le32(FILE *fp, uint32_t x) {
+	uint8_t buf[4];
+	store_le32(buf, x);
+	return fwrite(buf, 1, 4, fp) == 4;
+}
+
+static inline bool read_le32(FILE *fp, uint32_t *x) {
+	uint8_t buf[4];
+
+	if (fread(buf, 1, 4, fp) != 4) {
+		return false;
+	}
+
+	*x = load_le32(buf);
+	return true;
+}
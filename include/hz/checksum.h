@@ -0,0 +1,16 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (castagnoli), uses the SSE4.2 crc32 instruction when the cpu has
+// it and falls back to a slicing-by-8 table otherwise.
+//
+// pass 0 as `crc` to start a new checksum, or a previous result to continue
+uint32_t crc32c(uint32_t crc, const void *data, size_t length);
+
+#define SHA256_SIZE 32
+
+// SHA-256, for fingerprints that have to be collision free rather than just
+// catch corruption (see dedup.h). uses the SHA extensions when the cpu has
+// them.
+void sha256(const void *data, size_t length, uint8_t digest[SHA256_SIZE]);
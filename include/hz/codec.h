@@ -0,0 +1,96 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// codec ids as stored in frame headers, these can't change once written
+enum {
+	CODEC_RLE     = 1,
+	CODEC_LZS     = 2,
+	// lzs with huffman coded tokens (`lzs -H`)
+	CODEC_LZH     = 3,
+	CODEC_HUFFMAN = 4,
+	// order-1 context modeled huffman (`huffman -c`)
+	CODEC_HUFFCTX = 5,
+	// pre-filters from filter.h, the number is the word size in bytes
+	CODEC_DELTA    = 6,
+	CODEC_DELTA2   = 7,
+	CODEC_DELTA4   = 8,
+	CODEC_DELTA8   = 9,
+	CODEC_XOR4     = 10,
+	CODEC_XOR8     = 11,
+	CODEC_SHUFFLE2 = 12,
+	CODEC_SHUFFLE4 = 13,
+	CODEC_SHUFFLE8 = 14,
+	// burrows-wheeler and move-to-front, for ahead of rle and huffman
+	CODEC_BWT      = 15,
+	// content-defined dedup against a chunk store, see dedup.h
+	CODEC_DEDUP    = 16,
+};
+
+#define CODEC_MAX_CHAIN 8
+
+// reusable state for running lots of inputs through the codecs on one
+// thread, lzs encoders and decoders are kept between calls instead of being
+// set up again each time. a context can't be shared between threads.
+typedef struct codec_ctx codec_ctx_t;
+
+codec_ctx_t *codec_ctx_create(void);
+void codec_ctx_free(codec_ctx_t *ctx);
+
+typedef struct codec_opts {
+	// compression level from 1-9, 0 picks the codec's default
+	int level;
+	// optional, NULL sets everything up on each call
+	codec_ctx_t *ctx;
+} codec_opts_t;
+
+typedef struct codec {
+	uint8_t id;
+	const char *name;
+
+	// `in` is always seekable, since some codecs need two passes
+	bool (*encode)(FILE *in, FILE *out, const codec_opts_t *opts);
+	bool (*decode)(FILE *in, FILE *out, const codec_opts_t *opts);
+	// optional, decodes straight into a buffer of `size` bytes and fails if
+	// the output doesn't fit. codecs without one go through fmemopen().
+	bool (*decode_buffer)(FILE *in, uint8_t *out, size_t size,
+	                      size_t *written, const codec_opts_t *opts);
+} codec_t;
+
+const codec_t *codec_find(uint8_t id);
+const codec_t *codec_find_name(const char *name);
+
+// parses a comma separated list of codec names, returns the number of codecs
+// in the chain or 0 if a name isn't known or there are too many
+unsigned codec_parse_chain(const char *str, uint8_t *chain, unsigned max);
+
+// runs a buffer through each codec in a chain, encoding applies the chain
+// front to back and decoding back to front. `*out` is malloc()'d.
+bool codec_chain_encode(const uint8_t *chain,
+                        unsigned length,
+                        const codec_opts_t *opts,
+                        const uint8_t *in,
+                        size_t inlen,
+                        uint8_t **out,
+                        size_t *outlen);
+
+bool codec_chain_decode(const uint8_t *chain,
+                        unsigned length,
+                        const codec_opts_t *opts,
+                        const uint8_t *in,
+                        size_t inlen,
+                        uint8_t **out,
+                        size_t *outlen);
+
+// same as codec_chain_decode(), but the last codec writes into `out` which
+// has room for `size` bytes. fails if the output would be bigger.
+bool codec_chain_decode_buffer(const uint8_t *chain,
+                               unsigned length,
+                               const codec_opts_t *opts,
+                               const uint8_t *in,
+                               size_t inlen,
+                               uint8_t *out,
+                               size_t size,
+                               size_t *outlen);
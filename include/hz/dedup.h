@@ -0,0 +1,50 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// deduplication ahead of the other codecs (`hz -c dedup,lzh --store dir`).
+// input is cut into chunks at content-defined points, with a gear rolling
+// hash as in FastCDC, so an insert or delete only changes the chunks around
+// it. each chunk is fingerprinted with SHA-256 and looked up in a chunk
+// store, a local directory that's kept across runs. chunks already in the
+// store are replaced with a reference, new ones are added to the store and
+// passed through, so only data that hasn't been seen before reaches the rest
+// of the chain.
+//
+// the stream is a sequence of records, each one:
+//
+//   type        1 byte, DEDUP_DATA or DEDUP_REF
+//   length      4 bytes, number of bytes in the chunk
+//   data        `length` bytes of the chunk for DEDUP_DATA, or its
+//               SHA256_SIZE byte fingerprint for DEDUP_REF
+//
+// all integers are little-endian. references can point at chunks added by
+// earlier runs or by other blocks of the same frame, so decoding needs the
+// store the encoder used. streams without references decode without one.
+//
+// the store holds each chunk uncompressed in a file named by its
+// fingerprint in hex, under a subdirectory for the first byte, e.g.
+// "store/3f/3fa2...". new chunks are written to a temporary name and renamed
+// into place, so several encoders can share a store.
+#define DEDUP_DATA 0
+#define DEDUP_REF  1
+
+// chunks are cut between these sizes, aiming for the average. a shorter
+// chunk can only be the last one, and those are always passed through.
+#define DEDUP_MIN_CHUNK (2 * 1024)
+#define DEDUP_AVG_CHUNK (8 * 1024)
+#define DEDUP_MAX_CHUNK (64 * 1024)
+
+// sets the store directory for the dedup codec, which is created when
+// encoding if it doesn't exist. this is process wide like tracing, since
+// frames are decoded without any options.
+void dedup_set_store(const char *path);
+
+bool dedup_encode(FILE *in, FILE *out);
+bool dedup_decode(FILE *in, FILE *out);
+
+// length of the first chunk in `buf`, `length` if there's no cut point
+// before the end
+size_t dedup_cut(const uint8_t *buf, size_t length);
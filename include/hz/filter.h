@@ -0,0 +1,35 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// reversible pre-filters for arrays of fixed size little-endian values, like
+// int32 or float64 telemetry. neighbouring values are usually close, but
+// their bytes rarely repeat, so on their own they hardly compress. these
+// turn them into something rle and lzs can work with:
+//
+//   delta    each word minus the one before it, with wrap-around
+//   xor      each word xor the one before it, better for floats since
+//            close values share their sign, exponent and top mantissa bits
+//   shuffle  byte transposition, all the first bytes of each word, then all
+//            the second bytes and so on
+//
+// widths are 1, 2, 4 or 8 bytes (shuffle needs at least 2). bytes past the
+// last whole word are left alone. the filters are vectorized with SSE2, and
+// AVX2 where the cpu has it.
+typedef enum filter_type {
+	FILTER_DELTA,
+	FILTER_XOR,
+	FILTER_SHUFFLE,
+} filter_type_t;
+
+// transform `length` bytes in place. shuffling uses a temporary buffer of
+// the same size.
+void filter_encode(filter_type_t type, unsigned width, uint8_t *buf, size_t length);
+void filter_decode(filter_type_t type, unsigned width, uint8_t *buf, size_t length);
+
+// stream versions for the codec chain, the output is the same size as the
+// input
+bool filter_encode_stream(FILE *in, FILE *out, filter_type_t type, unsigned width);
+bool filter_decode_stream(FILE *in, FILE *out, filter_type_t type, unsigned width);
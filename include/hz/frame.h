@@ -0,0 +1,125 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <hz/codec.h>
+
+// framed container written by `hz`:
+//
+//   magic       4 bytes, "hzfr"
+//   version     1 byte
+//   flags       1 byte, see FRAME_FLAG_*
+//   chain len   1 byte
+//   chain       1 byte codec id per stage, applied in order when encoding
+//   block size  4 bytes, largest uncompressed block in the frame
+//   content     8 bytes, total uncompressed size. only there with
+//               FRAME_FLAG_CONTENT_SIZE, so decoders can size their output
+//               up front
+//   level       1 byte, compression level the frame was written with. only
+//               there with FRAME_FLAG_LEVEL, decoders don't need it
+//   check       1 byte, bits 8-15 of the crc32c of the header so far
+//
+// followed by blocks, each one encoded independently:
+//
+//   usize       4 bytes, uncompressed size, 0 marks the end of the frame
+//   csize       4 bytes, size of the payload. if the top bit is set
+//               (FRAME_BLOCK_STORED) the payload is the uncompressed data,
+//               for blocks the codec chain couldn't make any smaller
+//   checksum    4 bytes, crc32c of the uncompressed data
+//   payload     csize bytes
+//
+// when FRAME_FLAG_SEEK_TABLE is set a seek table follows the end marker,
+// so readers can find the block holding any uncompressed offset:
+//
+//   entries     8 bytes per block, usize (4) then the size of the block
+//               including its header (4)
+//   count       4 bytes, number of entries
+//   checksum    4 bytes, crc32c of the entries
+//   magic       4 bytes, "hzst"
+//
+// all integers are little-endian.
+#define FRAME_MAGIC              "hzfr"
+#define FRAME_SEEK_MAGIC         "hzst"
+#define FRAME_VERSION            1
+#define FRAME_DEFAULT_BLOCK_SIZE (1 << 20)
+#define FRAME_MAX_BLOCK_SIZE     (1 << 30)
+
+#define FRAME_FLAG_SEEK_TABLE    0x01
+#define FRAME_FLAG_CONTENT_SIZE  0x02
+#define FRAME_FLAG_LEVEL         0x04
+#define FRAME_KNOWN_FLAGS        (FRAME_FLAG_SEEK_TABLE | FRAME_FLAG_CONTENT_SIZE \
+                                  | FRAME_FLAG_LEVEL)
+
+#define FRAME_BLOCK_STORED       0x80000000u
+
+typedef struct frame_header {
+	uint8_t version;
+	uint8_t flags;
+	uint8_t chain[CODEC_MAX_CHAIN];
+	unsigned chain_length;
+	uint32_t block_size;
+	// only valid with FRAME_FLAG_CONTENT_SIZE
+	uint64_t content_size;
+	// only valid with FRAME_FLAG_LEVEL
+	uint8_t level;
+} frame_header_t;
+
+typedef struct frame_block {
+	uint32_t usize;
+	uint32_t csize;
+	uint32_t checksum;
+	bool stored;
+} frame_block_t;
+
+typedef struct frame_seek_entry {
+	uint64_t uoffset;
+	uint64_t coffset;
+	uint32_t usize;
+	uint32_t csize;
+} frame_seek_entry_t;
+
+typedef struct frame_params {
+	uint8_t chain[CODEC_MAX_CHAIN];
+	unsigned chain_length;
+	uint32_t block_size;
+	codec_opts_t opts;
+	bool seek_table;
+	// set when the input size is known ahead of time, compressing fails if
+	// the input turns out to be a different size
+	bool has_content_size;
+	uint64_t content_size;
+	// writes opts.level to the header, for chains picked by autotune.h
+	bool record_level;
+} frame_params_t;
+
+bool frame_write_header(FILE *out, const frame_header_t *header);
+bool frame_read_header(FILE *in, frame_header_t *header);
+
+bool frame_write_block_header(FILE *out, const frame_block_t *block);
+bool frame_read_block_header(FILE *in, frame_block_t *block);
+
+// errors are reported on stderr, both return false on failure
+bool frame_compress(FILE *in, FILE *out, const frame_params_t *params);
+// `ctx` is optional, see codec_ctx_t
+bool frame_decompress(FILE *in, FILE *out, codec_ctx_t *ctx);
+// decompresses to a file descriptor. when the frame has its content size and
+// `fd` is a regular file at offset 0, the file is truncated to that size and
+// mapped, and blocks are decoded straight into the mapping. otherwise it
+// falls back to frame_decompress() with buffered writes.
+bool frame_decompress_fd(FILE *in, int fd, codec_ctx_t *ctx);
+
+// reads the seek table from the end of a seekable frame, entry offsets are
+// relative to the first block header. `*entries` is malloc()'d.
+bool frame_read_seek_table(FILE *in,
+                           frame_seek_entry_t **entries,
+                           size_t *count);
+
+// decodes only the blocks overlapping [offset, offset + length) and writes
+// that range to `out`. `in` must be seekable and positioned at the start of
+// the frame. uses the seek table when there is one, otherwise walks the block
+// headers and skips over the payloads it doesn't need.
+bool frame_decompress_range(FILE *in,
+                            FILE *out,
+                            uint64_t offset,
+                            uint64_t length);
@@ -1,9 +1,13 @@
 #pragma once
+#include <stdio.h>
 #include <stdint.h>
 
 typedef struct huff_sym_table_ent {
-	uint8_t symbol;
-	uint8_t weight;
+	// wider than a byte so that alphabets with extra symbols (ie. LZS
+	// match lengths) and finer weights can share the tree code, the packed
+	// table format still only stores one byte of each
+	uint16_t symbol;
+	uint16_t weight;
 } huff_sym_table_ent_t;
 
 typedef struct huff_symbol_table {
@@ -11,7 +15,15 @@ typedef struct huff_symbol_table {
 	huff_sym_table_ent_t *symbols;
 } huff_symbol_table_t;
 
-//uint64_t count_file(FILE *fp, unsigned symbits, huff_symbol_t *symtab);
+typedef struct huff_symbol {
+	uint8_t  symbol;
+	uint64_t frequency;
+} huff_symbol_t;
+
+// adds the byte counts of the rest of `fp` to `symtab`, which needs room
+// for 256 symbols, then rewinds it. returns the number of bytes counted.
+uint64_t count_file(FILE *fp, unsigned symbits, huff_symbol_t *symtab);
 huff_symbol_table_t *generate_symtab(FILE *input);
 huff_symbol_table_t *read_packed_symtab(FILE *fp);
 void write_packed_symtab(FILE *fp, huff_symbol_table_t *table);
+void free_symtab(huff_symbol_table_t *table);
@@ -0,0 +1,29 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+// order-1 context modeled huffman coding, each byte is coded with a table
+// picked by the byte before it. the 256 contexts are clustered so that
+// contexts with similar statistics share a table, which keeps the header
+// small. after the HUFF_CONTEXT_SIGNATURE:
+//
+//   length      8 bytes, number of bytes coded
+//   clusters    1 byte, number of tables
+//   map         4 bits per context, the table it uses (if clusters > 1)
+//   tables      canonical code lengths, each table written with
+//               huff_write_lengths()
+//   data        canonical codes, lsb first like the lzs bit stream
+//
+// the tables and data are one bit stream.
+//
+// all integers are little-endian. the first byte is coded with context 0.
+#define HUFFCTX_SYMBOLS      256
+#define HUFFCTX_CONTEXTS     256
+#define HUFFCTX_MAX_CLUSTERS 16
+
+// `fp` needs to be seekable, it's read once to gather statistics and again
+// to encode. input that wouldn't get smaller is stored like huffman_encode()
+// does.
+bool huffctx_encode(FILE *fp, FILE *out);
+// decodes what follows the signature
+bool huffctx_decode(FILE *fp, FILE *out);
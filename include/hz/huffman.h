@@ -0,0 +1,67 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <hz/bitstream.h>
+#include <hz/hufftree.h>
+#include <hz/push.h>
+
+bool huff_do_encode(huff_node_t *node,
+                    bit_stream_t *stream,
+                    uint16_t symbol,
+                    uint32_t path,
+                    uint32_t pathbits);
+bool huff_do_decode(huff_node_t *node, bit_stream_t *stream, FILE *out);
+
+void huff_encode(huff_tree_t *tree, FILE *fp, FILE *out);
+void huff_decode(huff_tree_t *tree, FILE *fp, FILE *out);
+
+// huffman_encode() writes canonical streams, the signature followed by a
+// bit stream of the code lengths for the 256 byte values and the end of
+// block symbol as a compact table (see huff_write_lengths()), then the codes
+// and the end of block code. when one of the built-in tables in
+// hz/huffstatic.h codes the input in as few bits, there's a static stream
+// instead with just the table's id in 1 byte before the codes. streams with
+// the older packed symbol table and tree format still decode. input that
+// wouldn't get any smaller is stored as-is after its own signature, context
+// modeled streams are described in hz/huffctx.h
+#define HUFF_SIGNATURE           "hzpk"
+#define HUFF_STORED_SIGNATURE    "hzps"
+#define HUFF_CONTEXT_SIGNATURE   "hzpc"
+#define HUFF_CANONICAL_SIGNATURE "hzpl"
+#define HUFF_STATIC_SIGNATURE    "hzpt"
+
+typedef enum huff_mode {
+	HUFF_MODE_TREE,
+	HUFF_MODE_STORED,
+	HUFF_MODE_CONTEXT,
+	HUFF_MODE_CANONICAL,
+	HUFF_MODE_STATIC,
+} huff_mode_t;
+
+void write_signature(FILE *fp);
+// `*mode` is set to the kind of stream the signature starts
+bool check_signature(FILE *fp, huff_mode_t *mode);
+
+// complete streams, signature and symbol table followed by the coded data.
+// huffman_decode() also takes streams from huffctx_encode()
+bool huffman_encode(FILE *fp, FILE *out);
+bool huffman_decode(FILE *fp, FILE *out);
+// bytes huffman_encode() writes for input with these byte counts
+uint64_t huffman_encoded_size(const uint64_t *counts, uint64_t length);
+
+// push decoder for the same streams, see hz/push.h. stored streams don't
+// mark their end, so they never get PUSH_DONE.
+typedef struct huff_push huff_push_t;
+
+huff_push_t *huff_push_create(void);
+void huff_push_free(huff_push_t *dec);
+// starts over with a new stream
+void huff_push_reset(huff_push_t *dec);
+push_status_t huff_push_decode(huff_push_t *dec,
+                               const uint8_t *in,
+                               size_t length,
+                               size_t *used,
+                               uint8_t *out,
+                               size_t size,
+                               size_t *written);
@@ -0,0 +1,39 @@
+#pragma once
+#include <stdint.h>
+
+#include <hz/hufftree.h>
+
+// built-in huffman tables for common kinds of data. a stream coded with one
+// only has to name it, so short inputs don't pay for a table of their own
+// and decoding starts without building anything. the code lengths were
+// made with the `gentable` tool from sample corpora and are compiled in,
+// the codes and decoding tables are built from them once when the program
+// starts.
+//
+// ids are part of the stream format, as are the tables themselves. a table
+// can't be regenerated once it's been used, add a new id instead.
+typedef enum huff_static_id {
+	// english prose
+	HUFF_STATIC_TEXT,
+	HUFF_STATIC_JSON,
+	// line oriented program logs, timestamps and all
+	HUFF_STATIC_LOG,
+	// output of rle_encode()
+	HUFF_STATIC_RLE,
+
+	HUFF_STATIC_TABLES,
+} huff_static_id_t;
+
+// the byte values then the end of block symbol
+#define HUFF_STATIC_SYMBOLS 257
+
+typedef struct huff_static_table {
+	const char *name;
+	// every symbol has a code, so any input can be coded with any table
+	const uint8_t *lengths;
+	huff_code_t codes[HUFF_STATIC_SYMBOLS];
+	huff_decode_ent_t decode[1 << HUFF_MAX_CODE_BITS];
+} huff_static_table_t;
+
+// NULL if there's no table with that id
+const huff_static_table_t *huff_static_table(unsigned id);
@@ -0,0 +1,96 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <hz/gentable.h>
+#include <hz/bitstream.h>
+
+#define END_OF_BLOCK 0xffff
+
+// longest code that the canonical code helpers will generate, this also
+// sets the size of the decoding tables (1 << HUFF_MAX_CODE_BITS entries)
+#define HUFF_MAX_CODE_BITS 12
+
+typedef struct huff_node huff_node_t;
+typedef struct huff_node {
+	uint16_t symbol;
+	unsigned weight;
+
+	huff_node_t *left;
+	huff_node_t *right;
+	huff_node_t *parent;
+} huff_node_t;
+
+typedef struct huff_tree {
+	//huff_table_sym_t *symbols;
+	const huff_symbol_table_t *symbols;
+	/* TODO: const */ huff_node_t *nodes;
+	// every node in the tree, `nodes` points to the root somewhere in here
+	huff_node_t *pool;
+} huff_tree_t;
+
+// canonical code for one symbol, `code` is stored bit-reversed so that it
+// can be passed straight to bit_stream_write_bits() with the root bit first
+typedef struct huff_code {
+	uint16_t code;
+	uint8_t length;
+} huff_code_t;
+
+// decoding table entry, indexed by the next HUFF_MAX_CODE_BITS of input
+typedef struct huff_decode_ent {
+	uint16_t symbol;
+	uint8_t length;
+} huff_decode_ent_t;
+
+huff_node_t *make_huffnode(uint16_t symbol,
+                           huff_node_t *left,
+                           huff_node_t *right,
+                           unsigned weight);
+void dump_hufftree(huff_node_t *node, unsigned indent);
+
+huff_tree_t *huff_tree_create(const huff_symbol_table_t *sym_table);
+void huff_tree_free(huff_tree_t *tree);
+
+bool is_internal(huff_node_t *node);
+bool is_leaf(huff_node_t *node);
+
+// builds a tree from symbol frequencies and returns the code length of each
+// symbol in `lengths`, limited to at most `maxbits` bits.
+//
+// returns the length of the longest code.
+unsigned huff_lengths_from_freqs(const uint32_t *freqs,
+                                 unsigned symbols,
+                                 uint8_t *lengths,
+                                 unsigned maxbits);
+
+void huff_canonical_codes(const uint8_t *lengths,
+                          unsigned symbols,
+                          huff_code_t *codes);
+
+void huff_build_decode_table(const uint8_t *lengths,
+                             unsigned symbols,
+                             huff_decode_ent_t *table);
+
+// compact code length tables, for headers that would otherwise take 4 bits
+// per symbol. the lengths are run-length coded like deflate does, as symbols
+// of a small code length alphabet:
+//
+//   0-HUFF_MAX_CODE_BITS   a code length
+//   HUFF_CL_REPEAT         the previous length 3-6 more times, 2 extra bits
+//   HUFF_CL_ZEROS          3-10 zeros, 3 extra bits
+//   HUFF_CL_ZEROS_LONG     11-138 zeros, 7 extra bits
+//
+// which are themselves huffman coded. the table starts with 4 bits for the
+// number of code length code lengths minus one, then those lengths in
+// 3 bits each, in the order of huff_cl_order in hufftree.c (the rest are 0).
+// then come the symbols in the usual lsb first bit order.
+#define HUFF_CL_REPEAT     (HUFF_MAX_CODE_BITS + 1)
+#define HUFF_CL_ZEROS      (HUFF_MAX_CODE_BITS + 2)
+#define HUFF_CL_ZEROS_LONG (HUFF_MAX_CODE_BITS + 3)
+#define HUFF_CL_CODES      (HUFF_MAX_CODE_BITS + 4)
+
+void huff_write_lengths(bit_stream_t *out, const uint8_t *lengths, unsigned symbols);
+// returns false if the table is corrupt
+bool huff_read_lengths(bit_stream_t *in, uint8_t *lengths, unsigned symbols);
+// size of the table huff_write_lengths() would write, in bits
+size_t huff_lengths_bits(const uint8_t *lengths, unsigned symbols);
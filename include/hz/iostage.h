@@ -0,0 +1,20 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+// reader and writer stages that move file I/O off the thread doing the
+// coding. each one is a thread with a few chunk buffers, a reader fills
+// chunks ahead of the codec and a writer drains them behind it, so I/O
+// latency overlaps with compression instead of stalling it.
+//
+// reads and writes go through io_uring when the kernel allows it, falling
+// back to plain read() and write(). setting HZ_IO_URING=0 in the environment
+// forces the fallback.
+#define IOSTAGE_CHUNKS     3
+#define IOSTAGE_CHUNK_SIZE (256 * 1024)
+
+// both return a stdio stream that can be passed to the codecs as usual, or
+// NULL on failure. the returned streams can't seek. fclose() waits for the
+// stage to finish, for a writer it returns EOF if any write failed.
+FILE *iostage_open_reader(int fd);
+FILE *iostage_open_writer(int fd);
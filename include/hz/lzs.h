@@ -0,0 +1,159 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hz/push.h>
+
+// constants here for testing and maybe making really embedded variations
+// easier in the future
+#define MAX_WINDOW_BITS 11
+#define MAX_WINDOW_SIZE (1 << MAX_WINDOW_BITS)
+
+#define LZS_DICT_MAGIC "hzdc"
+
+// preset dictionary, loaded into the window before the first byte of input
+// so that short messages have something to match against
+typedef struct lzs_dict {
+	uint32_t id;
+	uint16_t length;
+	uint8_t data[MAX_WINDOW_SIZE];
+} lzs_dict_t;
+
+typedef enum {
+	// hash chains on 2 byte prefixes, only the most recent few entries in
+	// each chain are searched
+	LZS_MATCH_HASH_CHAIN,
+	// binary trees on 4 byte hashes, slower but finds the longest matches,
+	// see lzsbt.h
+	LZS_MATCH_BINARY_TREE,
+	// checks every position in the window, very slow but doesn't need any
+	// memory besides the windows
+	LZS_MATCH_SCAN,
+
+	LZS_MATCH_FINDERS,
+} lzs_match_finder_t;
+
+typedef struct lzs_params {
+	// 0 selects the largest window, sizes that aren't a power of two are
+	// rounded down. ignored when decoding.
+	unsigned window_size;
+	// huffman coded token format (`lzs -H`). streams record their format
+	// and decoders follow it, when decoding this only allocates the huffman
+	// tables up front.
+	bool entropy_coded;
+	// ignored when decoding
+	lzs_match_finder_t match_finder;
+
+	// the encoder uses the first dictionary and records its id in the
+	// stream, the decoder picks the one with the matching id and fails if
+	// it doesn't have it
+	const lzs_dict_t *const *dicts;
+	unsigned dict_count;
+
+	// history in bytes for long distance matches (`lzs -L`), repeats up to
+	// this far back are found by a sparse index over it, see lzsldm.h. 0
+	// turns it off, other sizes are rounded down to a power of two between
+	// LZS_LDM_MIN_WINDOW and LZS_LDM_MAX_WINDOW. streams record the size
+	// they were made with and decoders grow their history to match, so when
+	// decoding this only allocates it up front.
+	size_t long_window;
+
+	// caps the working memory of the encoder or decoder in bytes, 0 for no
+	// limit. the encoder shrinks its hash table, block buffer, match finder
+	// and window until it fits, at some cost in compression. what the
+	// decoder needs is fixed apart from the long window, it fails if that
+	// doesn't fit or a stream's long window would take it over.
+	size_t memory_limit;
+} lzs_params_t;
+
+// both return false if the memory limit is too small
+bool lzs_encode(FILE *fp, FILE *out, const lzs_params_t *params);
+bool lzs_decode(FILE *fp, FILE *out, const lzs_params_t *params);
+
+// working memory the encoder or decoder uses with these params, once the
+// memory limit is applied. this is also the peak, nothing is allocated
+// while coding. the encoder returns 0 if it can't fit in the limit.
+size_t lzs_encoder_memory(const lzs_params_t *params);
+size_t lzs_decoder_memory(const lzs_params_t *params);
+
+typedef struct lzs_stream lzs_stream_t;
+
+typedef enum {
+	// encodes everything written so far and pads to a byte boundary, the
+	// history is kept so later data can still match against earlier data
+	LZS_FLUSH_SYNC,
+	// same as a sync flush, but also forgets the history so that decoding
+	// can start again from this point (with the same dictionary)
+	LZS_FLUSH_FULL,
+} lzs_flush_t;
+
+// incremental encoder, the output is the same as lzs_encode() for the same
+// input as long as there are no flushes. returns NULL if the memory limit
+// is too small.
+lzs_stream_t *lzs_stream_create(FILE *out, const lzs_params_t *params);
+void lzs_stream_write(lzs_stream_t *stream, const uint8_t *data, size_t length);
+void lzs_stream_flush(lzs_stream_t *stream, lzs_flush_t mode);
+// writes the end of the stream, the stream can't be written to after this
+void lzs_stream_finish(lzs_stream_t *stream);
+void lzs_stream_free(lzs_stream_t *stream);
+// starts a new, independent stream on `out` with the same params. nothing
+// is allocated or cleared, so this is much cheaper than creating a new
+// stream when there are lots of small inputs. unfinished input is dropped.
+void lzs_stream_reset(lzs_stream_t *stream, FILE *out);
+// bytes allocated for the stream
+size_t lzs_stream_memory(const lzs_stream_t *stream);
+
+// reusable decoder, the window and tables are kept between streams. create
+// returns NULL if the memory limit is too small.
+typedef struct lzs_decoder lzs_decoder_t;
+
+lzs_decoder_t *lzs_decoder_create(const lzs_params_t *params);
+bool lzs_decoder_run(lzs_decoder_t *dec, FILE *fp, FILE *out);
+void lzs_decoder_free(lzs_decoder_t *dec);
+
+// decodes into `out` instead of a stream, matches are copied from the output
+// itself so the window isn't used. fails if the stream decodes to more than
+// `size` bytes, or if the decoder has dictionaries since their history isn't
+// in the buffer. `*written` is the number of bytes decoded.
+bool lzs_decoder_run_buffer(lzs_decoder_t *dec,
+                            FILE *fp,
+                            uint8_t *out,
+                            size_t size,
+                            size_t *written);
+
+// push decoder, see hz/push.h. it takes the same params as
+// lzs_decoder_create() and keeps its own history, so matches and
+// dictionaries work across calls. create returns NULL if the memory limit
+// is too small.
+typedef struct lzs_push lzs_push_t;
+
+lzs_push_t *lzs_push_create(const lzs_params_t *params);
+void lzs_push_free(lzs_push_t *dec);
+// starts over with a new stream
+void lzs_push_reset(lzs_push_t *dec);
+// bytes allocated for the decoder, including history grown for the
+// stream's long window
+size_t lzs_push_memory(const lzs_push_t *dec);
+push_status_t lzs_push_decode(lzs_push_t *dec,
+                              const uint8_t *in,
+                              size_t length,
+                              size_t *used,
+                              uint8_t *out,
+                              size_t size,
+                              size_t *written);
+
+// builds a dictionary of at most `size` bytes out of the substrings that are
+// most common across the samples
+lzs_dict_t *lzs_dict_train(const uint8_t *const *samples,
+                           const size_t *lengths,
+                           size_t count,
+                           size_t size);
+lzs_dict_t *lzs_dict_load(FILE *fp);
+bool lzs_dict_save(FILE *fp, const lzs_dict_t *dict);
+
+// maps a compression level from 1-9 to a window size
+unsigned lzs_window_size(int level);
+// and to a match finder, the top levels use binary trees
+lzs_match_finder_t lzs_match_finder(int level);
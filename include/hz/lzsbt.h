@@ -0,0 +1,48 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// binary tree match finder for the higher compression levels, same idea as
+// lzma's bt4: positions are hashed on their first 4 bytes, and each hash
+// bucket is a binary search tree of earlier positions sorted by the strings
+// that start there. inserting the current position walks down the tree and
+// finds the longest matches along the way, so there's no chain to cut short.
+// 2 and 3 byte matches come from small hash tables of the last position
+// with each prefix.
+//
+// the match finder keeps its own copy of the history and lookahead, bytes are
+// added with lzs_bt_append() and consumed with lzs_bt_advance().
+typedef struct lzs_bt lzs_bt_t;
+
+typedef struct lzs_match {
+	uint16_t length;
+	uint16_t distance;
+} lzs_match_t;
+
+// most matches lzs_bt_find() can return, one for each of the 2, 3 and 4 byte
+// hashes plus one per tree node visited
+#define LZS_BT_MAX_MATCHES 64
+
+// `window_size` is the size of the encoder's history window, a power of two.
+// matches are never further back than `window_size - 1`
+lzs_bt_t *lzs_bt_create(unsigned window_size);
+void lzs_bt_free(lzs_bt_t *bt);
+// bytes lzs_bt_create() allocates for a window size
+size_t lzs_bt_memory(unsigned window_size);
+
+// forgets the history, matches only start again after the current position
+void lzs_bt_reset(lzs_bt_t *bt);
+
+void lzs_bt_append(lzs_bt_t *bt, uint8_t value);
+void lzs_bt_advance(lzs_bt_t *bt, unsigned count);
+
+// leaves the current position out of the trees, for when the encoder isn't
+// searching there. call before advancing past it.
+void lzs_bt_skip(lzs_bt_t *bt);
+
+// finds matches for the current position, each one longer than the one
+// before it. matches can run past the current position into the lookahead
+// (length > distance), the way runs are usually coded. returns the number
+// of matches.
+unsigned lzs_bt_find(lzs_bt_t *bt, lzs_match_t *matches);
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// long distance match finder, for repeats far beyond the lzs window like
+// duplicated regions in disk images or log segments that come around again
+// after a rotation. a gear rolling hash runs over the last
+// LZS_LDM_HASH_LENGTH bytes, and roughly one position in
+// 2^LZS_LDM_SAMPLE_BITS (picked by the hash, so both copies of a repeat are
+// sampled at the same places) goes into a table. a sample that hits an
+// earlier one is checked and extended backwards, then kept as a candidate
+// distance that the encoder tries at each position until the repeat ends.
+//
+// the finder keeps its own history of `window_size` bytes, plus a table of
+// one 4 byte entry per 2^LZS_LDM_SAMPLE_BITS bytes of window. bytes are
+// added with lzs_ldm_append() as they go into the lookahead. there's no call
+// to consume them like lzsbt.h has, it runs for every byte and searches say
+// how long the lookahead is instead.
+typedef struct lzs_ldm lzs_ldm_t;
+
+#define LZS_LDM_HASH_LENGTH 64
+#define LZS_LDM_SAMPLE_BITS 5
+
+// shortest long distance match, shorter repeats are left to the normal
+// match finder
+#define LZS_LDM_MIN_MATCH 32
+
+#define LZS_LDM_MIN_WINDOW (1 << 16)
+#define LZS_LDM_MAX_WINDOW (1 << 30)
+
+typedef struct lzs_far_match {
+	uint32_t length;
+	uint32_t distance;
+} lzs_far_match_t;
+
+// `window_size` is rounded down to a power of two within the limits above.
+// matches are only looked for further back than `min_distance`, the normal
+// match finder's window.
+lzs_ldm_t *lzs_ldm_create(size_t window_size, uint32_t min_distance);
+void lzs_ldm_free(lzs_ldm_t *ldm);
+// bytes lzs_ldm_create() allocates for a window size
+size_t lzs_ldm_memory(size_t window_size);
+// the window size actually used for a requested size
+size_t lzs_ldm_window(size_t window_size);
+
+// forgets the history and drops the lookahead
+void lzs_ldm_reset(lzs_ldm_t *ldm);
+
+void lzs_ldm_append(lzs_ldm_t *ldm, uint8_t value);
+
+// looks for a match of at least LZS_LDM_MIN_MATCH bytes at the start of the
+// last `lookahead` bytes appended, matches don't run past them
+bool lzs_ldm_find(lzs_ldm_t *ldm, unsigned lookahead, lzs_far_match_t *match);
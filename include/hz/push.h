@@ -0,0 +1,76 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include <hz/bitstream.h>
+
+// push decoders take compressed input in pieces of any size as it arrives,
+// ie. from a non-blocking socket, and write as much output as that input
+// and the output buffer allow. a piece can end anywhere, even in the middle
+// of a token or a code, everything needed to carry on is kept in the
+// decoder. see lzs_push_decode(), huff_push_decode() and rle_push_decode().
+typedef enum push_status {
+	// all of the input was taken, call again once there's more
+	PUSH_NEED_INPUT,
+	// the output buffer is full, call again with more room. the decoder may
+	// not have taken all of the input.
+	PUSH_MORE_OUTPUT,
+	// the stream ended. whatever came after it in this piece of input isn't
+	// counted as taken, any from earlier pieces is dropped.
+	PUSH_DONE,
+	PUSH_ERROR,
+} push_status_t;
+
+// decodes from the input buffered in `in` until it needs more, the output is
+// full or the stream ends. `*written` is where to carry on in `out`.
+typedef push_status_t (*push_run_t)(void *dec,
+                                    bit_stream_t *in,
+                                    uint8_t *out,
+                                    size_t size,
+                                    size_t *written);
+
+// common part of the push decoders that read bit streams. input is copied
+// into the memory stream `in` a buffer at a time, and each step of the
+// decoder checks that the stream wasn't overrun before it does anything, so
+// a step that runs out of input just starts over once there's more. no step
+// needs more than a buffer of input.
+static inline push_status_t push_decode(bit_stream_t *in,
+                                        push_run_t run,
+                                        void *dec,
+                                        const uint8_t *data,
+                                        size_t length,
+                                        size_t *used,
+                                        uint8_t *out,
+                                        size_t size,
+                                        size_t *written)
+{
+	push_status_t ret = PUSH_NEED_INPUT;
+	*used = 0;
+	*written = 0;
+
+	for (;;) {
+		*used += bit_stream_feed(in, data + *used, length - *used);
+		ret = run(dec, in, out, size, written);
+
+		if (ret != PUSH_NEED_INPUT || *used == length) {
+			break;
+		}
+
+		if (bytepos(in->available) - bytepos(in->offset) == sizeof(in->fbuffer)) {
+			// a full buffer and still not enough for a step
+			ret = PUSH_ERROR;
+			break;
+		}
+	}
+
+	if (ret == PUSH_DONE) {
+		// streams end on a byte boundary, give back what comes after
+		size_t rest = bytepos(in->available) - bytepos(in->offset + 7);
+		rest = (rest < *used)? rest : *used;
+
+		*used -= rest;
+		in->available -= 8 * rest;
+	}
+
+	return ret;
+}
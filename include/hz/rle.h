@@ -0,0 +1,30 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <hz/push.h>
+
+#define RLE_ESCAPE '\a'
+
+void rle_encode(FILE *fp, FILE *out);
+void rle_decode(FILE *fp, FILE *out);
+
+// push decoder, see hz/push.h. rle streams don't mark their end, so this
+// never returns PUSH_DONE, rle_push_pending() says whether the input so far
+// stops in the middle of a run or stored block.
+typedef struct rle_push rle_push_t;
+
+rle_push_t *rle_push_create(void);
+void rle_push_free(rle_push_t *dec);
+// starts over with a new stream
+void rle_push_reset(rle_push_t *dec);
+bool rle_push_pending(const rle_push_t *dec);
+push_status_t rle_push_decode(rle_push_t *dec,
+                              const uint8_t *in,
+                              size_t length,
+                              size_t *used,
+                              uint8_t *out,
+                              size_t size,
+                              size_t *written);
@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// timings for the stages of the tools: reading, writing, histograms, tree
+// building, match finding, bit emission and so on. each stage records a
+// span with the monotonic clock and the number of bytes it went through,
+// and the spans are reported when the process exits.
+//
+// tracing is off unless HZ_TRACE is set in the environment, or a tool's -T
+// option turns it on. HZ_TRACE=1 prints a summary per stage on stderr, any
+// other value is a path to write a chrome trace to, for chrome://tracing or
+// perfetto. spans nest, a stage's time includes the stages inside it.
+//
+// stages are named by a category and a name, both have to be string
+// literals or otherwise live until exit.
+extern bool trace_active;
+
+// reads HZ_TRACE, call once at the start of main()
+void trace_init(void);
+// turns on tracing regardless of the environment, NULL for a summary
+void trace_enable(const char *path);
+
+uint64_t trace_now(void);
+
+// returns the start time of a span, or 0 if tracing is off
+static inline uint64_t trace_begin(void) {
+	return trace_active? trace_now() : 0;
+}
+
+void trace_record(const char *cat, const char *name,
+                  uint64_t start, uint64_t bytes);
+
+// ends a span started with trace_begin()
+static inline void trace_end(const char *cat, const char *name,
+                             uint64_t start, uint64_t bytes)
+{
+	if (trace_active) {
+		trace_record(cat, name, start, bytes);
+	}
+}
@@ -0,0 +1,497 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <hz/iostage.h>
+#include <hz/trace.h>
+
+// minimal io_uring with one request in flight at a time, each stage runs on
+// its own thread so that's enough to overlap with the codec
+typedef struct uring {
+	int fd;
+
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+} uring_t;
+
+typedef struct io_chunk {
+	uint8_t *data;
+	size_t length;
+	size_t offset;
+} io_chunk_t;
+
+typedef struct io_stage {
+	int fd;
+	bool writer;
+	bool use_uring;
+	uring_t ring;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	// chunks are handed over in order, `head` is the next one the consumer
+	// takes and `ready` is how many are waiting for it. for a reader the
+	// consumer is the codec, for a writer it's the stage thread.
+	io_chunk_t chunks[IOSTAGE_CHUNKS];
+	unsigned head;
+	unsigned ready;
+
+	// set by the producer when there won't be any more chunks
+	bool done;
+	// only set by the stage thread, with the lock held
+	bool error;
+} io_stage_t;
+
+static bool uring_init(uring_t *ring) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+
+	ring->fd = syscall(__NR_io_uring_setup, 4, &p);
+
+	if (ring->fd < 0) {
+		return false;
+	}
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes
+	                   + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+	                     MAP_SHARED | MAP_POPULATE, ring->fd,
+	                     IORING_OFF_SQ_RING);
+	ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+	                     MAP_SHARED | MAP_POPULATE, ring->fd,
+	                     IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+	                  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+	if (ring->sq_ring == MAP_FAILED
+	    || ring->cq_ring == MAP_FAILED
+	    || ring->sqes == MAP_FAILED)
+	{
+		if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+		if (ring->cq_ring != MAP_FAILED) munmap(ring->cq_ring, ring->cq_ring_size);
+		if (ring->sqes != MAP_FAILED)    munmap(ring->sqes, ring->sqes_size);
+		close(ring->fd);
+		return false;
+	}
+
+	uint8_t *sq = ring->sq_ring;
+	uint8_t *cq = ring->cq_ring;
+
+	ring->sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+	ring->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring->cq_head  = (unsigned *)(cq + p.cq_off.head);
+	ring->cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+	ring->cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+	ring->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return true;
+}
+
+static void uring_free(uring_t *ring) {
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sqes, ring->sqes_size);
+	close(ring->fd);
+}
+
+// submits one read or write at the current file position and waits for it,
+// `*res` is the same as read()/write() would return, with the error negated.
+// returns false if the request couldn't be submitted, it's taken back then.
+static bool uring_rw(uring_t *ring, int op, int fd, void *buf, size_t len,
+                     ssize_t *res)
+{
+	unsigned tail = *ring->sq_tail;
+	unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = ring->sqes + index;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = len;
+	// -1 uses (and moves) the file position, which also works for pipes
+	sqe->off = (uint64_t)-1;
+
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	int ret;
+
+	do {
+		ret = syscall(__NR_io_uring_enter, ring->fd, 1, 1,
+		              IORING_ENTER_GETEVENTS, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	// nothing is in flight, so waiting below would never end
+	if (ret <= 0) {
+		__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+		return false;
+	}
+
+	unsigned head = *ring->cq_head;
+
+	while (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		ret = syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+		              IORING_ENTER_GETEVENTS, NULL, 0);
+
+		// the request is still in flight, so it can't be retried with a
+		// plain read() or write()
+		if (ret < 0 && errno != EINTR) {
+			*res = -errno;
+			return true;
+		}
+	}
+
+	*res = ring->cqes[head & *ring->cq_mask].res;
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static ssize_t stage_read(io_stage_t *stage, void *buf, size_t len) {
+	ssize_t ret;
+
+	if (stage->use_uring) {
+		// kernels before 5.6 set up rings but don't know the opcode. that,
+		// or a ring that can't take requests, falls back to read() for good.
+		if (uring_rw(&stage->ring, IORING_OP_READ, stage->fd, buf, len, &ret)
+		    && ret != -EINVAL && ret != -EOPNOTSUPP)
+		{
+			if (ret < 0) {
+				errno = -ret;
+				return -1;
+			}
+
+			return ret;
+		}
+
+		stage->use_uring = false;
+	}
+
+	return read(stage->fd, buf, len);
+}
+
+static ssize_t stage_write(io_stage_t *stage, const void *buf, size_t len) {
+	ssize_t ret;
+
+	if (stage->use_uring) {
+		if (uring_rw(&stage->ring, IORING_OP_WRITE, stage->fd, (void *)buf,
+		             len, &ret)
+		    && ret != -EINVAL && ret != -EOPNOTSUPP)
+		{
+			if (ret < 0) {
+				errno = -ret;
+				return -1;
+			}
+
+			return ret;
+		}
+
+		stage->use_uring = false;
+	}
+
+	return write(stage->fd, buf, len);
+}
+
+static void *reader_thread(void *arg) {
+	io_stage_t *stage = arg;
+	unsigned next = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&stage->lock);
+
+		while (stage->ready == IOSTAGE_CHUNKS && !stage->done) {
+			pthread_cond_wait(&stage->cond, &stage->lock);
+		}
+
+		// `done` is set by the consumer here when the stream is closed early
+		bool stop = stage->done;
+		pthread_mutex_unlock(&stage->lock);
+
+		if (stop) {
+			break;
+		}
+
+		io_chunk_t *chunk = stage->chunks + next;
+		ssize_t ret;
+
+		uint64_t start = trace_begin();
+
+		do {
+			ret = stage_read(stage, chunk->data, IOSTAGE_CHUNK_SIZE);
+		} while (ret < 0 && errno == EINTR);
+
+		trace_end("io", "read", start, (ret > 0)? ret : 0);
+
+		pthread_mutex_lock(&stage->lock);
+
+		if (ret <= 0) {
+			stage->error = ret < 0;
+			stage->done = true;
+
+		} else {
+			chunk->length = ret;
+			chunk->offset = 0;
+			stage->ready++;
+			next = (next + 1) % IOSTAGE_CHUNKS;
+		}
+
+		pthread_cond_broadcast(&stage->cond);
+		pthread_mutex_unlock(&stage->lock);
+
+		if (ret <= 0) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static void *writer_thread(void *arg) {
+	io_stage_t *stage = arg;
+
+	for (;;) {
+		pthread_mutex_lock(&stage->lock);
+
+		while (stage->ready == 0 && !stage->done) {
+			pthread_cond_wait(&stage->cond, &stage->lock);
+		}
+
+		if (stage->ready == 0) {
+			pthread_mutex_unlock(&stage->lock);
+			break;
+		}
+
+		io_chunk_t *chunk = stage->chunks + stage->head;
+		pthread_mutex_unlock(&stage->lock);
+
+		uint64_t start = trace_begin();
+		size_t written = chunk->length - chunk->offset;
+
+		// after an error the rest of the output is dropped, the codec finds
+		// out when the stream is closed
+		while (!stage->error && chunk->offset < chunk->length) {
+			ssize_t ret = stage_write(stage, chunk->data + chunk->offset,
+			                          chunk->length - chunk->offset);
+
+			if (ret < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if (ret <= 0) {
+				pthread_mutex_lock(&stage->lock);
+				stage->error = true;
+				pthread_mutex_unlock(&stage->lock);
+				break;
+			}
+
+			chunk->offset += ret;
+		}
+
+		trace_end("io", "write", start, written);
+
+		pthread_mutex_lock(&stage->lock);
+		stage->head = (stage->head + 1) % IOSTAGE_CHUNKS;
+		stage->ready--;
+		pthread_cond_broadcast(&stage->cond);
+		pthread_mutex_unlock(&stage->lock);
+	}
+
+	return NULL;
+}
+
+static ssize_t cookie_read(void *cookie, char *buf, size_t size) {
+	io_stage_t *stage = cookie;
+	size_t ret = 0;
+
+	pthread_mutex_lock(&stage->lock);
+
+	// hand back whatever is ready, only blocking when nothing is
+	while (ret < size) {
+		while (stage->ready == 0 && !stage->done) {
+			pthread_cond_wait(&stage->cond, &stage->lock);
+		}
+
+		if (stage->ready == 0) {
+			break;
+		}
+
+		io_chunk_t *chunk = stage->chunks + stage->head;
+		size_t n = chunk->length - chunk->offset;
+		n = (n < size - ret)? n : size - ret;
+
+		memcpy(buf + ret, chunk->data + chunk->offset, n);
+		chunk->offset += n;
+		ret += n;
+
+		if (chunk->offset == chunk->length) {
+			stage->head = (stage->head + 1) % IOSTAGE_CHUNKS;
+			stage->ready--;
+			pthread_cond_broadcast(&stage->cond);
+		}
+
+		if (stage->ready == 0) {
+			break;
+		}
+	}
+
+	bool error = ret == 0 && stage->error;
+	pthread_mutex_unlock(&stage->lock);
+
+	return error? -1 : (ssize_t)ret;
+}
+
+static io_chunk_t *writer_next_chunk(io_stage_t *stage) {
+	pthread_mutex_lock(&stage->lock);
+
+	while (stage->ready == IOSTAGE_CHUNKS) {
+		pthread_cond_wait(&stage->cond, &stage->lock);
+	}
+
+	io_chunk_t *ret = stage->chunks
+	                + (stage->head + stage->ready) % IOSTAGE_CHUNKS;
+	pthread_mutex_unlock(&stage->lock);
+
+	ret->offset = 0;
+	return ret;
+}
+
+static ssize_t cookie_write(void *cookie, const char *buf, size_t size) {
+	io_stage_t *stage = cookie;
+	size_t ret = 0;
+
+	pthread_mutex_lock(&stage->lock);
+	bool error = stage->error;
+	pthread_mutex_unlock(&stage->lock);
+
+	if (error) {
+		return -1;
+	}
+
+	// the stream's buffer is a chunk in size, so stdio only gets here with a
+	// full chunk or on fflush(). either way everything goes to the writer.
+	while (ret < size) {
+		io_chunk_t *chunk = writer_next_chunk(stage);
+		size_t n = (size - ret < IOSTAGE_CHUNK_SIZE)? size - ret
+		                                            : IOSTAGE_CHUNK_SIZE;
+
+		memcpy(chunk->data, buf + ret, n);
+		chunk->length = n;
+		ret += n;
+
+		pthread_mutex_lock(&stage->lock);
+		stage->ready++;
+		pthread_cond_broadcast(&stage->cond);
+		pthread_mutex_unlock(&stage->lock);
+	}
+
+	return ret;
+}
+
+static void stage_free(io_stage_t *stage) {
+	if (stage->use_uring) {
+		uring_free(&stage->ring);
+	}
+
+	for (unsigned i = 0; i < IOSTAGE_CHUNKS; i++) {
+		free(stage->chunks[i].data);
+	}
+
+	pthread_mutex_destroy(&stage->lock);
+	pthread_cond_destroy(&stage->cond);
+	free(stage);
+}
+
+static int cookie_close(void *cookie) {
+	io_stage_t *stage = cookie;
+
+	pthread_mutex_lock(&stage->lock);
+	stage->done = true;
+	pthread_cond_broadcast(&stage->cond);
+	pthread_mutex_unlock(&stage->lock);
+
+	pthread_join(stage->thread, NULL);
+
+	bool error = stage->writer && stage->error;
+	stage_free(stage);
+
+	return error? EOF : 0;
+}
+
+static bool uring_enabled(void) {
+	const char *env = getenv("HZ_IO_URING");
+
+	return !env || strcmp(env, "0") != 0;
+}
+
+static FILE *iostage_open(int fd, bool writer) {
+	io_stage_t *stage = calloc(1, sizeof(io_stage_t));
+
+	stage->fd = fd;
+	stage->writer = writer;
+	stage->use_uring = uring_enabled() && uring_init(&stage->ring);
+
+	pthread_mutex_init(&stage->lock, NULL);
+	pthread_cond_init(&stage->cond, NULL);
+
+	for (unsigned i = 0; i < IOSTAGE_CHUNKS; i++) {
+		stage->chunks[i].data = malloc(IOSTAGE_CHUNK_SIZE);
+	}
+
+	if (pthread_create(&stage->thread, NULL,
+	                   writer? writer_thread : reader_thread, stage))
+	{
+		stage_free(stage);
+		return NULL;
+	}
+
+	cookie_io_functions_t funcs = {
+		.read = writer? NULL : cookie_read,
+		.write = writer? cookie_write : NULL,
+		.seek = NULL,
+		.close = cookie_close,
+	};
+
+	FILE *ret = fopencookie(stage, writer? "w" : "r", funcs);
+
+	if (!ret) {
+		cookie_close(stage);
+		return NULL;
+	}
+
+	setvbuf(ret, NULL, _IOFBF, IOSTAGE_CHUNK_SIZE);
+	return ret;
+}
+
+FILE *iostage_open_reader(int fd) {
+	return iostage_open(fd, false);
+}
+
+FILE *iostage_open_writer(int fd) {
+	return iostage_open(fd, true);
+}
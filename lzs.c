@@ -1,28 +1,116 @@
 #include <hz/bitstream.h>
-#include <hz/queue.h>
+#include <hz/hufftree.h>
+#include <hz/lzs.h>
+#include <hz/lzsbt.h>
+#include <hz/lzsldm.h>
+#include <hz/push.h>
+#include <hz/trace.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
-#include <unistd.h>
 
-// compile-time option to toggle the very slow but low-memory encoder
-#define LZS_FAST_ENCODER 1
+// hot functions are forced inline so that the window mask and match finder
+// are constants in each of the encoder variants
+#define LZS_INLINE static inline __attribute__((always_inline))
 
-// number of matches to look for in the hashmap collision queue, when
-// LZS_FAST_ENCODER is enabled.
+// smallest window, lzs_window_size(1)
+#define LZS_MIN_WINDOW_BITS 3
+
+// decoders always use the largest window, so their mask is a constant
+#define LZS_DECODER_MASK (MAX_WINDOW_SIZE - 1)
+
+// number of matches to look for in a hash chain, when using the hash chain
+// match finder.
 //
 // TODO: maybe add an option to scale this with an option
 #define LZS_MAX_PREFIX_SEARCH 30
 
-// constants here for testing and maybe making really embedded variations
-// easier in the future
-#define MAX_WINDOW_BITS 11
-#define MAX_WINDOW_SIZE (1 << MAX_WINDOW_BITS)
+// alphabets for the huffman coded token format (`-H`), literals and the end
+// of block symbol share a table with match lengths, same idea as deflate
+#define LZS_LEN_CODES    (2 * MAX_WINDOW_BITS + 2)
+#define LZS_DIST_CODES   (2 * MAX_WINDOW_BITS)
+#define LZS_END_OF_BLOCK 256
+// returned for a bad code, or one that runs past the end of the input
+#define LZS_BAD_SYMBOL   0xffff
+#define LZS_LITLEN_CODES (LZS_END_OF_BLOCK + 1 + LZS_LEN_CODES)
+
+// with long distance matching (`lzs -L`) the literal/length alphabet has one
+// more symbol for far matches. it's followed by the distance and length
+// minus LZS_LDM_MIN_MATCH as bucket codes of these sizes and their extra
+// bits, sent verbatim since far matches are rare.
+#define LZS_FAR_SYMBOL    LZS_LITLEN_CODES
+#define LZS_FAR_DIST_BITS 6
+#define LZS_FAR_LEN_BITS  5
+
+// far matches take two buffered tokens, the first has this distance and the
+// length, the second holds the 32 bit distance
+#define LZS_FAR_TOKEN 0xffff
+
+// number of tokens buffered before a block is written out, in either format,
+// fewer under a tight memory limit
+#define LZS_BLOCK_TOKENS     0x8000
+#define LZS_MIN_BLOCK_TOKENS 0x100
+
+// block types for the huffman coded format, sent after the final block bit.
+// flush blocks are empty and followed by padding up to the next byte.
+// huffman blocks have a bit that's set when they reuse the last huffman
+// block's tables, otherwise the code lengths follow as one compact table
+// (see huff_write_lengths()), literal/length codes then distance codes.
+#define LZS_BLOCK_HUFFMAN    0
+#define LZS_BLOCK_SYNC_FLUSH 1
+#define LZS_BLOCK_FULL_FLUSH 2
+#define LZS_BLOCK_STORED     3
+
+// marker lengths in the plain format, sync and full flushes are followed by
+// padding up to the next byte
+#define LZS_MARKER_SYNC_FLUSH 2
+#define LZS_MARKER_FULL_FLUSH 3
+#define LZS_MARKER_END        4
+#define LZS_MARKER_STORED     5
+// far match, followed by the same fields as LZS_FAR_SYMBOL
+#define LZS_MARKER_FAR        6
+
+// every stream starts with a header byte. the low bits hold the long
+// distance window as a power of two, or 0 without long distance matching,
+// so decoders size their far history from it and don't need to be told
+// about `-L`. LZS_HEADER_HUFFMAN marks the huffman coded format, decoders
+// pick the format from it. streams made with a dictionary set
+// LZS_HEADER_DICT and follow the header with the dictionary's id.
+#define LZS_HEADER_BITS    8
+#define LZS_HEADER_WINDOW  0x1f
+#define LZS_HEADER_HUFFMAN 0x20
+#define LZS_HEADER_DICT    0x40
+
+// stored data in either format is padded to the next byte, then has a 16 bit
+// length and the raw bytes. huffman coded blocks are stored when that's
+// smaller, and in the plain format runs of literals are.
+#define LZS_STORED_MAX 0xffff
+
+// a huffman block's tokens can cover more than that, it's split into several
+// stored blocks if needed
+#define LZS_BLOCK_RAW (4 * LZS_STORED_MAX)
+
+// hash chains index 2 byte prefixes directly with the full 16 bits, tight
+// memory limits shrink the table down to LZS_MIN_HASH_BITS
+#define LZS_HASH_BITS     16
+#define LZS_MIN_HASH_BITS 8
+
+// after this many literals in a row the input is probably incompressible,
+// so only every (LZS_SKIP_MASK + 1)th position is searched until a match
+// turns up
+#define LZS_SKIP_AFTER 256
+#define LZS_SKIP_MASK  7
+
+// shortest match that ends a run of literals that long, shorter ones cost
+// about as much as the literals would and split up stored data
+#define LZS_SKIP_MIN_MATCH 5
 
 typedef struct lzs_window {
 	uint8_t *window;
 	uint16_t length;
+	// windows are always a power of two in size, so positions wrap with this
+	uint16_t mask;
 	uint16_t start;
 	uint16_t end;
 } lzs_window_t;
@@ -34,19 +122,23 @@ typedef struct encoder_state {
 	// offset into the file
 	size_t offset;
 
-#if LZS_FAST_ENCODER
 	// since we can effectively compress sequences as small as 2 bytes, we can
-	// use a directly indexed hashmap of all 2 byte prefixes for window lookups
-	//
-	// TODO: having a huge array here might have been a bad idea, seems to take
-	//       a pretty decent amount of time to initialize ~1MB of memory.
-	//       might be better to implement a proper hashmap, or a search tree.
-	// TODO: also look into having a fixed array of available queue nodes,
-	//       so that way we can avoid going through malloc()/free(), since
-	//       there will never be more than MAX_WINDOW_SIZE entries in the
-	//       hashmap.
-	queue_t hashmap[0x10000];
-#endif
+	// hash chains on 2 byte prefixes for window lookups. `head` holds the
+	// most recent offset + 1 for each hash (0 when empty) and `prev` links
+	// each offset to the one before it with the same hash, indexed by offset
+	// modulo the window size. only allocated for the hash chain match finder.
+	uint32_t *head;
+	uint32_t *prev;
+	unsigned hash_bits;
+
+	// binary tree match finder
+	lzs_bt_t *bt;
+
+	// long distance match finder, NULL unless it's enabled
+	lzs_ldm_t *ldm;
+
+	// literals since the last match
+	unsigned misses;
 } encoder_t;
 
 typedef struct prefix_pair {
@@ -56,127 +148,236 @@ typedef struct prefix_pair {
 	bool end_marker;
 } prefix_pair_t;
 
-static inline uint16_t encoder_hash(uint8_t a, uint8_t b) {
-	return ((uint16_t)b << 8) | a;
+// a buffered literal or match, `distance` is zero for literals
+typedef struct lzs_token {
+	uint16_t distance;
+	uint16_t value;
+} lzs_token_t;
+
+typedef struct lzs_block {
+	size_t length;
+	size_t capacity;
+	lzs_token_t *tokens;
+
+	// the bytes the tokens cover, in case the block ends up stored
+	size_t raw_length;
+	size_t raw_capacity;
+	uint8_t *raw;
+
+	// plain format blocks are only buffered so they can be stored if the
+	// tokens don't come out smaller
+	bool entropy_coded;
+	// LZS_LITLEN_CODES, plus one with long distance matching
+	unsigned litlen_codes;
+
+	// code lengths of the last huffman block, the literal/length table
+	// followed by the distance table. a block can reuse them instead of
+	// sending its own, until a full flush.
+	uint8_t lengths[LZS_LITLEN_CODES + 1 + LZS_DIST_CODES];
+	bool have_lengths;
+} lzs_block_t;
+
+// encodes `length` bytes of input, then with `drain` set encodes whatever is
+// left in the lookahead. there's one of these for each window size and
+// match finder, see ENCODER_VARIANTS below.
+typedef void (*encoder_run_t)(lzs_stream_t *stream,
+                              const uint8_t *data,
+                              size_t length,
+                              bool drain);
+
+struct lzs_stream {
+	encoder_t state;
+	bit_stream_t out;
+	encoder_run_t encode;
+
+	lzs_block_t *block;
+	const lzs_dict_t *dict;
+	// the header byte, see LZS_HEADER_BITS
+	unsigned header;
+
+	// bytes allocated for the stream, this doesn't change after creation
+	size_t memory;
+};
+
+// also the public lzs_decoder_t, everything but `out` and `dict` is kept
+// between streams
+typedef struct lzs_decoder {
+	lzs_window_t *window;
+	const lzs_dict_t *dict;
+	FILE *out;
+
+	bool entropy_coded;
+	const lzs_dict_t *const *dicts;
+	unsigned dict_count;
+
+	// decoding tables for the huffman coded format, kept for blocks that
+	// reuse them. `have_tables` is cleared by a full flush.
+	huff_decode_ent_t *litlen;
+	huff_decode_ent_t *dist;
+	bool have_tables;
+
+	// history for far matches when writing to `out`, a ring of `far_size`
+	// bytes that takes the place of the window. positions count all bytes
+	// written, `far_base` is where the history starts. `long_distance` is
+	// read from each stream's header, the ring grows to fit as long as it
+	// stays under `memory_limit`.
+	bool long_distance;
+	size_t memory_limit;
+	uint8_t *far;
+	size_t far_size;
+	uint64_t far_pos;
+	uint64_t far_base;
+
+	// output buffer for lzs_decoder_run_buffer(), NULL when writing to
+	// `out`. `dest_base` is where the history starts, after a full flush
+	uint8_t *dest;
+	size_t dest_size;
+	size_t dest_pos;
+	size_t dest_base;
+	bool corrupt;
+} decoder_t;
+
+static inline uint32_t encoder_hash(uint8_t a, uint8_t b, unsigned bits) {
+	uint32_t x = ((uint32_t)b << 8) | a;
+
+	// every prefix gets its own chain with the full table
+	return (bits == LZS_HASH_BITS)? x : (x * 0x9e3779b1u) >> (32 - bits);
+}
+
+// sizes that aren't a power of two are rounded down, 0 is the largest window
+static unsigned window_bits(unsigned size) {
+	unsigned bits = MAX_WINDOW_BITS;
+
+	if (size && size < MAX_WINDOW_SIZE) {
+		bits = 31 - __builtin_clz(size);
+		bits = (bits < LZS_MIN_WINDOW_BITS)? LZS_MIN_WINDOW_BITS : bits;
+	}
+
+	return bits;
+}
+
+static size_t window_memory(unsigned size) {
+	return sizeof(lzs_window_t) + (1 << window_bits(size));
 }
 
-lzs_window_t *window_create(uint16_t size) {
-	uint16_t realsize = (size && size < MAX_WINDOW_SIZE)? size : MAX_WINDOW_SIZE;
+static lzs_window_t *window_create(unsigned size) {
+	unsigned bits = window_bits(size);
 	lzs_window_t *ret = calloc(1, sizeof(lzs_window_t));
 
-	ret->window = calloc(1, sizeof(uint8_t[realsize]));
-	ret->length = realsize;
+	ret->length = 1 << bits;
+	ret->mask = ret->length - 1;
+	ret->window = calloc(1, sizeof(uint8_t[ret->length]));
 	ret->start = ret->end = 0;
 
 	return ret;
 }
 
-static inline uint16_t window_increment(lzs_window_t *window, uint16_t thing) {
-	return (thing + 1) % window->length;
+static void window_free(lzs_window_t *window) {
+	free(window->window);
+	free(window);
 }
 
-static inline bool window_full(lzs_window_t *window) {
-	return window_increment(window, window->end) == window->start;
+// the window functions take the mask separately from the window, so the
+// specialized encoders and the decoder can pass it in as a constant
+LZS_INLINE uint16_t window_increment(uint16_t mask, uint16_t thing) {
+	return (thing + 1) & mask;
 }
 
-static inline bool window_empty(lzs_window_t *window) {
-	return window->start == window->end;
+LZS_INLINE bool window_full(lzs_window_t *window, uint16_t mask) {
+	return window_increment(mask, window->end) == window->start;
 }
 
-static inline uint16_t window_available(lzs_window_t *window) {
-	if (window->start <= window->end) {
-		return window->end - window->start;
+LZS_INLINE bool window_empty(lzs_window_t *window) {
+	return window->start == window->end;
+}
 
-	} else {
-		return window->end + (window->length - window->start);
-	}
+LZS_INLINE uint16_t window_available(lzs_window_t *window, uint16_t mask) {
+	return (window->end - window->start) & mask;
 }
 
-static inline uint16_t window_index(lzs_window_t *window, uint16_t index) {
-	return window->window[(window->start + index) % window->length];
+LZS_INLINE uint8_t window_index(lzs_window_t *window,
+                                uint16_t mask,
+                                uint16_t index)
+{
+	return window->window[(window->start + index) & mask];
 }
 
-static inline uint8_t window_peek(lzs_window_t *window) {
+LZS_INLINE uint8_t window_peek(lzs_window_t *window) {
 	return window->window[window->start];
 }
 
-static inline uint8_t window_peek_last(lzs_window_t *window) {
-	return window->window[window->end - 1];
+LZS_INLINE uint8_t window_peek_last(lzs_window_t *window, uint16_t mask) {
+	return window->window[(window->end - 1) & mask];
 }
 
-bool window_append(lzs_window_t *window, uint8_t value) {
+LZS_INLINE bool window_append(lzs_window_t *window,
+                              uint16_t mask,
+                              uint8_t value)
+{
 	bool ret = false;
 
-	if (window_full(window)) {
+	if (window_full(window, mask)) {
 		// silently erase old value, caller needs to check availability!
-		window->start = window_increment(window, window->start);
+		window->start = window_increment(mask, window->start);
 		ret = true;
 	}
 
 	window->window[window->end] = value;
-	window->end = window_increment(window, window->end);
+	window->end = window_increment(mask, window->end);
 
 	return ret;
 }
 
-uint8_t window_remove_front(lzs_window_t *window) {
+LZS_INLINE uint8_t window_remove_front(lzs_window_t *window, uint16_t mask) {
 	if (window_empty(window)) {
 		// TODO
 		return 0;
 	}
 
 	uint8_t ret = window->window[window->start];
-	window->start = window_increment(window, window->start);
+	window->start = window_increment(mask, window->start);
 
 	return ret;
 }
 
-bool refill_input(lzs_window_t *input, FILE *fp) {
-	while (!feof(fp) && !window_full(input)) {
-		uint8_t c = fgetc(fp);
-		if (feof(fp))
-			break;
-
-		window_append(input, c);
-	}
-
-	return !window_empty(input);
-}
-
-prefix_pair_t make_end_marker(void) {
+// markers are matches with a distance of 0, the length says which one
+prefix_pair_t make_marker(uint16_t marker) {
 	return (prefix_pair_t) {
 		.index = 0,
-		.length = 0,
+		.length = marker,
 		.found = true,
 		.end_marker = true,
 	};
 }
 
-static inline uint16_t prefix_length(encoder_t *state, uint16_t index) {
+prefix_pair_t make_end_marker(void) {
+	return make_marker(LZS_MARKER_END);
+}
+
+LZS_INLINE uint16_t prefix_length(encoder_t *state,
+                                  uint16_t mask,
+                                  uint16_t index)
+{
+	// matches can't run into the input window
+	uint16_t limit = window_available(state->window, mask) - index;
+	uint16_t available = window_available(state->input, mask);
 	uint16_t ret = 0;
 
-	for (uint16_t i = 0;
-		 i < window_available(state->input)
-		 && (i + index) < window_available(state->window);
-		 i++)
-	{
-		if (window_index(state->window, i + index)
-		    == window_index(state->input, i))
-		{
-			ret++;
+	limit = (available < limit)? available : limit;
 
-		} else {
-			break;
-		}
+	while (ret < limit
+	       && window_index(state->window, mask, ret + index)
+	          == window_index(state->input, mask, ret))
+	{
+		ret++;
 	}
 
 	return ret;
 }
 
-#if !LZS_FAST_ENCODER
-// TODO: huh, this seems to compress less effectively than the fast encoder,
+// TODO: huh, this seems to compress less effectively than the hash chains,
 //       why's that?
-prefix_pair_t find_prefix(encoder_t *state) {
+LZS_INLINE prefix_pair_t find_prefix_scan(encoder_t *state, uint16_t mask) {
 	prefix_pair_t ret = (prefix_pair_t){
 		.index = 0,
 		.length = 0,
@@ -184,11 +385,11 @@ prefix_pair_t find_prefix(encoder_t *state) {
 		.end_marker = false,
 	};
 
-	for (uint16_t k = 0; k < window_available(state->window); k++) {
-		uint16_t temp_len = 0;
+	uint16_t available = window_available(state->window, mask);
 
-		temp_len = prefix_length(state, k);
-		uint16_t distance = window_available(state->window) - k;
+	for (uint16_t k = 0; k < available; k++) {
+		uint16_t temp_len = prefix_length(state, mask, k);
+		uint16_t distance = available - k;
 
 		if (temp_len > ret.length) {
 			ret.found = true;
@@ -199,8 +400,12 @@ prefix_pair_t find_prefix(encoder_t *state) {
 
 	return ret;
 }
-#else /* if LZS_FAST_ENCODER */
-prefix_pair_t find_prefix(encoder_t *state) {
+
+LZS_INLINE uint16_t offset_index(uint32_t offset, uint16_t mask) {
+	return offset & mask;
+}
+
+LZS_INLINE prefix_pair_t find_prefix_chain(encoder_t *state, uint16_t mask) {
 	prefix_pair_t ret = (prefix_pair_t){
 		.index = 0,
 		.length = 0,
@@ -208,25 +413,30 @@ prefix_pair_t find_prefix(encoder_t *state) {
 		.end_marker = false,
 	};
 
-	if (window_available(state->input) <= 1) {
+	if (window_available(state->input, mask) <= 1) {
 		return ret;
 	}
 
-	uint8_t a = window_index(state->input, 0);
-	uint8_t b = window_index(state->input, 1);
-	uint16_t hash = encoder_hash(a, b);
+	uint8_t a = window_index(state->input, mask, 0);
+	uint8_t b = window_index(state->input, mask, 1);
+	uint32_t hash = encoder_hash(a, b, state->hash_bits);
+	uint16_t available = window_available(state->window, mask);
 
 	size_t max_length = 0;
 	unsigned visited = 0;
-	for (queue_node_t *temp = state->hashmap[hash].front;
-	     temp && visited < LZS_MAX_PREFIX_SEARCH;
-	     temp = temp->next, visited++)
+	for (uint32_t next = state->head[hash];
+	     next && visited < LZS_MAX_PREFIX_SEARCH;
+	     next = state->prev[offset_index(next - 1, mask)], visited++)
 	{
-		uintptr_t offset = temp->value;
+		// chains are in order, once one entry is out of the window the
+		// rest are too
+		uint32_t distance = (uint32_t)state->offset - (next - 1);
 
-		uint16_t distance = state->offset - offset;
-		uint16_t index = window_available(state->window) - distance;
-		uint16_t length = prefix_length(state, index);
+		if (distance > available) {
+			break;
+		}
+
+		uint16_t length = prefix_length(state, mask, available - distance);
 
 		if (length > max_length) {
 			max_length = length;
@@ -240,7 +450,28 @@ prefix_pair_t find_prefix(encoder_t *state) {
 
 	return ret;
 }
-#endif
+
+LZS_INLINE prefix_pair_t find_prefix_bt(encoder_t *state) {
+	lzs_match_t matches[LZS_BT_MAX_MATCHES];
+	unsigned count = lzs_bt_find(state->bt, matches);
+
+	if (count == 0) {
+		return (prefix_pair_t){
+			.index = 0,
+			.length = 0,
+			.found = false,
+			.end_marker = false,
+		};
+	}
+
+	// greedy parsing only needs the longest one
+	return (prefix_pair_t){
+		.index = matches[count - 1].distance,
+		.length = matches[count - 1].length,
+		.found = true,
+		.end_marker = false,
+	};
+}
 
 void write_prefix(prefix_pair_t *prefix, bit_stream_t *out) {
 	bit_stream_write(out, 1);
@@ -278,206 +509,2076 @@ void write_prefix(prefix_pair_t *prefix, bit_stream_t *out) {
 	}
 }
 
+// bits write_prefix() takes
+static inline unsigned prefix_bits(uint16_t index, uint16_t length) {
+	unsigned ret = 2 + ((index < 128)? 7 : MAX_WINDOW_BITS);
+
+	if (length < 5) {
+		return ret + 2;
+	} else if (length < 8) {
+		return ret + 4;
+	}
+
+	return ret + 4 * ((length + 7) / 15 + 1);
+}
+
 void write_literal(uint8_t literal, bit_stream_t *out) {
 	bit_stream_write(out, 0);
 	bit_stream_write_bits(out, 8, literal);
 }
 
-// read functions assume you've already read the leading bit
-prefix_pair_t read_prefix(bit_stream_t *in) {
-	prefix_pair_t ret = (prefix_pair_t){
-		.length = 0,
-		.index = 0,
-		.found = true,
-		.end_marker = false,
-	};
+static inline unsigned stored_padding(size_t offset) {
+	return (8 - bitpos(offset)) & 7;
+}
+
+// size of stored data in bits, when it would start at bit `offset`
+static inline size_t stored_bits(size_t offset, size_t length) {
+	return stored_padding(offset) + 16 + 8 * length;
+}
 
-	bool is_small_offset = bit_stream_read(in);
-	ret.index = bit_stream_read_bits(in, is_small_offset? 7 : MAX_WINDOW_BITS);
-	ret.end_marker = ret.index == 0;
+// the marker or block header has to be written before this
+void write_stored(bit_stream_t *out, const uint8_t *data, size_t length) {
+	bit_stream_write_bits(out, stored_padding(out->offset), 0);
+	bit_stream_write_bits(out, 16, length);
 
-	unsigned lenbits = bit_stream_read_bits(in, 2);
+	for (size_t i = 0; i < length; i++) {
+		bit_stream_write_bits(out, 8, data[i]);
+	}
+}
+
+// plain tokens are decoded by peeking at enough bits for any token but the
+// longest matches, and classifying the token from its flag bits and length
+// code with one lookup. the length code comes after the distance, so where
+// it's read from depends on the offset size bit:
+//
+//   literal:  0, 8 bits value
+//   match:    1, 1 + 7 bits or 0 + 11 bits distance, length code
+//   length:   2 bits for 2-4, 3 then 2 bits for 5-7, or 3, 3 then 4 bit
+//             groups for longer, each 0xf group adding 15
+#define TOKEN_PEEK_BITS (2 + MAX_WINDOW_BITS + 4)
+
+typedef enum {
+	TOKEN_LITERAL,
+	TOKEN_MATCH,
+	// lengths of 8 and up, continued with 4 bit groups
+	TOKEN_LONG_MATCH,
+} token_kind_t;
+
+typedef struct token_ent {
+	uint8_t kind;
+	uint8_t dist_bits;
+	uint8_t length;
+	// bits used by the token, for long matches everything before the groups
+	uint8_t bits;
+} token_ent_t;
+
+// keys are the flag bit, the offset size bit, then 4 bits of length code
+#define TOKEN_IS_MATCH(k)  ((k) & 1)
+#define TOKEN_DIST_BITS(k) (((k) & 2)? 7 : MAX_WINDOW_BITS)
+#define TOKEN_LEN_LOW(k)   (((k) >> 2) & 3)
+#define TOKEN_LEN_HIGH(k)  (((k) >> 4) & 3)
+
+#define TOKEN_ENT(k) { \
+	.kind = !TOKEN_IS_MATCH(k)? TOKEN_LITERAL \
+	      : (TOKEN_LEN_LOW(k) < 3 || TOKEN_LEN_HIGH(k) < 3)? TOKEN_MATCH \
+	      : TOKEN_LONG_MATCH, \
+	.dist_bits = TOKEN_DIST_BITS(k), \
+	.length = (TOKEN_LEN_LOW(k) < 3)? 2 + TOKEN_LEN_LOW(k) \
+	                                : 5 + TOKEN_LEN_HIGH(k), \
+	.bits = !TOKEN_IS_MATCH(k)? 9 \
+	      : 2 + TOKEN_DIST_BITS(k) + ((TOKEN_LEN_LOW(k) < 3)? 2 : 4), \
+}
 
-	if (lenbits < 3) {
-		ret.length = 2 + lenbits;
+#define TOKEN_ENT4(k) \
+	TOKEN_ENT(k), TOKEN_ENT(k + 1), TOKEN_ENT(k + 2), TOKEN_ENT(k + 3)
+#define TOKEN_ENT16(k) \
+	TOKEN_ENT4(k), TOKEN_ENT4(k + 4), TOKEN_ENT4(k + 8), TOKEN_ENT4(k + 12)
 
-	} else {
-		lenbits = bit_stream_read_bits(in, 2);
+static const token_ent_t token_table[64] = {
+	TOKEN_ENT16(0), TOKEN_ENT16(16), TOKEN_ENT16(32), TOKEN_ENT16(48),
+};
 
-		if (lenbits < 3) {
-			ret.length = 5 + lenbits;
+LZS_INLINE const token_ent_t *token_lookup(uint32_t word) {
+	unsigned shift = (word & 2)? 2 + 7 : 2 + MAX_WINDOW_BITS;
+	unsigned key = (word & 3) | (((word >> shift) & 0xf) << 2);
 
-		} else {
-			unsigned c = 1;
+	return token_table + key;
+}
+
+// slow path for the 4 bit groups of long matches. reads past the end of the
+// input give zeros, which ends the groups, so a memory stream that runs out
+// here is left overrun rather than stopping at the end.
+static uint16_t read_long_length(bit_stream_t *in) {
+	unsigned c = 1;
+	unsigned lenbits;
+
+	do {
+		lenbits = bit_stream_read_bits(in, 4);
+		c += lenbits == 0xf;
+	} while (lenbits == 0xf);
+
+	return ((c * 15) - 7) + lenbits;
+}
+
+// maps a value onto a log-scale bucket, each power of two is split into two
+// codes with the remaining low bits sent verbatim (same as deflate distances)
+static inline unsigned bucket_code(uint32_t value) {
+	if (value < 4) {
+		return value;
+	}
+
+	unsigned top = 31 - __builtin_clz(value);
+	return 2 * top + ((value >> (top - 1)) & 1);
+}
 
-			do {
-				lenbits = bit_stream_read_bits(in, 4);
-				c += lenbits == 0xf;
-			} while (lenbits == 0xf);
+static inline unsigned bucket_extra_bits(unsigned code) {
+	return (code < 4)? 0 : (code >> 1) - 1;
+}
+
+static inline uint32_t bucket_base(unsigned code) {
+	return (code < 4)? code : (2 | (code & 1)) << ((code >> 1) - 1);
+}
+
+// fields after a far match symbol or marker
+static void write_far(bit_stream_t *out, uint32_t distance, uint32_t length) {
+	unsigned distcode = bucket_code(distance - 1);
+	unsigned lencode = bucket_code(length - LZS_LDM_MIN_MATCH);
+
+	bit_stream_write_bits(out, LZS_FAR_DIST_BITS, distcode);
+	bit_stream_write_bits(out, bucket_extra_bits(distcode),
+	                      distance - 1 - bucket_base(distcode));
+	bit_stream_write_bits(out, LZS_FAR_LEN_BITS, lencode);
+	bit_stream_write_bits(out, bucket_extra_bits(lencode),
+	                      length - LZS_LDM_MIN_MATCH - bucket_base(lencode));
+}
+
+static inline unsigned far_bits(uint32_t distance, uint32_t length) {
+	return LZS_FAR_DIST_BITS + LZS_FAR_LEN_BITS
+	     + bucket_extra_bits(bucket_code(distance - 1))
+	     + bucket_extra_bits(bucket_code(length - LZS_LDM_MIN_MATCH));
+}
+
+static void read_far(bit_stream_t *in, uint32_t *distance, uint32_t *length) {
+	unsigned distcode = bit_stream_read_bits(in, LZS_FAR_DIST_BITS);
+	*distance = 1 + bucket_base(distcode)
+	          + bit_stream_read_bits(in, bucket_extra_bits(distcode));
 
-			ret.length = ((c * 15) - 7) + lenbits;
+	unsigned lencode = bit_stream_read_bits(in, LZS_FAR_LEN_BITS);
+	*length = LZS_LDM_MIN_MATCH + bucket_base(lencode)
+	        + bit_stream_read_bits(in, bucket_extra_bits(lencode));
+}
+
+// bits the block's symbols take with these code lengths, not counting far
+// matches. SIZE_MAX if one of them has no code.
+static size_t block_symbol_bits(const uint32_t *litlen_freqs,
+                                const uint32_t *dist_freqs,
+                                const uint8_t *lengths,
+                                unsigned litlen_codes)
+{
+	const uint8_t *dist_lengths = lengths + litlen_codes;
+	size_t ret = 0;
+
+	for (unsigned i = 0; i < litlen_codes; i++) {
+		unsigned extra = (i > LZS_END_OF_BLOCK && i != LZS_FAR_SYMBOL)
+			? bucket_extra_bits(i - LZS_END_OF_BLOCK - 1) : 0;
+
+		if (litlen_freqs[i] && !lengths[i]) {
+			return SIZE_MAX;
+		}
+
+		ret += (size_t)litlen_freqs[i] * (lengths[i] + extra);
+	}
+
+	for (unsigned i = 0; i < LZS_DIST_CODES; i++) {
+		if (dist_freqs[i] && !dist_lengths[i]) {
+			return SIZE_MAX;
 		}
+
+		ret += (size_t)dist_freqs[i] * (dist_lengths[i] + bucket_extra_bits(i));
 	}
 
 	return ret;
 }
 
-uint8_t read_literal(bit_stream_t *in) {
-	//return bit_stream_read_bits(in, 8)
-	uint8_t ret = 0;
+// a run of literals in the plain format, stored when that's cheaper than a
+// flag bit each. writes it to `out` unless that's NULL, and returns the
+// offset it ends at when starting at `offset`.
+static size_t plain_literals(bit_stream_t *out, size_t offset,
+                             const uint8_t *data, size_t count)
+{
+	prefix_pair_t marker = make_marker(LZS_MARKER_STORED);
+	unsigned marker_bits = prefix_bits(0, LZS_MARKER_STORED);
+	size_t stored = marker_bits + stored_bits(offset + marker_bits, count);
+
+	if (stored < 9 * count) {
+		if (out) {
+			write_prefix(&marker, out);
+			write_stored(out, data, count);
+		}
+
+		return offset + stored;
+	}
 
-	for (unsigned i = 0; i < 8; i++) {
-		ret |= bit_stream_read(in) << i;
+	for (size_t i = 0; out && i < count; i++) {
+		write_literal(data[i], out);
 	}
 
-	return ret;
+	return offset + 9 * count;
 }
 
-static inline void encoder_shift(encoder_t *state) {
-#if LZS_FAST_ENCODER
-	uint8_t a = window_peek(state->window);
-	uint8_t x = window_peek_last(state->window);
-	uint8_t y = window_peek(state->input);
-	uint16_t new_hash = encoder_hash(x, y);
-#endif
+// same as plain_literals() for all of the block's tokens
+static size_t plain_tokens(const lzs_block_t *block, bit_stream_t *out,
+                           size_t offset)
+{
+	const uint8_t *raw = block->raw;
 
-	bool wrap = window_append(state->window, window_remove_front(state->input));
-	state->offset += 1;
+	for (size_t i = 0; i < block->length;) {
+		const lzs_token_t *token = block->tokens + i;
+
+		if (token->distance == 0) {
+			size_t count = 1;
+
+			while (i + count < block->length && count < LZS_STORED_MAX
+			       && token[count].distance == 0)
+			{
+				count++;
+			}
+
+			offset = plain_literals(out, offset, raw, count);
+			raw += count;
+			i += count;
+			continue;
+		}
+
+		if (token->distance == LZS_FAR_TOKEN) {
+			prefix_pair_t marker = make_marker(LZS_MARKER_FAR);
+			uint32_t distance = token[1].distance | (uint32_t)token[1].value << 16;
+
+			if (out) {
+				write_prefix(&marker, out);
+				write_far(out, distance, token->value);
+			}
+
+			offset += prefix_bits(0, LZS_MARKER_FAR) + far_bits(distance, token->value);
+			raw += token->value;
+			i += 2;
+			continue;
+		}
+
+		prefix_pair_t prefix = {
+			.index = token->distance,
+			.length = token->value,
+			.found = true,
+		};
 
-#if LZS_FAST_ENCODER
-	if (wrap) {
-		uint8_t b = window_peek(state->window);
-		uint16_t hash = encoder_hash(a, b);
+		if (out) {
+			write_prefix(&prefix, out);
+		}
+
+		offset += prefix_bits(token->distance, token->value);
+		raw += token->value;
+		i++;
+	}
+
+	return offset;
+}
+
+// plain format blocks are stored whole when the tokens aren't smaller, so
+// input that doesn't compress only grows by the markers
+static void plain_block_write(lzs_block_t *block, bit_stream_t *out) {
+	uint64_t start = trace_begin();
+	size_t raw_length = block->raw_length;
+	size_t coded = plain_tokens(block, NULL, out->offset);
+	size_t stored = out->offset;
+	unsigned marker_bits = prefix_bits(0, LZS_MARKER_STORED);
 
-		queue_pop_back(&state->hashmap[hash]);
+	for (size_t i = 0; i < raw_length; i += LZS_STORED_MAX) {
+		size_t left = raw_length - i;
+		size_t n = (left < LZS_STORED_MAX)? left : LZS_STORED_MAX;
+
+		stored += marker_bits + stored_bits(stored + marker_bits, n);
 	}
 
-	// new_hash is only valid if there was something in the window to hash
-	if (window_available(state->window) > 1) {
-		// TODO: add `value` functions so we don't have to cast to a pointer
-		queue_push_front(&state->hashmap[new_hash], (void*)(state->offset - 2));
+	if (stored < coded) {
+		prefix_pair_t marker = make_marker(LZS_MARKER_STORED);
+
+		for (size_t i = 0; i < raw_length; i += LZS_STORED_MAX) {
+			size_t left = raw_length - i;
+			size_t n = (left < LZS_STORED_MAX)? left : LZS_STORED_MAX;
+
+			write_prefix(&marker, out);
+			write_stored(out, block->raw + i, n);
+		}
+
+	} else {
+		plain_tokens(block, out, out->offset);
 	}
-#endif
+
+	block->length = block->raw_length = 0;
+	trace_end("lzs", "block emit", start, raw_length);
 }
 
-void encode(FILE *fp, unsigned window_size) {
-	bit_stream_t out;
-	bit_stream_init_write(&out, stdout);
+// huffman blocks end with their own end of block, the plain format has a
+// marker for the end of the stream instead so `final` is ignored
+void block_write(lzs_block_t *block, bit_stream_t *out, bool final) {
+	if (!block->entropy_coded) {
+		plain_block_write(block, out);
+		return;
+	}
 
-	encoder_t state;
-	memset(&state, 0, sizeof(encoder_t));
+	uint64_t start = trace_begin();
+	unsigned litlen_codes = block->litlen_codes;
+	unsigned table_size = litlen_codes + LZS_DIST_CODES;
+	uint32_t litlen_freqs[LZS_LITLEN_CODES + 1];
+	uint32_t dist_freqs[LZS_DIST_CODES];
+	uint8_t lengths[LZS_LITLEN_CODES + 1 + LZS_DIST_CODES];
+	huff_code_t litlen[LZS_LITLEN_CODES + 1];
+	huff_code_t dist[LZS_DIST_CODES];
+	size_t far_coded = 0;
 
-	state.input  = window_create(window_size);
-	state.window = window_create(window_size);
+	memset(litlen_freqs, 0, sizeof(litlen_freqs));
+	memset(dist_freqs, 0, sizeof(dist_freqs));
 
-	while (refill_input(state.input, fp)) {
-		prefix_pair_t prefix = find_prefix(&state);
+	for (size_t i = 0; i < block->length; i++) {
+		lzs_token_t *token = block->tokens + i;
 
-		if (prefix.found && prefix.length > 1) {
-			write_prefix(&prefix, &out);
+		if (token->distance == 0) {
+			litlen_freqs[token->value]++;
 
-			for (unsigned k = 0; k < prefix.length; k++) {
-				encoder_shift(&state);
-			}
+		} else if (token->distance == LZS_FAR_TOKEN) {
+			uint32_t distance = token[1].distance | (uint32_t)token[1].value << 16;
+
+			litlen_freqs[LZS_FAR_SYMBOL]++;
+			far_coded += far_bits(distance, token->value);
+			i++;
 
 		} else {
-			write_literal(window_peek(state.input), &out);
-			encoder_shift(&state);
+			unsigned lencode = bucket_code(token->value - 2);
+			litlen_freqs[LZS_END_OF_BLOCK + 1 + lencode]++;
+			dist_freqs[bucket_code(token->distance - 1)]++;
+		}
+	}
+
+	litlen_freqs[LZS_END_OF_BLOCK] = 1;
+
+	huff_lengths_from_freqs(litlen_freqs, litlen_codes, lengths,
+	                        HUFF_MAX_CODE_BITS);
+	huff_lengths_from_freqs(dist_freqs, LZS_DIST_CODES, lengths + litlen_codes,
+	                        HUFF_MAX_CODE_BITS);
+
+	// the code lengths give the exact size of the coded block. a block that
+	// sends its own tables pays for them, reusing the last block's only
+	// costs the flag bit but may code worse.
+	size_t coded = 4 + huff_lengths_bits(lengths, table_size) + far_coded
+	             + block_symbol_bits(litlen_freqs, dist_freqs, lengths, litlen_codes);
+	bool reuse = false;
+
+	if (block->have_lengths) {
+		size_t bits = block_symbol_bits(litlen_freqs, dist_freqs, block->lengths,
+		                                litlen_codes);
+
+		if (bits != SIZE_MAX && 4 + bits + far_coded <= coded) {
+			coded = 4 + bits + far_coded;
+			reuse = true;
+		}
+	}
+
+	size_t chunks = 1 + block->raw_length / LZS_STORED_MAX;
+	size_t raw_length = block->raw_length;
+
+	trace_end("lzs", "block tables", start, raw_length);
+	start = trace_begin();
+
+	// compare against storing the bytes the tokens cover
+	if (stored_bits(out->offset + 3, block->raw_length) + 27 * chunks <= coded) {
+		size_t i = 0;
+
+		do {
+			size_t left = block->raw_length - i;
+			size_t n = (left < LZS_STORED_MAX)? left : LZS_STORED_MAX;
+
+			bit_stream_write(out, final && n == left);
+			bit_stream_write_bits(out, 2, LZS_BLOCK_STORED);
+			write_stored(out, block->raw + i, n);
+			i += n;
+		} while (i < block->raw_length);
+
+		block->length = block->raw_length = 0;
+		trace_end("lzs", "block stored", start, raw_length);
+		return;
+	}
+
+	bit_stream_write(out, final);
+	bit_stream_write_bits(out, 2, LZS_BLOCK_HUFFMAN);
+	bit_stream_write(out, reuse);
+
+	if (!reuse) {
+		huff_write_lengths(out, lengths, table_size);
+		memcpy(block->lengths, lengths, table_size);
+		block->have_lengths = true;
+	}
+
+	huff_canonical_codes(block->lengths, litlen_codes, litlen);
+	huff_canonical_codes(block->lengths + litlen_codes, LZS_DIST_CODES, dist);
+
+	for (size_t i = 0; i < block->length; i++) {
+		lzs_token_t *token = block->tokens + i;
+
+		if (token->distance == 0) {
+			huff_code_t *code = litlen + token->value;
+			bit_stream_write_bits(out, code->length, code->code);
+			continue;
 		}
+
+		if (token->distance == LZS_FAR_TOKEN) {
+			huff_code_t *code = litlen + LZS_FAR_SYMBOL;
+			uint32_t distance = token[1].distance | (uint32_t)token[1].value << 16;
+
+			bit_stream_write_bits(out, code->length, code->code);
+			write_far(out, distance, token->value);
+			i++;
+			continue;
+		}
+
+		unsigned length = token->value - 2;
+		unsigned lencode = bucket_code(length);
+		huff_code_t *code = litlen + LZS_END_OF_BLOCK + 1 + lencode;
+
+		bit_stream_write_bits(out, code->length, code->code);
+		bit_stream_write_bits(out, bucket_extra_bits(lencode),
+		                      length - bucket_base(lencode));
+
+		unsigned distance = token->distance - 1;
+		unsigned distcode = bucket_code(distance);
+		code = dist + distcode;
+
+		bit_stream_write_bits(out, code->length, code->code);
+		bit_stream_write_bits(out, bucket_extra_bits(distcode),
+		                      distance - bucket_base(distcode));
 	}
 
-	prefix_pair_t end = make_end_marker();
-	write_prefix(&end, &out);
-	bit_stream_flush(&out);
+	huff_code_t *end = litlen + LZS_END_OF_BLOCK;
+	bit_stream_write_bits(out, end->length, end->code);
+
+	block->length = block->raw_length = 0;
+	trace_end("lzs", "block emit", start, raw_length);
 }
 
-void decode(FILE *fp) {
-	bit_stream_t in;
-	memset(&in, 0, sizeof(bit_stream_t));
-	in.fp = fp;
+static inline
+void block_push(lzs_block_t *block, bit_stream_t *out, lzs_token_t token) {
+	block->tokens[block->length++] = token;
 
-	lzs_window_t *window = window_create(0);
+	if (block->length == block->capacity) {
+		block_write(block, out, false);
+	}
+}
 
-	while (!bit_stream_end(&in)) {
-		bool is_literal = !bit_stream_read(&in);
+static inline
+uint16_t block_read_symbol(bit_stream_t *in, huff_decode_ent_t *table) {
+	huff_decode_ent_t *ent = table + bit_stream_peek_bits(in, HUFF_MAX_CODE_BITS);
 
-		if (is_literal) {
-			uint8_t value = read_literal(&in);
-			putchar(value);
-			window_append(window, value);
+	// peeking refilled the buffer if it could, so the input really ends
+	// before the code does
+	if (!ent->length || in->offset + ent->length > in->available) {
+		return LZS_BAD_SYMBOL;
+	}
 
-		} else {
-			prefix_pair_t prefix = read_prefix(&in);
-			uint16_t index = window_available(window) - prefix.index;
+	bit_stream_skip_bits(in, ent->length);
+	return ent->symbol;
+}
 
-			if (prefix.end_marker) {
-				break;
-			}
+LZS_INLINE void encoder_append(encoder_t *state, uint16_t mask, uint8_t value) {
+	window_append(state->input, mask, value);
 
-			for (unsigned i = 0; i < prefix.length; i++) {
-				putchar(window_index(window, index + i));
-			}
+	if (state->bt) {
+		lzs_bt_append(state->bt, value);
+	}
 
-			unsigned adjust = 0;
-			for (unsigned i = 0; i < prefix.length; i++) {
-				uint8_t value = window_index(window, i + index - adjust);
-				adjust += window_append(window, value);
-			}
+	if (state->ldm) {
+		lzs_ldm_append(state->ldm, value);
+	}
+}
+
+LZS_INLINE void encoder_shift(encoder_t *state,
+                              uint16_t mask,
+                              lzs_match_finder_t finder)
+{
+	if (finder != LZS_MATCH_HASH_CHAIN) {
+		window_append(state->window, mask,
+		              window_remove_front(state->input, mask));
+		state->offset += 1;
+
+		if (finder == LZS_MATCH_BINARY_TREE) {
+			lzs_bt_advance(state->bt, 1);
 		}
+
+		return;
+	}
+
+	uint8_t x = window_peek_last(state->window, mask);
+	uint8_t y = window_peek(state->input);
+	uint32_t new_hash = encoder_hash(x, y, state->hash_bits);
+
+	window_append(state->window, mask, window_remove_front(state->input, mask));
+	state->offset += 1;
+
+	// new_hash is only valid if there was something in the window to hash,
+	// entries that fall out of the window are left to go stale
+	if (window_available(state->window, mask) > 1) {
+		uint32_t offset = state->offset - 2;
+
+		state->prev[offset_index(offset, mask)] = state->head[new_hash];
+		state->head[new_hash] = offset + 1;
 	}
 }
 
-static unsigned translate_compression_level(int level) {
-	// compression level from 1-9, same as zip
-	return 1 << (2 + level);
+static lzs_match_finder_t encoder_finder(encoder_t *state) {
+	return state->bt?      LZS_MATCH_BINARY_TREE
+	     : state->head?    LZS_MATCH_HASH_CHAIN
+	     :                 LZS_MATCH_SCAN;
 }
 
-void print_help(void) {
-	puts("Usage: lzs [-edh] [-c level]\n"
-	     "\t-h: print this help\n"
-	     "\t-e: encode input from stdin, the default if no options are given\n"
-	     "\t-d: decode input from stdin\n"
-	     "\t-c: specify compression level for the encoder, ranging from 1-9\n"
-	     "\t    with 1 being the lowest and 9 being the highest.");
+// runs dictionary content through the window and match finder without
+// emitting anything, so the first bytes of input have something to match
+static void encoder_preload(encoder_t *state, const lzs_dict_t *dict) {
+	uint16_t mask = state->window->mask;
+	lzs_match_finder_t finder = encoder_finder(state);
+
+	for (unsigned i = 0; i < dict->length; i++) {
+		encoder_append(state, mask, dict->data[i]);
+		encoder_shift(state, mask, finder);
+	}
 }
 
-int main(int argc, char *argv[]) {
-	unsigned window_size = 0;
-	bool do_encode = true;
+// forgets all history, the input window is expected to be empty. this
+// doesn't touch the match finder tables: offsets keep counting up, so every
+// entry from before now is further back than the (empty) window and gets
+// skipped as stale. that keeps resetting cheap for lots of small inputs.
+static void encoder_clear(encoder_t *state) {
+	if (state->bt) {
+		lzs_bt_reset(state->bt);
+	}
 
-	for (int opt; (opt = getopt(argc, argv, "edhc:")) != -1;) {
-		switch (opt) {
-			case 'e':
-				do_encode = true;
-				break;
+	if (state->ldm) {
+		lzs_ldm_reset(state->ldm);
+	}
 
-			case 'd':
-				do_encode = false;
-				break;
+	state->window->start = state->window->end = 0;
+	state->misses = 0;
+}
 
-			case 'c':
-				window_size = translate_compression_level(atoi(optarg));
-				break;
+LZS_INLINE void stream_emit_literal(lzs_stream_t *stream, uint8_t value) {
+	block_push(stream->block, &stream->out, (lzs_token_t){
+		.distance = 0,
+		.value = value,
+	});
+}
 
-			case 'h':
-				print_help();
-				exit(0);
-				break;
+LZS_INLINE void stream_emit_match(lzs_stream_t *stream, prefix_pair_t *prefix) {
+	block_push(stream->block, &stream->out, (lzs_token_t){
+		.distance = prefix->index,
+		.value = prefix->length,
+	});
+}
 
-			default:
-				print_help();
-				exit(EXIT_FAILURE);
-				break;
+LZS_INLINE void stream_emit_far(lzs_stream_t *stream,
+                                const lzs_far_match_t *match)
+{
+	block_push(stream->block, &stream->out, (lzs_token_t){
+		.distance = LZS_FAR_TOKEN,
+		.value = match->length,
+	});
+	block_push(stream->block, &stream->out, (lzs_token_t){
+		.distance = match->distance & 0xffff,
+		.value = match->distance >> 16,
+	});
+}
+
+// keeps a copy of the next `length` bytes of input in the block, so that it
+// can be stored if it doesn't compress
+LZS_INLINE void stream_block_raw(lzs_stream_t *stream,
+                                 uint16_t mask,
+                                 uint16_t length)
+{
+	lzs_block_t *block = stream->block;
+
+	if (block->raw_length + length > block->raw_capacity) {
+		block_write(block, &stream->out, false);
+	}
+
+	for (unsigned i = 0; i < length; i++) {
+		block->raw[block->raw_length++] = window_index(stream->state.input,
+		                                               mask, i);
+	}
+}
+
+// encodes one token from the front of the input window
+LZS_INLINE void encoder_step(lzs_stream_t *stream,
+                             uint16_t mask,
+                             lzs_match_finder_t finder)
+{
+	encoder_t *state = &stream->state;
+	prefix_pair_t prefix = { .found = false };
+	bool skipping = state->misses >= LZS_SKIP_AFTER;
+	lzs_far_match_t far;
+
+	// repeats from beyond the window come first, the match finders below
+	// can't see them
+	if (state->ldm
+	    && lzs_ldm_find(state->ldm, window_available(state->input, mask), &far))
+	{
+		lzs_block_t *block = stream->block;
+
+		// both tokens have to end up in the same block
+		if (block->length + 2 > block->capacity) {
+			block_write(block, &stream->out, false);
 		}
+
+		stream_block_raw(stream, mask, far.length);
+
+		stream_emit_far(stream, &far);
+		state->misses = 0;
+
+		for (unsigned k = 0; k < far.length; k++) {
+			encoder_shift(state, mask, finder);
+		}
+
+		return;
+	}
+
+	if (skipping && (state->misses & LZS_SKIP_MASK)) {
+		// not searching here, positions the tree match finder skips
+		// don't need to be inserted either
+		if (finder == LZS_MATCH_BINARY_TREE) {
+			lzs_bt_skip(state->bt);
+		}
+
+	} else switch (finder) {
+		case LZS_MATCH_HASH_CHAIN:  prefix = find_prefix_chain(state, mask); break;
+		case LZS_MATCH_BINARY_TREE: prefix = find_prefix_bt(state); break;
+		default:                    prefix = find_prefix_scan(state, mask); break;
 	}
 
-	// TODO: filename
+	unsigned min_length = skipping? LZS_SKIP_MIN_MATCH : 2;
+
+	if (prefix.found && prefix.length >= min_length) {
+		stream_block_raw(stream, mask, prefix.length);
+
+		stream_emit_match(stream, &prefix);
+		state->misses = 0;
+
+		for (unsigned k = 0; k < prefix.length; k++) {
+			encoder_shift(state, mask, finder);
+		}
 
-	if (do_encode) {
-		encode(stdin, window_size);
 	} else {
-		decode(stdin);
+		stream_block_raw(stream, mask, 1);
+
+		stream_emit_literal(stream, window_peek(state->input));
+		state->misses++;
+		encoder_shift(state, mask, finder);
+	}
+}
+
+LZS_INLINE void encoder_run(lzs_stream_t *stream,
+                            const uint8_t *data,
+                            size_t length,
+                            bool drain,
+                            uint16_t mask,
+                            lzs_match_finder_t finder)
+{
+	encoder_t *state = &stream->state;
+
+	// tokens are only encoded with a full lookahead, so that the output is
+	// the same no matter how the input is split up
+	for (size_t i = 0; i < length; i++) {
+		while (window_full(state->input, mask)) {
+			encoder_step(stream, mask, finder);
+		}
+
+		encoder_append(state, mask, data[i]);
+	}
+
+	while (drain && !window_empty(state->input)) {
+		encoder_step(stream, mask, finder);
+	}
+}
+
+// encoder_run() with the window mask and match finder as constants, one for
+// each window size and match finder. the one used is picked when the stream
+// is created.
+#define ENCODER_VARIANT(bits, name, finder) \
+	static void encoder_run_##bits##_##name(lzs_stream_t *stream, \
+	                                        const uint8_t *data, \
+	                                        size_t length, \
+	                                        bool drain) \
+	{ \
+		encoder_run(stream, data, length, drain, (1 << bits) - 1, finder); \
+	}
+
+#define ENCODER_VARIANTS(bits) \
+	ENCODER_VARIANT(bits, chain, LZS_MATCH_HASH_CHAIN) \
+	ENCODER_VARIANT(bits, tree,  LZS_MATCH_BINARY_TREE) \
+	ENCODER_VARIANT(bits, scan,  LZS_MATCH_SCAN)
+
+#define ENCODER_ENTRY(bits) \
+	[bits] = { \
+		[LZS_MATCH_HASH_CHAIN]  = encoder_run_##bits##_chain, \
+		[LZS_MATCH_BINARY_TREE] = encoder_run_##bits##_tree, \
+		[LZS_MATCH_SCAN]        = encoder_run_##bits##_scan, \
+	}
+
+ENCODER_VARIANTS(3)
+ENCODER_VARIANTS(4)
+ENCODER_VARIANTS(5)
+ENCODER_VARIANTS(6)
+ENCODER_VARIANTS(7)
+ENCODER_VARIANTS(8)
+ENCODER_VARIANTS(9)
+ENCODER_VARIANTS(10)
+ENCODER_VARIANTS(11)
+
+static const encoder_run_t encoders[MAX_WINDOW_BITS + 1][LZS_MATCH_FINDERS] = {
+	ENCODER_ENTRY(3),
+	ENCODER_ENTRY(4),
+	ENCODER_ENTRY(5),
+	ENCODER_ENTRY(6),
+	ENCODER_ENTRY(7),
+	ENCODER_ENTRY(8),
+	ENCODER_ENTRY(9),
+	ENCODER_ENTRY(10),
+	ENCODER_ENTRY(11),
+};
+
+// sizes of everything an encoder allocates, picked to fit the memory limit
+typedef struct encoder_config {
+	unsigned window_size;
+	lzs_match_finder_t finder;
+	unsigned hash_bits;
+	bool entropy_coded;
+	size_t block_tokens;
+	// 0 without long distance matching
+	size_t long_window;
+} encoder_config_t;
+
+static size_t block_raw_capacity(size_t tokens) {
+	// about as many bytes per token as the default block size allows
+	return tokens * LZS_BLOCK_RAW / LZS_BLOCK_TOKENS;
+}
+
+static size_t encoder_memory(const encoder_config_t *config) {
+	unsigned window_size = 1 << window_bits(config->window_size);
+	size_t ret = sizeof(lzs_stream_t) + 2 * window_memory(window_size)
+	           + sizeof(lzs_block_t)
+	           + sizeof(lzs_token_t[config->block_tokens])
+	           + block_raw_capacity(config->block_tokens);
+
+	if (config->finder == LZS_MATCH_BINARY_TREE) {
+		ret += lzs_bt_memory(window_size);
+
+	} else if (config->finder == LZS_MATCH_HASH_CHAIN) {
+		ret += sizeof(uint32_t[1 << config->hash_bits])
+		     + sizeof(uint32_t[window_size]);
+	}
+
+	if (config->long_window) {
+		ret += lzs_ldm_memory(config->long_window);
 	}
 
-	return 0;
+	return ret;
+}
+
+// cuts down whatever costs the least compression next, returns false when
+// there's nothing left to cut
+static bool encoder_shrink(encoder_config_t *config) {
+	bool chain = config->finder == LZS_MATCH_HASH_CHAIN;
+
+	// the long window is much bigger than anything else. it can't be turned
+	// off though, that changes the format.
+	if (config->long_window
+	    && lzs_ldm_window(config->long_window) > LZS_LDM_MIN_WINDOW)
+	{
+		config->long_window = lzs_ldm_window(config->long_window) / 2;
+
+	} else if (chain && config->hash_bits > 12) {
+		config->hash_bits--;
+
+	} else if (config->block_tokens > LZS_MIN_BLOCK_TOKENS) {
+		config->block_tokens /= 2;
+
+	} else if (config->finder == LZS_MATCH_BINARY_TREE) {
+		config->finder = LZS_MATCH_HASH_CHAIN;
+
+	} else if (chain && config->hash_bits > LZS_MIN_HASH_BITS) {
+		config->hash_bits--;
+
+	} else if (window_bits(config->window_size) > LZS_MIN_WINDOW_BITS) {
+		config->window_size = (1 << window_bits(config->window_size)) / 2;
+
+	} else if (chain) {
+		// the scan finder doesn't need anything besides the windows
+		config->finder = LZS_MATCH_SCAN;
+
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+static bool encoder_configure(const lzs_params_t *params,
+                              encoder_config_t *config)
+{
+	*config = (encoder_config_t){
+		.window_size = 1 << window_bits(params->window_size),
+		.finder = params->match_finder,
+		.hash_bits = LZS_HASH_BITS,
+		.entropy_coded = params->entropy_coded,
+		.block_tokens = LZS_BLOCK_TOKENS,
+		.long_window = params->long_window,
+	};
+
+	while (params->memory_limit
+	       && encoder_memory(config) > params->memory_limit)
+	{
+		if (!encoder_shrink(config)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+size_t lzs_encoder_memory(const lzs_params_t *params) {
+	encoder_config_t config;
+	return encoder_configure(params, &config)? encoder_memory(&config) : 0;
+}
+
+static void stream_start(lzs_stream_t *stream, FILE *out) {
+	bit_stream_init_write(&stream->out, out);
+	bit_stream_write_bits(&stream->out, LZS_HEADER_BITS, stream->header);
+
+	if (stream->dict) {
+		bit_stream_write_bits(&stream->out, 32, stream->dict->id);
+		encoder_preload(&stream->state, stream->dict);
+	}
+}
+
+lzs_stream_t *lzs_stream_create(FILE *out, const lzs_params_t *params) {
+	encoder_config_t config;
+
+	if (!encoder_configure(params, &config)) {
+		fprintf(stderr, "error: memory limit of %zu bytes is too small, "
+		                "the encoder needs at least %zu\n",
+		        params->memory_limit, encoder_memory(&config));
+		return NULL;
+	}
+
+	lzs_stream_t *ret = calloc(1, sizeof(lzs_stream_t));
+	lzs_match_finder_t finder = config.finder;
+
+	ret->memory = encoder_memory(&config);
+
+	size_t raw = block_raw_capacity(config.block_tokens);
+
+	ret->block = calloc(1, sizeof(lzs_block_t));
+	ret->block->entropy_coded = config.entropy_coded;
+	ret->block->capacity = config.block_tokens;
+	ret->block->tokens = calloc(config.block_tokens, sizeof(lzs_token_t));
+	ret->block->raw_capacity = raw;
+	ret->block->raw = malloc(raw);
+	ret->block->litlen_codes = LZS_LITLEN_CODES + !!config.long_window;
+
+	ret->state.input  = window_create(config.window_size);
+	ret->state.window = window_create(config.window_size);
+
+	if (finder == LZS_MATCH_BINARY_TREE) {
+		ret->state.bt = lzs_bt_create(ret->state.window->length);
+
+	} else if (finder == LZS_MATCH_HASH_CHAIN) {
+		ret->state.hash_bits = config.hash_bits;
+		ret->state.head = calloc(1 << config.hash_bits, sizeof(uint32_t));
+		ret->state.prev = calloc(ret->state.window->length, sizeof(uint32_t));
+	}
+
+	if (config.long_window) {
+		ret->state.ldm = lzs_ldm_create(config.long_window,
+		                                ret->state.window->length);
+		ret->header = __builtin_ctzl(lzs_ldm_window(config.long_window));
+	}
+
+	if (config.entropy_coded) {
+		ret->header |= LZS_HEADER_HUFFMAN;
+	}
+
+	unsigned bits = __builtin_ctz(ret->state.window->length);
+	ret->encode = encoders[bits][finder];
+
+	// the encoder always uses the first dictionary given
+	ret->dict = (params->dict_count > 0)? params->dicts[0] : NULL;
+
+	if (ret->dict) {
+		ret->header |= LZS_HEADER_DICT;
+	}
+
+	stream_start(ret, out);
+	return ret;
+}
+
+void lzs_stream_reset(lzs_stream_t *stream, FILE *out) {
+	// anything still in the lookahead or in a block is dropped
+	stream->state.input->start = stream->state.input->end = 0;
+	encoder_clear(&stream->state);
+
+	stream->block->length = stream->block->raw_length = 0;
+	stream->block->have_lengths = false;
+	stream_start(stream, out);
+}
+
+void lzs_stream_write(lzs_stream_t *stream, const uint8_t *data, size_t length) {
+	uint64_t start = trace_begin();
+	stream->encode(stream, data, length, false);
+	trace_end("lzs", "encode", start, length);
+}
+
+void lzs_stream_flush(lzs_stream_t *stream, lzs_flush_t mode) {
+	bool full = mode == LZS_FLUSH_FULL;
+	bit_stream_t *out = &stream->out;
+
+	stream->encode(stream, NULL, 0, true);
+
+	if (stream->block->length > 0) {
+		block_write(stream->block, out, false);
+	}
+
+	if (stream->block->entropy_coded) {
+		bit_stream_write(out, false);
+		bit_stream_write_bits(out, 2, full? LZS_BLOCK_FULL_FLUSH
+		                                  : LZS_BLOCK_SYNC_FLUSH);
+
+	} else {
+		prefix_pair_t marker = make_marker(full? LZS_MARKER_FULL_FLUSH
+		                                       : LZS_MARKER_SYNC_FLUSH);
+		write_prefix(&marker, out);
+	}
+
+	// pad to a byte boundary so everything so far can be decoded from the
+	// bytes written out
+	bit_stream_write_bits(out, (8 - bitpos(out->offset)) & 7, 0);
+	bit_stream_flush(out);
+
+	if (full) {
+		encoder_clear(&stream->state);
+
+		// the decoder can start from here, without the last block's tables
+		stream->block->have_lengths = false;
+
+		if (stream->dict) {
+			encoder_preload(&stream->state, stream->dict);
+		}
+	}
+}
+
+void lzs_stream_finish(lzs_stream_t *stream) {
+	stream->encode(stream, NULL, 0, true);
+
+	block_write(stream->block, &stream->out, true);
+
+	if (!stream->block->entropy_coded) {
+		prefix_pair_t end = make_end_marker();
+		write_prefix(&end, &stream->out);
+	}
+
+	bit_stream_flush(&stream->out);
+}
+
+void lzs_stream_free(lzs_stream_t *stream) {
+	window_free(stream->state.input);
+	window_free(stream->state.window);
+	free(stream->state.head);
+	free(stream->state.prev);
+
+	if (stream->state.bt) {
+		lzs_bt_free(stream->state.bt);
+	}
+
+	if (stream->state.ldm) {
+		lzs_ldm_free(stream->state.ldm);
+	}
+
+	free(stream->block->tokens);
+	free(stream->block->raw);
+	free(stream->block);
+	free(stream);
+}
+
+size_t lzs_stream_memory(const lzs_stream_t *stream) {
+	return stream->memory;
+}
+
+bool lzs_encode(FILE *fp, FILE *out, const lzs_params_t *params) {
+	lzs_stream_t *stream = lzs_stream_create(out, params);
+	uint8_t buf[0x1000];
+
+	if (!stream) {
+		return false;
+	}
+
+	for (size_t n; (n = fread(buf, 1, sizeof(buf), fp)) > 0;) {
+		lzs_stream_write(stream, buf, n);
+	}
+
+	lzs_stream_finish(stream);
+	lzs_stream_free(stream);
+	return true;
+}
+
+// copies one byte at a time, so matches longer than their distance repeat
+// the bytes they've just written
+LZS_INLINE void window_copy_match(lzs_window_t *window,
+                                     FILE *out,
+                                     uint16_t distance,
+                                     uint16_t length)
+{
+	uint16_t index = window_available(window, LZS_DECODER_MASK) - distance;
+
+	unsigned adjust = 0;
+	for (unsigned i = 0; i < length; i++) {
+		uint8_t value = window_index(window, LZS_DECODER_MASK, i + index - adjust);
+		fputc(value, out);
+		adjust += window_append(window, LZS_DECODER_MASK, value);
+	}
+}
+
+LZS_INLINE void decoder_put(decoder_t *dec, uint8_t value) {
+	if (!dec->dest && dec->far) {
+		fputc(value, dec->out);
+		dec->far[dec->far_pos++ & (dec->far_size - 1)] = value;
+
+	} else if (!dec->dest) {
+		fputc(value, dec->out);
+		window_append(dec->window, LZS_DECODER_MASK, value);
+
+	} else if (dec->dest_pos < dec->dest_size) {
+		dec->dest[dec->dest_pos++] = value;
+
+	} else {
+		dec->corrupt = true;
+	}
+}
+
+// copies from the far history, for all matches when there is one
+static void far_copy_match(decoder_t *dec, uint32_t distance, uint32_t length) {
+	size_t mask = dec->far_size - 1;
+
+	if (distance > dec->far_pos - dec->far_base || distance > dec->far_size) {
+		dec->corrupt = true;
+		return;
+	}
+
+	for (uint32_t i = 0; i < length; i++) {
+		uint8_t value = dec->far[(dec->far_pos - distance) & mask];
+
+		fputc(value, dec->out);
+		dec->far[dec->far_pos++ & mask] = value;
+	}
+}
+
+LZS_INLINE void decoder_copy(decoder_t *dec, uint32_t distance, uint32_t length) {
+	if (!dec->dest && dec->far) {
+		far_copy_match(dec, distance, length);
+		return;
+	}
+
+	if (!dec->dest) {
+		// the window is cleared with the history, so it only has what was
+		// decoded since
+		if (distance > window_available(dec->window, LZS_DECODER_MASK)) {
+			dec->corrupt = true;
+			return;
+		}
+
+		window_copy_match(dec->window, dec->out, distance, length);
+		return;
+	}
+
+	if (distance > dec->dest_pos - dec->dest_base
+	    || length > dec->dest_size - dec->dest_pos)
+	{
+		dec->corrupt = true;
+		return;
+	}
+
+	uint8_t *p = dec->dest + dec->dest_pos;
+	const uint8_t *src = p - distance;
+	dec->dest_pos += length;
+
+	// forwards a byte at a time, so overlapping matches repeat
+	for (unsigned i = 0; i < length; i++) {
+		p[i] = src[i];
+	}
+}
+
+// forgets all history after a full flush, except for the dictionary
+static void decoder_reset(decoder_t *dec) {
+	dec->window->start = dec->window->end = 0;
+	dec->have_tables = false;
+	dec->dest_base = dec->dest_pos;
+	dec->far_base = dec->far_pos;
+
+	if (dec->dict) {
+		for (unsigned i = 0; i < dec->dict->length; i++) {
+			if (dec->far) {
+				dec->far[dec->far_pos++ & (dec->far_size - 1)] = dec->dict->data[i];
+			} else {
+				window_append(dec->window, LZS_DECODER_MASK, dec->dict->data[i]);
+			}
+		}
+	}
+}
+
+static void decoder_flush(decoder_t *dec, bit_stream_t *in, bool full) {
+	bit_stream_skip_bits(in, (8 - bitpos(in->offset)) & 7);
+
+	if (!dec->dest) {
+		fflush(dec->out);
+	}
+
+	if (full) {
+		decoder_reset(dec);
+	}
+}
+
+static void decode_stored(decoder_t *dec, bit_stream_t *in) {
+	bit_stream_skip_bits(in, (8 - bitpos(in->offset)) & 7);
+	unsigned length = bit_stream_read_bits(in, 16);
+	unsigned i = 0;
+
+	for (; i < length && !bit_stream_end(in); i++) {
+		decoder_put(dec, bit_stream_read_bits(in, 8));
+	}
+
+	if (i < length) {
+		dec->corrupt = true;
+	}
+}
+
+// stops at the end marker, anything else that stops it marks the stream
+// corrupt, including the input running out first
+static void decode_plain(bit_stream_t *in, decoder_t *dec) {
+	while (!dec->corrupt) {
+		uint32_t word = bit_stream_peek_bits(in, TOKEN_PEEK_BITS);
+		const token_ent_t *ent = token_lookup(word);
+
+		if (in->offset + ent->bits > in->available) {
+			dec->corrupt = true;
+			break;
+		}
+
+		bit_stream_skip_bits(in, ent->bits);
+
+		if (ent->kind == TOKEN_LITERAL) {
+			decoder_put(dec, word >> 1);
+			continue;
+		}
+
+		uint16_t distance = (word >> 2) & ((1 << ent->dist_bits) - 1);
+		uint16_t length = (ent->kind == TOKEN_LONG_MATCH)? read_long_length(in)
+		                                                 : ent->length;
+
+		if (distance != 0) {
+			decoder_copy(dec, distance, length);
+
+		} else if (length == LZS_MARKER_SYNC_FLUSH
+		           || length == LZS_MARKER_FULL_FLUSH)
+		{
+			decoder_flush(dec, in, length == LZS_MARKER_FULL_FLUSH);
+
+		} else if (length == LZS_MARKER_STORED) {
+			decode_stored(dec, in);
+
+		} else if (length == LZS_MARKER_FAR && dec->long_distance) {
+			uint32_t far_distance, far_length;
+
+			read_far(in, &far_distance, &far_length);
+			decoder_copy(dec, far_distance, far_length);
+
+		} else {
+			dec->corrupt = length != LZS_MARKER_END;
+			break;
+		}
+	}
+}
+
+#define DECODE_TABLE_SIZE sizeof(huff_decode_ent_t[1 << HUFF_MAX_CODE_BITS])
+
+// stops after the final block, anything else that stops it marks the stream
+// corrupt, including the input running out first
+static void decode_entropy_coded(bit_stream_t *in, decoder_t *dec) {
+	huff_decode_ent_t *litlen = dec->litlen;
+	huff_decode_ent_t *dist = dec->dist;
+	unsigned litlen_codes = LZS_LITLEN_CODES + dec->long_distance;
+
+	unsigned table_size = litlen_codes + LZS_DIST_CODES;
+	bool final = false;
+
+	while (!final && !dec->corrupt) {
+		if (bit_stream_end(in)) {
+			fprintf(stderr, "error: stream ends before its final block\n");
+			dec->corrupt = true;
+			break;
+		}
+
+		uint8_t lengths[LZS_LITLEN_CODES + 1 + LZS_DIST_CODES];
+
+		final = bit_stream_read(in);
+		unsigned type = bit_stream_read_bits(in, 2);
+
+		if (type == LZS_BLOCK_SYNC_FLUSH || type == LZS_BLOCK_FULL_FLUSH) {
+			decoder_flush(dec, in, type == LZS_BLOCK_FULL_FLUSH);
+			continue;
+
+		} else if (type == LZS_BLOCK_STORED) {
+			decode_stored(dec, in);
+			continue;
+
+		} else if (type != LZS_BLOCK_HUFFMAN) {
+			fprintf(stderr, "error: unknown block type %u\n", type);
+			dec->corrupt = true;
+			break;
+		}
+
+		if (bit_stream_read(in)) {
+			if (!dec->have_tables) {
+				fprintf(stderr, "error: block reuses tables it doesn't have\n");
+				dec->corrupt = true;
+				break;
+			}
+
+		} else if (!huff_read_lengths(in, lengths, table_size)) {
+			fprintf(stderr, "error: bad code length table\n");
+			dec->corrupt = true;
+			break;
+
+		} else {
+			huff_build_decode_table(lengths, litlen_codes, litlen);
+			huff_build_decode_table(lengths + litlen_codes, LZS_DIST_CODES, dist);
+			dec->have_tables = true;
+		}
+
+		while (!dec->corrupt) {
+			uint16_t sym = block_read_symbol(in, litlen);
+
+			if (sym == LZS_BAD_SYMBOL) {
+				dec->corrupt = true;
+				break;
+			}
+
+			if (sym < LZS_END_OF_BLOCK) {
+				decoder_put(dec, sym);
+				continue;
+			}
+
+			if (sym == LZS_END_OF_BLOCK) {
+				break;
+			}
+
+			if (sym == LZS_FAR_SYMBOL) {
+				uint32_t far_distance, far_length;
+
+				read_far(in, &far_distance, &far_length);
+				decoder_copy(dec, far_distance, far_length);
+				continue;
+			}
+
+			unsigned lencode = sym - LZS_END_OF_BLOCK - 1;
+			unsigned length = 2 + bucket_base(lencode)
+			                + bit_stream_read_bits(in, bucket_extra_bits(lencode));
+
+			unsigned distcode = block_read_symbol(in, dist);
+
+			if (distcode >= LZS_DIST_CODES) {
+				dec->corrupt = true;
+				break;
+			}
+
+			unsigned distance = 1 + bucket_base(distcode)
+			                  + bit_stream_read_bits(in, bucket_extra_bits(distcode));
+
+			decoder_copy(dec, distance, length);
+		}
+	}
+}
+
+static size_t decoder_memory(bool entropy_coded, size_t long_window) {
+	// the decoder always has the largest window, and the same bit stream
+	// buffer as the encoder
+	size_t ret = sizeof(bit_stream_t) + sizeof(decoder_t) + window_memory(0);
+
+	if (entropy_coded) {
+		ret += 2 * DECODE_TABLE_SIZE;
+	}
+
+	if (long_window) {
+		ret += lzs_ldm_window(long_window);
+	}
+
+	return ret;
+}
+
+size_t lzs_decoder_memory(const lzs_params_t *params) {
+	return decoder_memory(params->entropy_coded, params->long_window);
+}
+
+// long window for the header's value, 0 if it isn't one an encoder writes
+static size_t header_long_window(unsigned bits) {
+	size_t ret = (bits < BITS(size_t))? (size_t)1 << bits : 0;
+
+	return (ret >= LZS_LDM_MIN_WINDOW && ret <= LZS_LDM_MAX_WINDOW)? ret : 0;
+}
+
+// false if an encoder wouldn't write this header
+static bool header_valid(unsigned header) {
+	unsigned bits = header & LZS_HEADER_WINDOW;
+
+	return !(header & ~(LZS_HEADER_WINDOW | LZS_HEADER_HUFFMAN | LZS_HEADER_DICT))
+	    && (bits == 0 || header_long_window(bits) != 0);
+}
+
+// the dictionary with the stream's id, NULL if the decoder doesn't have it
+static const lzs_dict_t *header_dict(const lzs_dict_t *const *dicts,
+                                     unsigned count,
+                                     uint32_t id)
+{
+	for (unsigned i = 0; i < count; i++) {
+		if (dicts[i]->id == id) {
+			return dicts[i];
+		}
+	}
+
+	if (count == 0) {
+		fprintf(stderr, "error: stream needs dictionary %08x\n", id);
+	} else {
+		fprintf(stderr, "error: no dictionary with id %08x\n", id);
+	}
+
+	return NULL;
+}
+
+lzs_decoder_t *lzs_decoder_create(const lzs_params_t *params) {
+	size_t memory = lzs_decoder_memory(params);
+
+	if (params->memory_limit && memory > params->memory_limit) {
+		fprintf(stderr, "error: memory limit of %zu bytes is too small, "
+		                "the decoder needs %zu\n", params->memory_limit, memory);
+		return NULL;
+	}
+
+	decoder_t *ret = calloc(1, sizeof(decoder_t));
+
+	ret->window = window_create(0);
+	ret->entropy_coded = params->entropy_coded;
+	ret->dicts = params->dicts;
+	ret->dict_count = params->dict_count;
+	ret->memory_limit = params->memory_limit;
+
+	if (params->entropy_coded) {
+		ret->litlen = malloc(DECODE_TABLE_SIZE);
+		ret->dist = malloc(DECODE_TABLE_SIZE);
+	}
+
+	// streams with long distance matching are expected, so the history is
+	// allocated up front
+	if (params->long_window) {
+		ret->far_size = lzs_ldm_window(params->long_window);
+		ret->far = malloc(ret->far_size);
+	}
+
+	return ret;
+}
+
+void lzs_decoder_free(lzs_decoder_t *dec) {
+	window_free(dec->window);
+	free(dec->litlen);
+	free(dec->dist);
+	free(dec->far);
+	free(dec);
+}
+
+// picks the stream's format, and sets up the decoding tables and the far
+// history for its long window if they weren't allocated up front
+static bool decoder_header(decoder_t *dec, unsigned header) {
+	size_t long_window = header_long_window(header & LZS_HEADER_WINDOW);
+	bool entropy_coded = header & LZS_HEADER_HUFFMAN;
+
+	if (!header_valid(header)) {
+		fprintf(stderr, "error: bad stream header\n");
+		return false;
+	}
+
+	dec->entropy_coded = entropy_coded;
+	dec->long_distance = long_window != 0;
+
+	bool tables = entropy_coded && !dec->litlen;
+	bool far = long_window > dec->far_size;
+
+	if (!tables && !far) {
+		return true;
+	}
+
+	size_t memory = decoder_memory(entropy_coded || dec->litlen,
+	                               far? long_window : dec->far_size);
+
+	if (dec->memory_limit && memory > dec->memory_limit) {
+		fprintf(stderr, "error: memory limit of %zu bytes is too small, the "
+		                "stream needs %zu\n", dec->memory_limit, memory);
+		return false;
+	}
+
+	if (tables) {
+		dec->litlen = malloc(DECODE_TABLE_SIZE);
+		dec->dist = malloc(DECODE_TABLE_SIZE);
+	}
+
+	if (far) {
+		free(dec->far);
+		dec->far_size = long_window;
+		dec->far = malloc(long_window);
+		dec->far_pos = dec->far_base = 0;
+	}
+
+	return true;
+}
+
+static bool decoder_run(decoder_t *dec, FILE *fp) {
+	bit_stream_t in;
+	memset(&in, 0, sizeof(bit_stream_t));
+	in.fp = fp;
+
+	dec->dict = NULL;
+	dec->corrupt = false;
+
+	unsigned header = bit_stream_read_bits(&in, LZS_HEADER_BITS);
+
+	if (!decoder_header(dec, header)) {
+		return false;
+	}
+
+	if (header & LZS_HEADER_DICT) {
+		uint32_t id = bit_stream_read_bits(&in, 32);
+		dec->dict = header_dict(dec->dicts, dec->dict_count, id);
+
+		if (!dec->dict) {
+			return false;
+		}
+	}
+
+	decoder_reset(dec);
+	uint64_t start = trace_begin();
+
+	if (dec->entropy_coded) {
+		decode_entropy_coded(&in, dec);
+	} else {
+		decode_plain(&in, dec);
+	}
+
+	trace_end("lzs", "decode", start, dec->dest_pos);
+	return true;
+}
+
+bool lzs_decoder_run(lzs_decoder_t *dec, FILE *fp, FILE *out) {
+	dec->out = out;
+	dec->dest = NULL;
+	dec->dest_pos = dec->dest_base = 0;
+
+	if (!decoder_run(dec, fp)) {
+		return false;
+	}
+
+	if (dec->corrupt) {
+		fprintf(stderr, "error: corrupt stream\n");
+	}
+
+	return !dec->corrupt;
+}
+
+bool lzs_decoder_run_buffer(lzs_decoder_t *dec,
+                            FILE *fp,
+                            uint8_t *out,
+                            size_t size,
+                            size_t *written)
+{
+	if (dec->dict_count > 0) {
+		fprintf(stderr, "error: dictionaries need a stream to decode to\n");
+		return false;
+	}
+
+	dec->out = NULL;
+	dec->dest = out;
+	dec->dest_size = size;
+	dec->dest_pos = dec->dest_base = 0;
+
+	bool ret = decoder_run(dec, fp) && !dec->corrupt;
+	*written = dec->dest_pos;
+
+	dec->dest = NULL;
+	return ret;
+}
+
+bool lzs_decode(FILE *fp, FILE *out, const lzs_params_t *params) {
+	lzs_decoder_t *dec = lzs_decoder_create(params);
+
+	if (!dec) {
+		return false;
+	}
+
+	bool ret = lzs_decoder_run(dec, fp, out);
+	lzs_decoder_free(dec);
+	return ret;
+}
+
+typedef enum lzs_push_state {
+	// the header, then the dictionary id if the stream has one
+	LZS_PUSH_HEADER,
+	// plain format tokens
+	LZS_PUSH_TOKENS,
+	// huffman coded format block headers and tables, then the block's symbols
+	LZS_PUSH_BLOCK,
+	LZS_PUSH_SYMBOLS,
+	// `stored` bytes of stored data still to go
+	LZS_PUSH_STORED,
+	LZS_PUSH_DONE,
+} lzs_push_state_t;
+
+struct lzs_push {
+	bit_stream_t in;
+	lzs_push_state_t state;
+
+	bool entropy_coded;
+	// from the stream's header
+	bool long_distance;
+	size_t memory_limit;
+	const lzs_dict_t *const *dicts;
+	unsigned dict_count;
+	const lzs_dict_t *dict;
+
+	huff_decode_ent_t *litlen;
+	huff_decode_ent_t *dist;
+	bool have_tables;
+	// the current block is the last one
+	bool final;
+
+	// history is a ring of `history_size` bytes, the window or the far
+	// history with long distance matching, grown to fit the stream's long
+	// window. positions count all bytes decoded, `base` is where the
+	// history starts.
+	uint8_t *history;
+	size_t history_size;
+	uint64_t pos;
+	uint64_t base;
+
+	// rest of a match that didn't fit in the output
+	uint32_t distance;
+	uint32_t length;
+	size_t stored;
+};
+
+static size_t push_memory(bool entropy_coded, size_t long_window) {
+	size_t ret = sizeof(lzs_push_t);
+
+	if (entropy_coded) {
+		ret += 2 * DECODE_TABLE_SIZE;
+	}
+
+	return ret + (long_window? lzs_ldm_window(long_window) : MAX_WINDOW_SIZE);
+}
+
+lzs_push_t *lzs_push_create(const lzs_params_t *params) {
+	size_t memory = push_memory(params->entropy_coded, params->long_window);
+
+	if (params->memory_limit && memory > params->memory_limit) {
+		fprintf(stderr, "error: memory limit of %zu bytes is too small, "
+		                "the decoder needs %zu\n", params->memory_limit, memory);
+		return NULL;
+	}
+
+	lzs_push_t *ret = calloc(1, sizeof(lzs_push_t));
+
+	ret->entropy_coded = params->entropy_coded;
+	ret->memory_limit = params->memory_limit;
+	ret->dicts = params->dicts;
+	ret->dict_count = params->dict_count;
+	ret->history_size = params->long_window? lzs_ldm_window(params->long_window)
+	                                       : MAX_WINDOW_SIZE;
+	ret->history = malloc(ret->history_size);
+
+	if (params->entropy_coded) {
+		ret->litlen = malloc(DECODE_TABLE_SIZE);
+		ret->dist = malloc(DECODE_TABLE_SIZE);
+	}
+
+	return ret;
+}
+
+void lzs_push_free(lzs_push_t *dec) {
+	free(dec->history);
+	free(dec->litlen);
+	free(dec->dist);
+	free(dec);
+}
+
+size_t lzs_push_memory(const lzs_push_t *dec) {
+	size_t ret = sizeof(lzs_push_t) + dec->history_size;
+
+	if (dec->litlen) {
+		ret += 2 * DECODE_TABLE_SIZE;
+	}
+
+	return ret;
+}
+
+void lzs_push_reset(lzs_push_t *dec) {
+	memset(&dec->in, 0, sizeof(bit_stream_t));
+	dec->state = LZS_PUSH_HEADER;
+	dec->dict = NULL;
+	dec->have_tables = false;
+	dec->pos = dec->base = 0;
+	dec->length = 0;
+	dec->stored = 0;
+}
+
+// same as decoder_header()
+static bool push_header(lzs_push_t *dec, unsigned header) {
+	size_t long_window = header_long_window(header & LZS_HEADER_WINDOW);
+	bool entropy_coded = header & LZS_HEADER_HUFFMAN;
+
+	if (!header_valid(header)) {
+		fprintf(stderr, "error: bad stream header\n");
+		return false;
+	}
+
+	dec->entropy_coded = entropy_coded;
+	dec->long_distance = long_window != 0;
+
+	bool tables = entropy_coded && !dec->litlen;
+	bool grow = long_window > dec->history_size;
+
+	if (!tables && !grow) {
+		return true;
+	}
+
+	size_t history = grow? long_window : dec->history_size;
+	size_t memory = push_memory(entropy_coded || dec->litlen,
+	                            (history > MAX_WINDOW_SIZE)? history : 0);
+
+	if (dec->memory_limit && memory > dec->memory_limit) {
+		fprintf(stderr, "error: memory limit of %zu bytes is too small, the "
+		                "stream needs %zu\n", dec->memory_limit, memory);
+		return false;
+	}
+
+	if (tables) {
+		dec->litlen = malloc(DECODE_TABLE_SIZE);
+		dec->dist = malloc(DECODE_TABLE_SIZE);
+	}
+
+	if (grow) {
+		free(dec->history);
+		dec->history_size = long_window;
+		dec->history = malloc(long_window);
+		dec->pos = dec->base = 0;
+	}
+
+	return true;
+}
+
+// same as decoder_reset()
+static void push_history_reset(lzs_push_t *dec) {
+	dec->have_tables = false;
+	dec->base = dec->pos;
+
+	for (unsigned i = 0; dec->dict && i < dec->dict->length; i++) {
+		dec->history[dec->pos++ & (dec->history_size - 1)] = dec->dict->data[i];
+	}
+}
+
+LZS_INLINE void push_put(lzs_push_t *dec, uint8_t *out, size_t *o, uint8_t value) {
+	out[(*o)++] = value;
+	dec->history[dec->pos++ & (dec->history_size - 1)] = value;
+}
+
+// false if the match reaches back past the start of the history
+static bool push_match(lzs_push_t *dec, uint32_t distance, uint32_t length) {
+	if (distance > dec->pos - dec->base || distance > dec->history_size) {
+		return false;
+	}
+
+	dec->distance = distance;
+	dec->length = length;
+	return true;
+}
+
+// copies as much of the pending match as fits, true if it all did
+static bool push_copy(lzs_push_t *dec, uint8_t *out, size_t size, size_t *o) {
+	size_t mask = dec->history_size - 1;
+	uint32_t n = (dec->length < size - *o)? dec->length : size - *o;
+
+	for (uint32_t i = 0; i < n; i++) {
+		push_put(dec, out, o, dec->history[(dec->pos - dec->distance) & mask]);
+	}
+
+	dec->length -= n;
+	return dec->length == 0;
+}
+
+// the state after stored data or a block
+static lzs_push_state_t push_next_block(const lzs_push_t *dec) {
+	if (!dec->entropy_coded) {
+		return LZS_PUSH_TOKENS;
+	}
+
+	return dec->final? LZS_PUSH_DONE : LZS_PUSH_BLOCK;
+}
+
+// padding and the length of stored data, the marker or block header comes
+// before this
+static void push_stored_header(lzs_push_t *dec, bit_stream_t *in) {
+	bit_stream_skip_bits(in, (8 - bitpos(in->offset)) & 7);
+	dec->stored = bit_stream_read_bits(in, 16);
+	dec->state = LZS_PUSH_STORED;
+}
+
+// false if the far match is bad
+static bool push_far(lzs_push_t *dec, bit_stream_t *in) {
+	uint32_t distance, length;
+
+	if (bit_stream_peek_bits(in, LZS_FAR_DIST_BITS)
+	    > bucket_code(dec->history_size - 1))
+	{
+		return bit_stream_overrun(in);
+	}
+
+	read_far(in, &distance, &length);
+	return bit_stream_overrun(in) || push_match(dec, distance, length);
+}
+
+static push_status_t push_tokens(lzs_push_t *dec, bit_stream_t *in,
+                                 uint8_t *out, size_t size, size_t *o)
+{
+	while (dec->state == LZS_PUSH_TOKENS) {
+		if (dec->length && !push_copy(dec, out, size, o)) {
+			return PUSH_MORE_OUTPUT;
+		}
+
+		if (*o == size) {
+			return PUSH_MORE_OUTPUT;
+		}
+
+		size_t save = in->offset;
+		uint32_t word = bit_stream_peek_bits(in, TOKEN_PEEK_BITS);
+		const token_ent_t *ent = token_lookup(word);
+
+		bit_stream_skip_bits(in, ent->bits);
+
+		uint16_t distance = (word >> 2) & ((1 << ent->dist_bits) - 1);
+		uint16_t length = (ent->kind == TOKEN_LONG_MATCH)? read_long_length(in)
+		                                                 : ent->length;
+		bool ok = true;
+
+		if (bit_stream_overrun(in)) {
+			in->offset = save;
+			return PUSH_NEED_INPUT;
+		}
+
+		if (ent->kind == TOKEN_LITERAL) {
+			push_put(dec, out, o, word >> 1);
+
+		} else if (distance != 0) {
+			ok = push_match(dec, distance, length);
+
+		} else if (length == LZS_MARKER_SYNC_FLUSH
+		           || length == LZS_MARKER_FULL_FLUSH)
+		{
+			bit_stream_skip_bits(in, (8 - bitpos(in->offset)) & 7);
+
+			if (length == LZS_MARKER_FULL_FLUSH) {
+				push_history_reset(dec);
+			}
+
+		} else if (length == LZS_MARKER_STORED) {
+			push_stored_header(dec, in);
+
+		} else if (length == LZS_MARKER_FAR && dec->long_distance) {
+			ok = push_far(dec, in);
+
+		} else if (length == LZS_MARKER_END) {
+			dec->state = LZS_PUSH_DONE;
+
+		} else {
+			ok = false;
+		}
+
+		if (!ok) {
+			return PUSH_ERROR;
+		}
+
+		if (bit_stream_overrun(in)) {
+			in->offset = save;
+			dec->state = LZS_PUSH_TOKENS;
+			dec->length = 0;
+			return PUSH_NEED_INPUT;
+		}
+	}
+
+	return PUSH_NEED_INPUT;
+}
+
+// block headers up to the first symbol of a huffman block
+static push_status_t push_block(lzs_push_t *dec, bit_stream_t *in) {
+	unsigned litlen_codes = LZS_LITLEN_CODES + dec->long_distance;
+	unsigned table_size = litlen_codes + LZS_DIST_CODES;
+
+	while (dec->state == LZS_PUSH_BLOCK) {
+		uint8_t lengths[LZS_LITLEN_CODES + 1 + LZS_DIST_CODES];
+		size_t save = in->offset;
+		bool final = bit_stream_read(in);
+		unsigned type = bit_stream_read_bits(in, 2);
+
+		if (type == LZS_BLOCK_SYNC_FLUSH || type == LZS_BLOCK_FULL_FLUSH) {
+			bit_stream_skip_bits(in, (8 - bitpos(in->offset)) & 7);
+
+			if (bit_stream_overrun(in)) {
+				in->offset = save;
+				return PUSH_NEED_INPUT;
+			}
+
+			if (type == LZS_BLOCK_FULL_FLUSH) {
+				push_history_reset(dec);
+			}
+
+			dec->state = final? LZS_PUSH_DONE : LZS_PUSH_BLOCK;
+			continue;
+		}
+
+		if (type == LZS_BLOCK_STORED) {
+			push_stored_header(dec, in);
+
+		} else if (bit_stream_read(in)) {
+			if (!dec->have_tables && !bit_stream_overrun(in)) {
+				return PUSH_ERROR;
+			}
+
+			dec->state = LZS_PUSH_SYMBOLS;
+
+		} else if (!huff_read_lengths(in, lengths, table_size)) {
+			// a table cut short by the end of the input fails too
+			if (in->offset + HUFF_MAX_CODE_BITS <= in->available) {
+				return PUSH_ERROR;
+			}
+
+		} else if (!bit_stream_overrun(in)) {
+			huff_build_decode_table(lengths, litlen_codes, dec->litlen);
+			huff_build_decode_table(lengths + litlen_codes, LZS_DIST_CODES,
+			                        dec->dist);
+			dec->have_tables = true;
+			dec->state = LZS_PUSH_SYMBOLS;
+		}
+
+		if (dec->state == LZS_PUSH_BLOCK || bit_stream_overrun(in)) {
+			in->offset = save;
+			dec->state = LZS_PUSH_BLOCK;
+			return PUSH_NEED_INPUT;
+		}
+
+		dec->final = final;
+	}
+
+	return PUSH_NEED_INPUT;
+}
+
+// next code in `table`, false if there isn't one. a code cut short by the
+// end of the input looks like a bad one, `*cut` says if it might be that.
+LZS_INLINE bool push_symbol(bit_stream_t *in, const huff_decode_ent_t *table,
+                            unsigned *symbol, bool *cut)
+{
+	const huff_decode_ent_t *ent = table + bit_stream_peek_bits(in,
+	                                                            HUFF_MAX_CODE_BITS);
+
+	if (!ent->length || in->offset + ent->length > in->available) {
+		*cut = in->offset + HUFF_MAX_CODE_BITS > in->available;
+		return false;
+	}
+
+	bit_stream_skip_bits(in, ent->length);
+	*symbol = ent->symbol;
+	return true;
+}
+
+static push_status_t push_symbols(lzs_push_t *dec, bit_stream_t *in,
+                                  uint8_t *out, size_t size, size_t *o)
+{
+	while (dec->state == LZS_PUSH_SYMBOLS) {
+		if (dec->length && !push_copy(dec, out, size, o)) {
+			return PUSH_MORE_OUTPUT;
+		}
+
+		if (*o == size) {
+			return PUSH_MORE_OUTPUT;
+		}
+
+		size_t save = in->offset;
+		unsigned sym, distcode;
+		bool cut = false;
+		bool ok = push_symbol(in, dec->litlen, &sym, &cut);
+
+		if (!ok) {
+			// bad or cut short, see below
+
+		} else if (sym < LZS_END_OF_BLOCK) {
+			push_put(dec, out, o, sym);
+			continue;
+
+		} else if (sym == LZS_END_OF_BLOCK) {
+			dec->state = push_next_block(dec);
+
+		} else if (sym == LZS_FAR_SYMBOL) {
+			ok = push_far(dec, in);
+
+		} else {
+			unsigned lencode = sym - LZS_END_OF_BLOCK - 1;
+			unsigned length = 2 + bucket_base(lencode)
+			                + bit_stream_read_bits(in, bucket_extra_bits(lencode));
+
+			if (bit_stream_overrun(in)
+			    || !push_symbol(in, dec->dist, &distcode, &cut)
+			    || distcode >= LZS_DIST_CODES)
+			{
+				ok = false;
+
+			} else {
+				unsigned distance = 1 + bucket_base(distcode)
+				                  + bit_stream_read_bits(in, bucket_extra_bits(distcode));
+
+				ok = bit_stream_overrun(in) || push_match(dec, distance, length);
+			}
+		}
+
+		if (cut || bit_stream_overrun(in)) {
+			in->offset = save;
+			dec->state = LZS_PUSH_SYMBOLS;
+			dec->length = 0;
+			return PUSH_NEED_INPUT;
+		}
+
+		if (!ok) {
+			return PUSH_ERROR;
+		}
+	}
+
+	return PUSH_NEED_INPUT;
+}
+
+static push_status_t lzs_push_run(void *ptr, bit_stream_t *in,
+                                  uint8_t *out, size_t size, size_t *written)
+{
+	lzs_push_t *dec = ptr;
+	push_status_t ret = PUSH_NEED_INPUT;
+	lzs_push_state_t state;
+
+	// each state runs until it needs more input or moves on to another one
+	do {
+		state = dec->state;
+
+		switch (state) {
+			case LZS_PUSH_HEADER: {
+				size_t save = in->offset;
+				unsigned header = bit_stream_read_bits(in, LZS_HEADER_BITS);
+				bool has_dict = header & LZS_HEADER_DICT;
+				uint32_t id = has_dict? bit_stream_read_bits(in, 32) : 0;
+
+				if (bit_stream_overrun(in)) {
+					in->offset = save;
+					break;
+				}
+
+				if (!push_header(dec, header)) {
+					ret = PUSH_ERROR;
+					break;
+				}
+
+				dec->dict = has_dict? header_dict(dec->dicts, dec->dict_count, id)
+				                    : NULL;
+
+				if (has_dict && !dec->dict) {
+					ret = PUSH_ERROR;
+					break;
+				}
+
+				push_history_reset(dec);
+				dec->state = dec->entropy_coded? LZS_PUSH_BLOCK : LZS_PUSH_TOKENS;
+				break;
+			}
+
+			case LZS_PUSH_TOKENS:
+				ret = push_tokens(dec, in, out, size, written);
+				break;
+
+			case LZS_PUSH_BLOCK:
+				ret = push_block(dec, in);
+				break;
+
+			case LZS_PUSH_SYMBOLS:
+				ret = push_symbols(dec, in, out, size, written);
+				break;
+
+			case LZS_PUSH_STORED: {
+				size_t n = bytepos(in->available) - bytepos(in->offset);
+				n = (n < dec->stored)? n : dec->stored;
+				n = (n < size - *written)? n : size - *written;
+
+				const uint8_t *p = in->fbuffer + bytepos(in->offset);
+
+				for (size_t i = 0; i < n; i++) {
+					push_put(dec, out, written, p[i]);
+				}
+
+				in->offset += 8 * n;
+				dec->stored -= n;
+
+				if (dec->stored == 0) {
+					dec->state = push_next_block(dec);
+				} else if (*written == size) {
+					ret = PUSH_MORE_OUTPUT;
+				}
+				break;
+			}
+
+			case LZS_PUSH_DONE:
+				ret = PUSH_DONE;
+				break;
+		}
+	} while (ret == PUSH_NEED_INPUT && state != dec->state);
+
+	return ret;
+}
+
+push_status_t lzs_push_decode(lzs_push_t *dec,
+                              const uint8_t *in,
+                              size_t length,
+                              size_t *used,
+                              uint8_t *out,
+                              size_t size,
+                              size_t *written)
+{
+	return push_decode(&dec->in, lzs_push_run, dec, in, length, used,
+	                   out, size, written);
+}
+
+unsigned lzs_window_size(int level) {
+	// compression level from 1-9, same as zip
+	return 1 << (2 + level);
+}
+
+lzs_match_finder_t lzs_match_finder(int level) {
+	return (level >= 8)? LZS_MATCH_BINARY_TREE : LZS_MATCH_HASH_CHAIN;
 }
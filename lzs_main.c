@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+#include <hz/lzs.h>
+#include <hz/iostage.h>
+#include <hz/trace.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+void print_help(void) {
+	puts("Usage: lzs [-edhHFT] [-c level] [-m bytes] [-L bytes]\n"
+	     "           [-D dictionary]\n"
+	     "       lzs -t dictionary [-c level] samples...\n"
+	     "\t-h: print this help\n"
+	     "\t-e: encode input from stdin, the default if no options are given\n"
+	     "\t-d: decode input from stdin\n"
+	     "\t-c: specify compression level for the encoder, ranging from 1-9\n"
+	     "\t    with 1 being the lowest and 9 being the highest. levels 8\n"
+	     "\t    and 9 use a slower binary tree match finder.\n"
+	     "\t-H: huffman code the output tokens with per-block tables, the\n"
+	     "\t    decoder reads the format from the stream\n"
+	     "\t-F: flush the output after every line of input, so each line can\n"
+	     "\t    be decoded as soon as it's written\n"
+	     "\t-m: limit the coder's working memory, k and m suffixes are\n"
+	     "\t    accepted. the encoder trades compression to fit, and the peak\n"
+	     "\t    is printed to stderr. I/O isn't buffered on separate threads\n"
+	     "\t    with a limit, since those buffers are bigger than the coder.\n"
+	     "\t-L: also look for repeats up to this far back, past the window,\n"
+	     "\t    with a sparse index over the input. k, m and g suffixes are\n"
+	     "\t    accepted. the coder keeps that much history, the decoder\n"
+	     "\t    reads the size from the stream.\n"
+	     "\t-D: preload a dictionary made with -t. can be given more than once\n"
+	     "\t    when decoding, the one matching the stream's id is used.\n"
+	     "\t-t: train a dictionary from sample files and write it out, the\n"
+	     "\t    size is the window size from -c\n"
+	     "\t-T: print the time and bytes spent in each stage to stderr on\n"
+	     "\t    exit, same as HZ_TRACE=1");
+}
+
+static lzs_dict_t *load_dict(const char *path) {
+	FILE *fp = fopen(path, "r");
+
+	if (!fp) {
+		fprintf(stderr, "error: couldn't open dictionary \"%s\"\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	lzs_dict_t *ret = lzs_dict_load(fp);
+	fclose(fp);
+
+	if (!ret) {
+		fprintf(stderr, "error: \"%s\" isn't a dictionary\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	return ret;
+}
+
+// samples can be pipes, so they're read until the end instead of sized
+// with ftell()
+static uint8_t *read_sample(FILE *fp, size_t *length) {
+	size_t space = 0x10000;
+	uint8_t *ret = malloc(space);
+
+	*length = 0;
+
+	for (size_t n; (n = fread(ret + *length, 1, space - *length, fp)) > 0;) {
+		*length += n;
+
+		if (*length == space) {
+			space *= 2;
+			ret = realloc(ret, space);
+		}
+	}
+
+	return ret;
+}
+
+static int train_dict(const char *path,
+                      unsigned window_size,
+                      char **files,
+                      int count)
+{
+	if (count == 0) {
+		fprintf(stderr, "error: -t needs at least one sample file\n");
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	uint8_t *samples[count];
+	size_t lengths[count];
+
+	for (int i = 0; i < count; i++) {
+		FILE *fp = fopen(files[i], "r");
+
+		if (!fp) {
+			fprintf(stderr, "error: couldn't open sample \"%s\"\n", files[i]);
+			return EXIT_FAILURE;
+		}
+
+		samples[i] = read_sample(fp, &lengths[i]);
+		fclose(fp);
+	}
+
+	lzs_dict_t *dict = lzs_dict_train((const uint8_t *const *)samples,
+	                                  lengths, count, window_size);
+	FILE *out = fopen(path, "w");
+
+	if (!out || !lzs_dict_save(out, dict)) {
+		fprintf(stderr, "error: couldn't write dictionary \"%s\"\n", path);
+		return EXIT_FAILURE;
+	}
+
+	fclose(out);
+	fprintf(stderr, "dictionary %08x: %u bytes from %d samples\n",
+	        dict->id, dict->length, count);
+
+	for (int i = 0; i < count; i++) {
+		free(samples[i]);
+	}
+
+	free(dict);
+	return 0;
+}
+
+static size_t parse_size(const char *str) {
+	char *end = NULL;
+	size_t ret = strtoull(str, &end, 10);
+
+	switch (*end) {
+		case 'k': case 'K': ret <<= 10; break;
+		case 'm': case 'M': ret <<= 20; break;
+		case 'g': case 'G': ret <<= 30; break;
+		default: break;
+	}
+
+	return ret;
+}
+
+static bool encode_lines(FILE *fp, FILE *out, const lzs_params_t *params) {
+	lzs_stream_t *stream = lzs_stream_create(out, params);
+	char *line = NULL;
+	size_t size = 0;
+
+	if (!stream) {
+		return false;
+	}
+
+	for (ssize_t n; (n = getline(&line, &size, fp)) > 0;) {
+		lzs_stream_write(stream, (uint8_t *)line, n);
+		lzs_stream_flush(stream, LZS_FLUSH_SYNC);
+	}
+
+	lzs_stream_finish(stream);
+	lzs_stream_free(stream);
+	free(line);
+	return true;
+}
+
+// decodes straight from `fd` with the push decoder, taking whatever each
+// read() returns and flushing the output after it, so a stream written with
+// -F decodes as it arrives on a pipe instead of once the input ends.
+// `*memory` is what the decoder allocated.
+static bool decode_pushed(int fd, FILE *out, const lzs_params_t *params,
+                          size_t *memory)
+{
+	lzs_push_t *dec = lzs_push_create(params);
+	uint8_t in[0x10000];
+	uint8_t buf[0x10000];
+	push_status_t status = PUSH_NEED_INPUT;
+
+	if (!dec) {
+		return false;
+	}
+
+	while (status == PUSH_NEED_INPUT) {
+		ssize_t n = read(fd, in, sizeof(in));
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (n <= 0) {
+			break;
+		}
+
+		for (size_t used = 0;;) {
+			size_t taken, written;
+
+			status = lzs_push_decode(dec, in + used, n - used, &taken,
+			                         buf, sizeof(buf), &written);
+			fwrite(buf, 1, written, out);
+			used += taken;
+
+			if (status != PUSH_MORE_OUTPUT) {
+				break;
+			}
+		}
+
+		fflush(out);
+	}
+
+	*memory = lzs_push_memory(dec);
+	lzs_push_free(dec);
+
+	if (status == PUSH_ERROR) {
+		fprintf(stderr, "error: couldn't decode stream\n");
+	} else if (status != PUSH_DONE) {
+		fprintf(stderr, "error: stream ends early\n");
+	}
+
+	return status == PUSH_DONE;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned window_size = 0;
+	lzs_match_finder_t match_finder = LZS_MATCH_HASH_CHAIN;
+	bool do_encode = true;
+	bool entropy_coded = false;
+	bool flush_lines = false;
+	size_t memory_limit = 0;
+	size_t long_window = 0;
+	const char *train_path = NULL;
+
+	const lzs_dict_t *dicts[argc];
+	unsigned dict_count = 0;
+
+	trace_init();
+
+	for (int opt; (opt = getopt(argc, argv, "edhHFTc:m:L:D:t:")) != -1;) {
+		switch (opt) {
+			case 'e':
+				do_encode = true;
+				break;
+
+			case 'd':
+				do_encode = false;
+				break;
+
+			case 'c':
+				window_size = lzs_window_size(atoi(optarg));
+				match_finder = lzs_match_finder(atoi(optarg));
+				break;
+
+			case 'H':
+				entropy_coded = true;
+				break;
+
+			case 'F':
+				flush_lines = true;
+				break;
+
+			case 'm':
+				memory_limit = parse_size(optarg);
+				break;
+
+			case 'L':
+				long_window = parse_size(optarg);
+				break;
+
+			case 'D':
+				dicts[dict_count++] = load_dict(optarg);
+				break;
+
+			case 't':
+				train_path = optarg;
+				break;
+
+			case 'T':
+				trace_enable(NULL);
+				break;
+
+			case 'h':
+				print_help();
+				exit(0);
+				break;
+
+			default:
+				print_help();
+				exit(EXIT_FAILURE);
+				break;
+		}
+	}
+
+	if (train_path) {
+		return train_dict(train_path, window_size,
+		                  argv + optind, argc - optind);
+	}
+
+	// TODO: filename
+
+	lzs_params_t params = {
+		.window_size = window_size,
+		.entropy_coded = entropy_coded,
+		.match_finder = match_finder,
+		.dicts = dicts,
+		.dict_count = dict_count,
+		.memory_limit = memory_limit,
+		.long_window = long_window,
+	};
+
+	size_t push_memory = 0;
+
+	// the decoder reads stdin itself, see decode_pushed()
+	FILE *fp = (memory_limit || !do_encode)? stdin
+	         : iostage_open_reader(STDIN_FILENO);
+	FILE *out = memory_limit? stdout : iostage_open_writer(STDOUT_FILENO);
+
+	if (!fp || !out) {
+		fprintf(stderr, "error: couldn't start I/O threads\n");
+		return EXIT_FAILURE;
+	}
+
+	bool ok = (do_encode && flush_lines)? encode_lines(fp, out, &params)
+	        : do_encode?                  lzs_encode(fp, out, &params)
+	        :                             decode_pushed(STDIN_FILENO, out,
+	                                                    &params, &push_memory);
+
+	if (!ok) {
+		return EXIT_FAILURE;
+	}
+
+	if (memory_limit) {
+		size_t peak = do_encode? lzs_encoder_memory(&params) : push_memory;
+
+		fprintf(stderr, "peak memory: %zu bytes of %zu\n", peak, memory_limit);
+	}
+
+	fclose(fp);
+
+	if (fclose(out) != 0) {
+		fprintf(stderr, "error: couldn't write output\n");
+		return EXIT_FAILURE;
+	}
+
+	return 0;
+}
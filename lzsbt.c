@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <hz/lzs.h>
+#include <hz/lzsbt.h>
+
+#define BT_HASH2_BITS 10
+#define BT_HASH3_BITS 12
+#define BT_HASH4_BITS 14
+
+// holds the history for the oldest position that may still be waiting to be
+// inserted, plus the lookahead
+#define BT_BUFFER_SIZE (4 * MAX_WINDOW_SIZE)
+#define BT_BUFFER_MASK (BT_BUFFER_SIZE - 1)
+
+// positions start here so that 0 can mean an empty tree or hash entry
+#define BT_POS_START BT_BUFFER_SIZE
+
+// strings are only compared up to this length when building the trees,
+// longer matches are extended afterwards
+#define BT_NICE_LENGTH 128
+
+// most tree nodes visited for one position
+#define BT_MAX_DEPTH 48
+
+struct lzs_bt {
+	uint8_t buffer[BT_BUFFER_SIZE];
+
+	uint32_t hash2[1 << BT_HASH2_BITS];
+	uint32_t hash3[1 << BT_HASH3_BITS];
+	uint32_t hash4[1 << BT_HASH4_BITS];
+
+	// two children for each position in the window, indexed by position
+	// modulo the window size. the left child holds smaller strings.
+	uint32_t *tree;
+	unsigned window_size;
+
+	// current position, end of the lookahead, start of the history, and the
+	// next position to insert into the trees. positions inside a match are
+	// only inserted when the next search happens, so that they can see as
+	// much of the lookahead as possible.
+	uint32_t pos;
+	uint32_t end;
+	uint32_t base;
+	uint32_t next;
+
+	// trees built while the lookahead was shorter than BT_NICE_LENGTH can
+	// be out of order past the bytes that were known, matches found before
+	// this position are checked before being returned
+	uint32_t check_until;
+};
+
+static inline uint8_t bt_byte(lzs_bt_t *bt, uint32_t pos) {
+	return bt->buffer[pos & BT_BUFFER_MASK];
+}
+
+static inline uint32_t bt_hash(lzs_bt_t *bt, uint32_t pos, unsigned bytes,
+                               unsigned bits)
+{
+	uint32_t x = 0;
+
+	for (unsigned i = 0; i < bytes; i++) {
+		x |= (uint32_t)bt_byte(bt, pos + i) << (8 * i);
+	}
+
+	return (x * 0x9e3779b1u) >> (32 - bits);
+}
+
+static inline uint32_t *bt_node(lzs_bt_t *bt, uint32_t pos) {
+	return bt->tree + 2 * (pos & (bt->window_size - 1));
+}
+
+static inline unsigned bt_common(lzs_bt_t *bt, uint32_t a, uint32_t b,
+                                 unsigned start, unsigned limit)
+{
+	unsigned ret = start;
+
+	while (ret < limit && bt_byte(bt, a + ret) == bt_byte(bt, b + ret)) {
+		ret++;
+	}
+
+	return ret;
+}
+
+lzs_bt_t *lzs_bt_create(unsigned window_size) {
+	lzs_bt_t *ret = calloc(1, sizeof(lzs_bt_t));
+
+	ret->window_size = window_size;
+	ret->tree = calloc(2 * window_size, sizeof(uint32_t));
+	ret->pos = ret->end = ret->base = ret->next = BT_POS_START;
+
+	return ret;
+}
+
+size_t lzs_bt_memory(unsigned window_size) {
+	return sizeof(lzs_bt_t) + sizeof(uint32_t[2 * window_size]);
+}
+
+void lzs_bt_free(lzs_bt_t *bt) {
+	free(bt->tree);
+	free(bt);
+}
+
+void lzs_bt_reset(lzs_bt_t *bt) {
+	// old entries are left where they are, they're out of range of the
+	// history from here on
+	bt->base = bt->next = bt->pos;
+}
+
+void lzs_bt_append(lzs_bt_t *bt, uint8_t value) {
+	bt->buffer[bt->end & BT_BUFFER_MASK] = value;
+	bt->end++;
+}
+
+void lzs_bt_advance(lzs_bt_t *bt, unsigned count) {
+	bt->pos += count;
+}
+
+void lzs_bt_skip(lzs_bt_t *bt) {
+	bt->next = bt->pos + 1;
+}
+
+static inline void bt_push(lzs_match_t *matches, unsigned *count,
+                           unsigned *best, unsigned length, uint32_t distance)
+{
+	if (matches && length > *best && *count < LZS_BT_MAX_MATCHES) {
+		matches[(*count)++] = (lzs_match_t){
+			.length = length,
+			.distance = distance,
+		};
+
+		*best = length;
+	}
+}
+
+// tries the most recent position in a hash bucket
+static inline void bt_check_hash(lzs_bt_t *bt, uint32_t pos, uint32_t cur,
+                                 unsigned history, unsigned limit,
+                                 lzs_match_t *matches, unsigned *count,
+                                 unsigned *best)
+{
+	uint32_t delta = pos - cur;
+
+	if (matches && delta > 0 && delta <= history) {
+		bt_push(matches, count, best, bt_common(bt, pos, cur, 0, limit), delta);
+	}
+}
+
+// inserts `pos` into the hash tables and trees, and if `matches` isn't NULL
+// collects the matches found on the way
+static unsigned bt_insert(lzs_bt_t *bt, uint32_t pos, lzs_match_t *matches) {
+	unsigned limit = bt->end - pos;
+	unsigned history = pos - bt->base;
+	unsigned count = 0;
+	unsigned best = 1;
+	uint32_t *node = bt_node(bt, pos);
+
+	limit = (limit < BT_NICE_LENGTH)? limit : BT_NICE_LENGTH;
+	history = (history < bt->window_size - 1)? history : bt->window_size - 1;
+
+	// left empty unless the position goes into a tree below
+	node[0] = node[1] = 0;
+
+	if (limit >= 2) {
+		uint32_t hash = bt_hash(bt, pos, 2, BT_HASH2_BITS);
+		bt_check_hash(bt, pos, bt->hash2[hash], history, limit,
+		              matches, &count, &best);
+		bt->hash2[hash] = pos;
+	}
+
+	if (limit >= 3) {
+		uint32_t hash = bt_hash(bt, pos, 3, BT_HASH3_BITS);
+		bt_check_hash(bt, pos, bt->hash3[hash], history, limit,
+		              matches, &count, &best);
+		bt->hash3[hash] = pos;
+	}
+
+	if (limit < 4) {
+		return count;
+	}
+
+	uint32_t hash = bt_hash(bt, pos, 4, BT_HASH4_BITS);
+	uint32_t cur = bt->hash4[hash];
+	bt->hash4[hash] = pos;
+
+	uint32_t *left = node;
+	uint32_t *right = node + 1;
+	unsigned left_length = 0;
+	unsigned right_length = 0;
+
+	for (unsigned depth = 0;; depth++) {
+		uint32_t delta = pos - cur;
+
+		if (depth == BT_MAX_DEPTH || delta == 0 || delta > history) {
+			*left = *right = 0;
+			break;
+		}
+
+		// everything under this node shares at least this much with `pos`
+		unsigned start = (left_length < right_length)? left_length : right_length;
+		unsigned length = bt_common(bt, pos, cur, start, limit);
+		uint32_t *pair = bt_node(bt, cur);
+
+		bt_push(matches, &count, &best, length, delta);
+
+		if (length == limit) {
+			// same string as far as we can tell, `pos` replaces the node
+			*left = pair[0];
+			*right = pair[1];
+
+			if (limit < BT_NICE_LENGTH) {
+				bt->check_until = pos + bt->window_size;
+			}
+
+			break;
+		}
+
+		if (bt_byte(bt, cur + length) < bt_byte(bt, pos + length)) {
+			*left = cur;
+			left = pair + 1;
+			cur = *left;
+			left_length = length;
+
+		} else {
+			*right = cur;
+			right = pair;
+			cur = *right;
+			right_length = length;
+		}
+	}
+
+	return count;
+}
+
+unsigned lzs_bt_find(lzs_bt_t *bt, lzs_match_t *matches) {
+	while (bt->next != bt->pos) {
+		bt_insert(bt, bt->next++, NULL);
+	}
+
+	unsigned count = bt_insert(bt, bt->pos, matches);
+	unsigned lookahead = bt->end - bt->pos;
+	bt->next = bt->pos + 1;
+
+	if ((int32_t)(bt->check_until - bt->pos) > 0) {
+		unsigned kept = 0;
+
+		for (unsigned i = 0; i < count; i++) {
+			lzs_match_t match = matches[i];
+			unsigned max = (match.length < lookahead)? match.length : lookahead;
+
+			match.length = bt_common(bt, bt->pos, bt->pos - match.distance,
+			                         0, max);
+
+			if (match.length > 1
+			    && (kept == 0 || match.length > matches[kept - 1].length))
+			{
+				matches[kept++] = match;
+			}
+		}
+
+		count = kept;
+	}
+
+	if (count > 0 && matches[count - 1].length >= BT_NICE_LENGTH) {
+		lzs_match_t *match = matches + count - 1;
+		match->length = bt_common(bt, bt->pos, bt->pos - match->distance,
+		                          match->length, lookahead);
+	}
+
+	return count;
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hz/lzs.h>
+#include <hz/bytes.h>
+#include <hz/checksum.h>
+
+// dictionary training is a simplified version of the "cover" algorithm:
+// count how many samples each short substring (dmer) shows up in, then split
+// the samples into one epoch per dictionary segment and take the segment from
+// each epoch whose dmers are the most common. dmers that make it into the
+// dictionary aren't counted again, so segments don't repeat each other.
+#define DICT_SEGMENT_SIZE 16
+#define DICT_DMER_SIZE    6
+#define DICT_HASH_BITS    20
+#define DICT_HASH_SIZE    (1 << DICT_HASH_BITS)
+
+typedef struct dict_segment {
+	size_t offset;
+	uint64_t score;
+} dict_segment_t;
+
+static inline uint32_t dmer_hash(const uint8_t *p) {
+	uint64_t x = 0;
+	memcpy(&x, p, DICT_DMER_SIZE);
+
+	return (x * 0x9e3779b97f4a7c15ull) >> (64 - DICT_HASH_BITS);
+}
+
+static int segment_compare(const void *a, const void *b) {
+	const dict_segment_t *x = a;
+	const dict_segment_t *y = b;
+
+	return (x->score > y->score) - (x->score < y->score);
+}
+
+lzs_dict_t *lzs_dict_train(const uint8_t *const *samples,
+                           const size_t *lengths,
+                           size_t count,
+                           size_t size)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < count; i++) {
+		total += lengths[i];
+	}
+
+	if (size == 0 || size >= MAX_WINDOW_SIZE) {
+		// the window holds one byte less than its size
+		size = MAX_WINDOW_SIZE - 1;
+	}
+
+	uint8_t *data = malloc(total + DICT_DMER_SIZE);
+	uint32_t *freqs = calloc(DICT_HASH_SIZE, sizeof(uint32_t));
+	uint32_t *seen = calloc(DICT_HASH_SIZE, sizeof(uint32_t));
+	uint32_t *hashes = calloc(total + 1, sizeof(uint32_t));
+
+	// hashes of dmers that would cross into the next sample are marked
+	// invalid, those shouldn't end up in the dictionary
+	const uint32_t invalid = UINT32_MAX;
+	size_t offset = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		memcpy(data + offset, samples[i], lengths[i]);
+
+		for (size_t k = 0; k < lengths[i]; k++) {
+			if (k + DICT_DMER_SIZE > lengths[i]) {
+				hashes[offset + k] = invalid;
+				continue;
+			}
+
+			uint32_t hash = dmer_hash(samples[i] + k);
+			hashes[offset + k] = hash;
+
+			// only count each dmer once per sample
+			if (seen[hash] != i + 1) {
+				seen[hash] = i + 1;
+				freqs[hash]++;
+			}
+		}
+
+		offset += lengths[i];
+	}
+
+	// keep epochs big enough that there's a choice of segments in each
+	size_t epochs = size / DICT_SEGMENT_SIZE;
+	if (epochs && total / epochs < 4 * DICT_SEGMENT_SIZE) {
+		epochs = total / (4 * DICT_SEGMENT_SIZE);
+	}
+
+	size_t epoch_size = epochs? total / epochs : 0;
+	dict_segment_t *segments = calloc(epochs + 1, sizeof(dict_segment_t));
+	size_t num_segments = 0;
+
+	for (size_t e = 0; e < epochs && epoch_size >= DICT_SEGMENT_SIZE; e++) {
+		size_t start = e * epoch_size;
+		size_t end = start + epoch_size - DICT_SEGMENT_SIZE;
+		dict_segment_t best = { .offset = start, .score = 0 };
+		uint64_t score = 0;
+
+		// sliding window over the dmers that start inside each segment
+		for (size_t k = start; k < start + DICT_SEGMENT_SIZE; k++) {
+			score += (hashes[k] == invalid)? 0 : freqs[hashes[k]];
+		}
+
+		for (size_t k = start;; k++) {
+			if (score > best.score) {
+				best.offset = k;
+				best.score = score;
+			}
+
+			if (k == end) {
+				break;
+			}
+
+			uint32_t out = hashes[k];
+			uint32_t in = hashes[k + DICT_SEGMENT_SIZE];
+			score -= (out == invalid)? 0 : freqs[out];
+			score += (in == invalid)? 0 : freqs[in];
+		}
+
+		// dmers that show up in only one sample aren't worth keeping
+		if (best.score <= DICT_SEGMENT_SIZE) {
+			continue;
+		}
+
+		for (size_t k = best.offset; k < best.offset + DICT_SEGMENT_SIZE; k++) {
+			if (hashes[k] != invalid) {
+				freqs[hashes[k]] = 0;
+			}
+		}
+
+		segments[num_segments++] = best;
+	}
+
+	// best segments go at the end, closest to the data, where distances
+	// are shortest
+	qsort(segments, num_segments, sizeof(dict_segment_t), segment_compare);
+
+	lzs_dict_t *ret = calloc(1, sizeof(lzs_dict_t));
+
+	for (size_t i = 0; i < num_segments; i++) {
+		memcpy(ret->data + ret->length, data + segments[i].offset,
+		       DICT_SEGMENT_SIZE);
+		ret->length += DICT_SEGMENT_SIZE;
+	}
+
+	ret->id = crc32c(0, ret->data, ret->length);
+
+	free(segments);
+	free(hashes);
+	free(seen);
+	free(freqs);
+	free(data);
+
+	return ret;
+}
+
+lzs_dict_t *lzs_dict_load(FILE *fp) {
+	uint8_t header[10];
+
+	if (fread(header, 1, sizeof(header), fp) != sizeof(header)
+	    || memcmp(header, LZS_DICT_MAGIC, 4) != 0)
+	{
+		return NULL;
+	}
+
+	lzs_dict_t *ret = calloc(1, sizeof(lzs_dict_t));
+	ret->id = load_le32(header + 4);
+	ret->length = header[8] | (header[9] << 8);
+
+	if (ret->length >= MAX_WINDOW_SIZE
+	    || fread(ret->data, 1, ret->length, fp) != ret->length)
+	{
+		free(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
+bool lzs_dict_save(FILE *fp, const lzs_dict_t *dict) {
+	uint8_t header[10];
+
+	memcpy(header, LZS_DICT_MAGIC, 4);
+	store_le32(header + 4, dict->id);
+	header[8] = dict->length;
+	header[9] = dict->length >> 8;
+
+	return fwrite(header, 1, sizeof(header), fp) == sizeof(header)
+	    && fwrite(dict->data, 1, dict->length, fp) == dict->length;
+}
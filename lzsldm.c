@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <hz/lzsldm.h>
+
+// distances currently being tried, most repeats are a single long run at
+// one distance but a few can overlap where one region ends and another one
+// starts
+#define LDM_CANDIDATES 4
+
+typedef struct ldm_candidate {
+	// position the repeat was found to start at, and its distance. 0 is an
+	// unused slot.
+	uint64_t start;
+	uint32_t distance;
+} ldm_candidate_t;
+
+struct lzs_ldm {
+	uint8_t *history;
+	size_t size;
+	size_t mask;
+
+	uint32_t *table;
+	unsigned table_bits;
+
+	uint32_t min_distance;
+	uint64_t hash;
+
+	// position as of the last search, end of the lookahead and start of
+	// the history, counted from the start of the stream
+	uint64_t pos;
+	uint64_t end;
+	uint64_t base;
+
+	ldm_candidate_t candidates[LDM_CANDIDATES];
+	unsigned next_candidate;
+	unsigned candidate_count;
+};
+
+static uint64_t gear[256];
+
+// splitmix64, any fixed table of well mixed values will do as long as the
+// encoder always uses the same one. it doesn't affect the format.
+__attribute__((constructor))
+static void ldm_init(void) {
+	uint64_t x = 0;
+
+	for (unsigned i = 0; i < 256; i++) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+static inline uint8_t ldm_byte(const lzs_ldm_t *ldm, uint64_t pos) {
+	return ldm->history[pos & ldm->mask];
+}
+
+// oldest position that's still in the history
+static inline uint64_t ldm_oldest(const lzs_ldm_t *ldm) {
+	uint64_t ring = (ldm->end > ldm->size)? ldm->end - ldm->size : 0;
+	return (ring > ldm->base)? ring : ldm->base;
+}
+
+static unsigned ldm_common(const lzs_ldm_t *ldm, uint64_t a, uint64_t b,
+                           unsigned limit)
+{
+	unsigned ret = 0;
+
+	// 8 bytes at a time while neither side wraps around the history
+	while (ret + 8 <= limit
+	       && ((a + ret) & ldm->mask) + 8 <= ldm->size
+	       && ((b + ret) & ldm->mask) + 8 <= ldm->size)
+	{
+		uint64_t x, y;
+
+		memcpy(&x, ldm->history + ((a + ret) & ldm->mask), 8);
+		memcpy(&y, ldm->history + ((b + ret) & ldm->mask), 8);
+
+		if (x != y) {
+			return ret + __builtin_ctzll(x ^ y) / 8;
+		}
+
+		ret += 8;
+	}
+
+	while (ret < limit && ldm_byte(ldm, a + ret) == ldm_byte(ldm, b + ret)) {
+		ret++;
+	}
+
+	return ret;
+}
+
+size_t lzs_ldm_window(size_t window_size) {
+	size_t ret = LZS_LDM_MIN_WINDOW;
+
+	while (ret < LZS_LDM_MAX_WINDOW && 2 * ret <= window_size) {
+		ret *= 2;
+	}
+
+	return ret;
+}
+
+size_t lzs_ldm_memory(size_t window_size) {
+	size_t size = lzs_ldm_window(window_size);
+
+	return sizeof(lzs_ldm_t) + size
+	     + (size >> LZS_LDM_SAMPLE_BITS) * sizeof(uint32_t);
+}
+
+lzs_ldm_t *lzs_ldm_create(size_t window_size, uint32_t min_distance) {
+	lzs_ldm_t *ldm = calloc(1, sizeof(lzs_ldm_t));
+
+	if (!ldm) {
+		return NULL;
+	}
+
+	ldm->size = lzs_ldm_window(window_size);
+	ldm->mask = ldm->size - 1;
+	ldm->table_bits = 0;
+
+	while (((size_t)1 << (ldm->table_bits + LZS_LDM_SAMPLE_BITS)) < ldm->size) {
+		ldm->table_bits++;
+	}
+
+	ldm->min_distance = min_distance;
+	ldm->history = malloc(ldm->size);
+	ldm->table = calloc((size_t)1 << ldm->table_bits, sizeof(uint32_t));
+
+	if (!ldm->history || !ldm->table) {
+		lzs_ldm_free(ldm);
+		return NULL;
+	}
+
+	return ldm;
+}
+
+void lzs_ldm_free(lzs_ldm_t *ldm) {
+	if (ldm) {
+		free(ldm->history);
+		free(ldm->table);
+		free(ldm);
+	}
+}
+
+void lzs_ldm_reset(lzs_ldm_t *ldm) {
+	// old table entries point before the base and are ignored, there's no
+	// need to clear it
+	ldm->pos = ldm->base = ldm->end;
+	ldm->hash = 0;
+	ldm->candidate_count = 0;
+	memset(ldm->candidates, 0, sizeof(ldm->candidates));
+}
+
+static bool ldm_is_candidate(const lzs_ldm_t *ldm, uint32_t distance) {
+	for (unsigned i = 0; i < LDM_CANDIDATES; i++) {
+		if (ldm->candidates[i].distance == distance) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void ldm_add_candidate(lzs_ldm_t *ldm, uint64_t start, uint32_t distance) {
+	ldm->candidates[ldm->next_candidate] = (ldm_candidate_t) {
+		.start = start,
+		.distance = distance,
+	};
+	ldm->next_candidate = (ldm->next_candidate + 1) % LDM_CANDIDATES;
+	ldm->candidate_count += ldm->candidate_count < LDM_CANDIDATES;
+}
+
+void lzs_ldm_append(lzs_ldm_t *ldm, uint8_t value) {
+	// the shift pushes bytes out of the top after LZS_LDM_HASH_LENGTH, so
+	// the top bits depend on all of them
+	uint64_t hash = (ldm->hash << 1) + gear[value];
+
+	ldm->history[ldm->end++ & ldm->mask] = value;
+	ldm->hash = hash;
+
+	if ((hash >> (64 - LZS_LDM_SAMPLE_BITS)) != 0
+	    || ldm->end - ldm->base < LZS_LDM_HASH_LENGTH)
+	{
+		return;
+	}
+
+	uint32_t *slot = ldm->table
+	               + ((ldm->hash >> (64 - LZS_LDM_SAMPLE_BITS - ldm->table_bits))
+	                  & (((uint32_t)1 << ldm->table_bits) - 1));
+	uint32_t distance = (uint32_t)ldm->end - *slot;
+	bool empty = !*slot;
+
+	*slot = (uint32_t)ldm->end;
+
+	uint64_t start = ldm->end - LZS_LDM_HASH_LENGTH;
+	uint64_t oldest = ldm_oldest(ldm);
+
+	// positions are truncated to 32 bits in the table, an entry from too
+	// long ago just fails the check below
+	// samples inside a repeat that's already known are the common case,
+	// and need no checking
+	if (empty || distance <= ldm->min_distance || distance > start
+	    || start - distance < oldest || ldm_is_candidate(ldm, distance)
+	    || ldm_common(ldm, start, start - distance, LZS_LDM_HASH_LENGTH)
+	       < LZS_LDM_HASH_LENGTH)
+	{
+		return;
+	}
+
+	// the repeat usually starts before the sample, but nothing before the
+	// last search position is of any use
+	while (start > ldm->pos && start - distance > oldest
+	       && ldm_byte(ldm, start - 1) == ldm_byte(ldm, start - 1 - distance))
+	{
+		start--;
+	}
+
+	ldm_add_candidate(ldm, start, distance);
+}
+
+bool lzs_ldm_find(lzs_ldm_t *ldm, unsigned lookahead, lzs_far_match_t *match) {
+	ldm->pos = ldm->end - lookahead;
+	match->length = 0;
+
+	if (!ldm->candidate_count || lookahead < LZS_LDM_MIN_MATCH) {
+		return false;
+	}
+
+	uint64_t oldest = ldm_oldest(ldm);
+
+	for (unsigned i = 0; i < LDM_CANDIDATES; i++) {
+		const ldm_candidate_t *cand = ldm->candidates + i;
+		uint64_t pos = ldm->pos;
+		uint32_t distance = cand->distance;
+
+		if (!distance || cand->start > pos || distance > pos
+		    || pos - distance < oldest
+		    // quick check on the last byte a short match would need
+		    || ldm_byte(ldm, pos + LZS_LDM_MIN_MATCH - 1)
+		       != ldm_byte(ldm, pos + LZS_LDM_MIN_MATCH - 1 - distance))
+		{
+			continue;
+		}
+
+		unsigned length = ldm_common(ldm, pos, pos - distance, lookahead);
+
+		if (length >= LZS_LDM_MIN_MATCH && length > match->length) {
+			match->length = length;
+			match->distance = distance;
+		}
+	}
+
+	return match->length > 0;
+}
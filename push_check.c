@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <hz/huffman.h>
+#include <hz/rle.h>
+
+// decodes a huffman or rle stream from stdin with its push decoder, fed
+// `piece` bytes at a time with room for `room` bytes of output per call, so
+// check_push.sh can check that a stream cut up anywhere decodes the same
+
+static uint8_t *read_all(FILE *in, size_t *length) {
+	size_t space = 0x10000;
+	uint8_t *ret = malloc(space);
+
+	*length = 0;
+
+	for (size_t n; (n = fread(ret + *length, 1, space - *length, in)) > 0;) {
+		*length += n;
+
+		if (*length == space) {
+			space *= 2;
+			ret = realloc(ret, space);
+		}
+	}
+
+	return ret;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2 || (strcmp(argv[1], "huffman") && strcmp(argv[1], "rle"))) {
+		puts("Usage: push_check huffman|rle [piece] [room]");
+		return EXIT_FAILURE;
+	}
+
+	bool huffman = strcmp(argv[1], "huffman") == 0;
+	size_t piece = (argc > 2)? strtoull(argv[2], NULL, 10) : 1;
+	size_t room = (argc > 3)? strtoull(argv[3], NULL, 10) : 1;
+
+	if (piece == 0 || room == 0) {
+		fprintf(stderr, "error: pieces and output room can't be empty\n");
+		return EXIT_FAILURE;
+	}
+
+	size_t length;
+	uint8_t *in = read_all(stdin, &length);
+	uint8_t *out = malloc(room);
+
+	huff_push_t *huff = huffman? huff_push_create() : NULL;
+	rle_push_t *rle = huffman? NULL : rle_push_create();
+	push_status_t status = PUSH_NEED_INPUT;
+
+	// carries on without input while there's output left to take
+	for (size_t pos = 0;
+	     (pos < length && status != PUSH_DONE) || status == PUSH_MORE_OUTPUT;)
+	{
+		size_t n = (length - pos < piece)? length - pos : piece;
+		size_t used, written;
+
+		status = huffman? huff_push_decode(huff, in + pos, n, &used,
+		                                   out, room, &written)
+		       :          rle_push_decode(rle, in + pos, n, &used,
+		                                  out, room, &written);
+
+		if (status == PUSH_ERROR) {
+			break;
+		}
+
+		fwrite(out, 1, written, stdout);
+		pos += used;
+	}
+
+	// rle and stored huffman streams don't mark their end, they just have
+	// to stop between runs
+	bool stored = length >= 4 && !memcmp(in, HUFF_STORED_SIGNATURE, 4);
+	bool ok = huffman? (status == PUSH_DONE
+	                    || (stored && status == PUSH_NEED_INPUT))
+	        :          (status == PUSH_NEED_INPUT && !rle_push_pending(rle));
+
+	if (!ok) {
+		fprintf(stderr, "error: push decoder %s\n",
+		        (status == PUSH_ERROR)? "failed" : "didn't finish the stream");
+	}
+
+	if (huff) {
+		huff_push_free(huff);
+	}
+
+	if (rle) {
+		rle_push_free(rle);
+	}
+
+	free(in);
+	free(out);
+	return ok? 0 : EXIT_FAILURE;
+}
@@ -1,92 +1,262 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 
-#define RLE_ESCAPE '\a'
+#include <hz/rle.h>
+#include <hz/trace.h>
 
-void encode(FILE *fp) {
-	uint8_t last = 0;
-	uint8_t count = 0;
+// input is encoded in blocks so that blocks that don't shrink can be stored
+// as they are, runs don't continue from one block to the next. stored blocks
+// are an escape with a count of 0 and a 16 bit length.
+#define RLE_BLOCK_SIZE    0xffff
+#define RLE_STORED_HEADER 4
 
-	while (!feof(fp)) {
-		uint8_t c = fgetc(fp);
+static size_t rle_put_run(uint8_t *out, uint8_t value, unsigned count) {
+	if (count < 3 && value != RLE_ESCAPE) {
+		memset(out, value, count);
+		return count;
+	}
 
-		if (feof(fp)){
-			if (count > 0) {
-				putchar(RLE_ESCAPE);
-				putchar(count);
-				putchar(last);
-			}
+	out[0] = RLE_ESCAPE;
+	out[1] = count;
+	out[2] = value;
+	return 3;
+}
 
-			break;
+// returns the encoded size, `out` needs room for 3 bytes per input byte
+// (a lone escape byte takes 3)
+static size_t rle_encode_block(const uint8_t *in, size_t length, uint8_t *out) {
+	size_t ret = 0;
+
+	for (size_t i = 0; i < length;) {
+		uint8_t value = in[i];
+		unsigned count = 1;
+
+		while (i + count < length && in[i + count] == value && count < 0xff) {
+			count++;
 		}
 
-		if (count == 0) {
-			count = 1;
-			last  = c;
-			continue;
+		ret += rle_put_run(out + ret, value, count);
+		i += count;
+	}
+
+	return ret;
+}
+
+// blocks without escapes or runs of 3 encode to themselves, which is the
+// usual case for already compressed input
+static bool rle_block_changes(const uint8_t *in, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		if (in[i] == RLE_ESCAPE
+		    || (i >= 2 && in[i] == in[i - 1] && in[i] == in[i - 2]))
+		{
+			return true;
 		}
+	}
 
-		if (c != last || count == 0xff) {
-			if (count < 3 && last != RLE_ESCAPE) {
-				for (unsigned k = 0; k < count; k++){
-					putchar(last);
-				}
+	return false;
+}
 
-			} else {
-				putchar(RLE_ESCAPE);
-				putchar(count);
-				putchar(last);
-			}
+void rle_encode(FILE *fp, FILE *out) {
+	uint8_t *in = malloc(RLE_BLOCK_SIZE);
+	uint8_t *coded = malloc(3 * RLE_BLOCK_SIZE);
+
+	for (size_t n; (n = fread(in, 1, RLE_BLOCK_SIZE, fp)) > 0;) {
+		uint64_t start = trace_begin();
 
-			count = 1;
-			last  = c;
+		if (!rle_block_changes(in, n)) {
+			fwrite(in, 1, n, out);
 
 		} else {
-			count++;
+			size_t codedlen = rle_encode_block(in, n, coded);
+
+			if (codedlen <= n + RLE_STORED_HEADER) {
+				fwrite(coded, 1, codedlen, out);
+
+			} else {
+				uint8_t header[RLE_STORED_HEADER] = {
+					RLE_ESCAPE, 0, n & 0xff, n >> 8
+				};
+
+				fwrite(header, 1, sizeof(header), out);
+				fwrite(in, 1, n, out);
+			}
 		}
+
+		trace_end("rle", "encode block", start, n);
 	}
+
+	free(coded);
+	free(in);
 }
 
-void decode(FILE *fp) {
+void rle_decode(FILE *fp, FILE *out) {
+	uint8_t buf[0x1000];
+	uint64_t start = trace_begin();
+	size_t decoded = 0;
+
 	while (!feof(fp)) {
 		uint8_t c = fgetc(fp);
 
 		if (feof(fp))
 			break;
 
-		if (c == RLE_ESCAPE) {
-			uint8_t count = fgetc(fp);
-			uint8_t chr   = fgetc(fp);
+		if (c != RLE_ESCAPE) {
+			fputc(c, out);
+			decoded++;
+			continue;
+		}
 
-			for (unsigned k = 0; k < count; k++) {
-				putchar(chr);
+		uint8_t count = fgetc(fp);
+		uint8_t chr   = fgetc(fp);
+
+		if (count == 0) {
+			// stored block, `chr` is the low byte of the length
+			size_t length = chr | (fgetc(fp) << 8);
+
+			while (length > 0 && !feof(fp)) {
+				size_t n = (length < sizeof(buf))? length : sizeof(buf);
+				n = fread(buf, 1, n, fp);
+				fwrite(buf, 1, n, out);
+				length -= n;
+				decoded += n;
 			}
 
-		} else {
-			putchar(c);
+			continue;
+		}
+
+		for (unsigned k = 0; k < count; k++) {
+			fputc(chr, out);
 		}
+
+		decoded += count;
 	}
+
+	trace_end("rle", "decode", start, decoded);
 }
 
-int main(int argc, char *argv[]) {
-	FILE *fp = stdin;
+typedef enum rle_push_state {
+	// the next byte is a literal or an escape
+	RLE_PUSH_BYTE,
+	// after an escape, the count or 0 for stored data
+	RLE_PUSH_COUNT,
+	// the value of a run, or the low byte of a stored length
+	RLE_PUSH_VALUE,
+	RLE_PUSH_STORED_HIGH,
+	// `remaining` bytes of stored data or of a run still to go
+	RLE_PUSH_STORED,
+	RLE_PUSH_RUN,
+} rle_push_state_t;
 
-	if (argc < 2) {
-		// TODO
-		return 0;
-	}
+struct rle_push {
+	rle_push_state_t state;
+	uint8_t count;
+	uint8_t value;
+	size_t remaining;
+};
+
+rle_push_t *rle_push_create(void) {
+	return calloc(1, sizeof(rle_push_t));
+}
+
+void rle_push_free(rle_push_t *dec) {
+	free(dec);
+}
+
+void rle_push_reset(rle_push_t *dec) {
+	memset(dec, 0, sizeof(rle_push_t));
+}
+
+bool rle_push_pending(const rle_push_t *dec) {
+	return dec->state != RLE_PUSH_BYTE;
+}
+
+// no bit stream here, every state only needs the next byte so the input
+// is decoded in place
+push_status_t rle_push_decode(rle_push_t *dec,
+                              const uint8_t *in,
+                              size_t length,
+                              size_t *used,
+                              uint8_t *out,
+                              size_t size,
+                              size_t *written)
+{
+	push_status_t ret = PUSH_NEED_INPUT;
+	size_t i = 0, o = 0;
+
+	while (ret == PUSH_NEED_INPUT) {
+		if (dec->state == RLE_PUSH_RUN || dec->state == RLE_PUSH_STORED) {
+			size_t n = (dec->remaining < size - o)? dec->remaining : size - o;
+
+			if (dec->state == RLE_PUSH_STORED) {
+				n = (n < length - i)? n : length - i;
+				memcpy(out + o, in + i, n);
+				i += n;
+
+			} else {
+				memset(out + o, dec->value, n);
+			}
+
+			o += n;
+			dec->remaining -= n;
+
+			if (dec->remaining == 0) {
+				dec->state = RLE_PUSH_BYTE;
+			} else if (o == size) {
+				ret = PUSH_MORE_OUTPUT;
+			} else {
+				break;
+			}
+
+			continue;
+		}
 
-	if (strcmp(argv[1], "-e") == 0) {
-		encode(fp);
+		if (i == length) {
+			break;
+		}
+
+		uint8_t c = in[i];
+
+		switch (dec->state) {
+			case RLE_PUSH_BYTE:
+				if (c == RLE_ESCAPE) {
+					dec->state = RLE_PUSH_COUNT;
+				} else if (o < size) {
+					out[o++] = c;
+				} else {
+					ret = PUSH_MORE_OUTPUT;
+					continue;
+				}
+				break;
 
-	} else if (strcmp(argv[1], "-d") == 0) {
-		decode(fp);
+			case RLE_PUSH_COUNT:
+				dec->count = c;
+				dec->state = RLE_PUSH_VALUE;
+				break;
+
+			case RLE_PUSH_VALUE:
+				// a count of 0 is stored data, `c` is the low byte of the
+				// length
+				dec->value = c;
+				dec->remaining = dec->count? dec->count : c;
+				dec->state = dec->count? RLE_PUSH_RUN : RLE_PUSH_STORED_HIGH;
+				break;
+
+			case RLE_PUSH_STORED_HIGH:
+				dec->remaining |= (size_t)c << 8;
+				dec->state = RLE_PUSH_STORED;
+				break;
+
+			default:
+				break;
+		}
 
-	} else {
-		// TODO
+		i++;
 	}
 
-	return 0;
+	*used = i;
+	*written = o;
+	return ret;
 }
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hz/rle.h>
+#include <hz/iostage.h>
+#include <hz/trace.h>
+
+int main(int argc, char *argv[]) {
+	trace_init();
+
+	if (argc < 2) {
+		// TODO
+		return 0;
+	}
+
+	FILE *fp = iostage_open_reader(STDIN_FILENO);
+	FILE *out = iostage_open_writer(STDOUT_FILENO);
+
+	if (!fp || !out) {
+		fprintf(stderr, "error: couldn't start I/O threads\n");
+		return 1;
+	}
+
+	if (strcmp(argv[1], "-e") == 0) {
+		rle_encode(fp, out);
+
+	} else if (strcmp(argv[1], "-d") == 0) {
+		rle_decode(fp, out);
+
+	} else {
+		// TODO
+	}
+
+	fclose(fp);
+
+	if (fclose(out) != 0) {
+		fprintf(stderr, "error: couldn't write output\n");
+		return 1;
+	}
+
+	return 0;
+}
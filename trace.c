@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include <hz/trace.h>
+
+// most distinct stages the summary keeps track of, later ones are dropped
+#define TRACE_MAX_STAGES 64
+
+typedef struct trace_stage {
+	const char *cat;
+	const char *name;
+	uint64_t calls;
+	uint64_t ns;
+	uint64_t bytes;
+} trace_stage_t;
+
+typedef struct trace_event {
+	const char *cat;
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+	uint64_t bytes;
+	pid_t tid;
+} trace_event_t;
+
+bool trace_active = false;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_stage_t stages[TRACE_MAX_STAGES];
+static unsigned stage_count = 0;
+
+// only kept when writing a chrome trace
+static const char *trace_path = NULL;
+static trace_event_t *events = NULL;
+static size_t event_count = 0;
+static size_t event_space = 0;
+
+// timestamps in the chrome trace are relative to this
+static uint64_t trace_epoch = 0;
+
+uint64_t trace_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static trace_stage_t *find_stage(const char *cat, const char *name) {
+	for (unsigned i = 0; i < stage_count; i++) {
+		if (strcmp(stages[i].cat, cat) == 0
+		    && strcmp(stages[i].name, name) == 0)
+		{
+			return stages + i;
+		}
+	}
+
+	if (stage_count == TRACE_MAX_STAGES) {
+		return NULL;
+	}
+
+	stages[stage_count] = (trace_stage_t) { .cat = cat, .name = name };
+	return stages + stage_count++;
+}
+
+void trace_record(const char *cat, const char *name,
+                  uint64_t start, uint64_t bytes)
+{
+	uint64_t end = trace_now();
+
+	pthread_mutex_lock(&trace_lock);
+	trace_stage_t *stage = find_stage(cat, name);
+
+	if (stage) {
+		stage->calls++;
+		stage->ns += end - start;
+		stage->bytes += bytes;
+	}
+
+	if (trace_path) {
+		if (event_count == event_space) {
+			event_space = event_space? event_space * 2 : 1024;
+			events = realloc(events, event_space * sizeof(trace_event_t));
+		}
+
+		events[event_count++] = (trace_event_t) {
+			.cat = cat,
+			.name = name,
+			.start = start,
+			.end = end,
+			.bytes = bytes,
+			.tid = syscall(SYS_gettid),
+		};
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+}
+
+static void print_summary(void) {
+	fprintf(stderr, "%-24s %8s %12s %14s %10s\n",
+	        "stage", "calls", "ms", "bytes", "MB/s");
+
+	for (unsigned i = 0; i < stage_count; i++) {
+		trace_stage_t *stage = stages + i;
+		char name[64];
+
+		snprintf(name, sizeof(name), "%s/%s", stage->cat, stage->name);
+		fprintf(stderr, "%-24s %8lu %12.3f %14lu",
+		        name, (unsigned long)stage->calls, stage->ns / 1e6,
+		        (unsigned long)stage->bytes);
+
+		if (stage->bytes && stage->ns) {
+			fprintf(stderr, " %10.1f\n", stage->bytes * 1e3 / stage->ns);
+		} else {
+			fprintf(stderr, " %10s\n", "-");
+		}
+	}
+}
+
+static bool write_chrome_trace(const char *path) {
+	FILE *fp = fopen(path, "w");
+
+	if (!fp) {
+		return false;
+	}
+
+	pid_t pid = getpid();
+	fprintf(fp, "{\"traceEvents\":[");
+
+	// complete events, times in microseconds
+	for (size_t i = 0; i < event_count; i++) {
+		trace_event_t *ev = events + i;
+
+		fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+		            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+		            "\"args\":{\"bytes\":%lu}}",
+		        i? "," : "", ev->name, ev->cat,
+		        (ev->start - trace_epoch) / 1e3, (ev->end - ev->start) / 1e3,
+		        (int)pid, (int)ev->tid, (unsigned long)ev->bytes);
+	}
+
+	fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	return fclose(fp) == 0;
+}
+
+static void trace_report(void) {
+	pthread_mutex_lock(&trace_lock);
+
+	if (trace_path) {
+		if (!write_chrome_trace(trace_path)) {
+			fprintf(stderr, "error: couldn't write trace \"%s\"\n", trace_path);
+		}
+
+	} else {
+		print_summary();
+	}
+
+	free(events);
+	events = NULL;
+	event_count = event_space = 0;
+
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_enable(const char *path) {
+	if (!trace_active) {
+		trace_epoch = trace_now();
+		atexit(trace_report);
+	}
+
+	trace_path = path;
+	trace_active = true;
+}
+
+void trace_init(void) {
+	const char *env = getenv("HZ_TRACE");
+
+	if (!env || !*env || strcmp(env, "0") == 0) {
+		return;
+	}
+
+	trace_enable(strcmp(env, "1") == 0? NULL : env);
+}